@@ -0,0 +1,139 @@
+/*
+ * (c) 1998-2018 by Columbia University; all rights reserved
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifndef WIN32
+#include <netinet/in.h>
+#include <err.h>
+#endif
+
+#include "sysdep.h"
+#include "filter.h"
+
+
+/*
+* Add the comma-separated numbers in 's' to filter 'f' for 'term'.
+* Payload types may be given as ranges "lo-hi". Return 0 on success.
+*/
+static int filter_list(filter_t *f, const char *term, char *s)
+{
+  char *end;
+  unsigned long lo, hi;
+
+  do {
+    errno = 0;
+    lo = hi = strtoul(s, &end, 0);
+    if (end == s || errno) return -1;
+    if (term[0] == 'p' && *end == '-') {
+      s = end + 1;
+      hi = strtoul(s, &end, 0);
+      if (end == s || hi < lo) return -1;
+    }
+    if (*end != ',' && *end != '\0') return -1;
+    if (term[0] == 's') {
+      if (lo > 0xffffffffUL || f->nssrc == FILTER_SSRC_MAX) return -1;
+      f->ssrc[f->nssrc++] = lo;
+    }
+    else {
+      if (hi > 127) return -1;
+      for (; lo <= hi; lo++) {
+        if (f->pt_set[lo]) continue;
+        f->pt_set[lo] = 1;
+        f->pt[f->npt++] = lo;
+      }
+    }
+    s = end + 1;
+  } while (*end == ',');
+  return 0;
+} /* filter_list */
+
+
+/*
+* Add filter expression 'expr' to 'f': a list of the terms "rtp",
+* "rtcp", "ssrc=<ssrc>[,<ssrc>...]" and "pt=<pt>[-<pt>][,...]"
+* separated by white space. 'expr' is modified. Return 0 on success.
+*/
+int filter_parse(filter_t *f, char *expr)
+{
+  char *term;
+
+  if (!f->on) f->kinds = 3;
+  f->on = 1;
+  for (term = strtok(expr, " \t"); term; term = strtok(NULL, " \t")) {
+    if (strcmp(term, "rtp") == 0 || strcmp(term, "rtcp") == 0) {
+      if (!f->kinds_given) f->kinds = 0;
+      f->kinds_given = 1;
+      f->kinds |= term[3] ? 2 : 1;
+    }
+    else if (strncmp(term, "ssrc=", 5) == 0) {
+      if (filter_list(f, term, term + 5)) goto bad;
+    }
+    else if (strncmp(term, "pt=", 3) == 0) {
+      if (filter_list(f, term, term + 3)) goto bad;
+    }
+    else goto bad;
+  }
+  return 0;
+
+bad:
+  warnx("invalid filter term: %s", term);
+  return -1;
+} /* filter_parse */
+
+
+/*
+* Return whether packet 'buf' of 'len' bytes (RTCP if 'ctrl') passes
+* filter 'f'.
+*/
+int filter_match(const filter_t *f, int ctrl, const char *buf, int len)
+{
+  uint32_t ssrc;
+  int i;
+
+  if (!(f->kinds & (1 << ctrl))) return 0;
+  if (!ctrl && f->npt) {
+    if (len < 12 || !f->pt_set[buf[1] & 0x7f]) return 0;
+  }
+  if (f->nssrc) {
+    if (len < (ctrl ? 8 : 12)) return 0;
+    memcpy(&ssrc, buf + (ctrl ? 4 : 8), sizeof(ssrc));
+    ssrc = ntohl(ssrc);
+    for (i = 0; i < f->nssrc; i++) {
+      if (f->ssrc[i] == ssrc) return 1;
+    }
+    return 0;
+  }
+  return 1;
+} /* filter_match */
@@ -0,0 +1,53 @@
+/*
+ * (c) 1998-2018 by Columbia University; all rights reserved
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+* Packet filter of rtpdump -e and rtpslice -m: a packet is kept only if
+* it matches all given terms. The SSRC of an RTCP packet is that of the
+* sender of its first report; the payload type only applies to RTP
+* packets. A zeroed filter_t is empty; filter_match() must not be
+* called for one that is not 'on'.
+*/
+#define FILTER_SSRC_MAX 64
+
+typedef struct filter {
+  int on;
+  int kinds;                        /* bit 0: RTP, bit 1: RTCP */
+  int kinds_given;                  /* "rtp" or "rtcp" was a term */
+  int nssrc;
+  uint32_t ssrc[FILTER_SSRC_MAX];
+  int npt;
+  unsigned char pt[128];            /* payload types, in order given */
+  unsigned char pt_set[128];        /* pt_set[t]: t is in pt[] */
+} filter_t;
+
+extern int filter_parse(filter_t *f, char *expr);
+extern int filter_match(const filter_t *f, int ctrl, const char *buf,
+  int len);
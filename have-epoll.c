@@ -0,0 +1,17 @@
+#include <sys/epoll.h>
+#include <unistd.h>
+
+int
+main(void)
+{
+	struct epoll_event ev;
+	int fd;
+
+	if ((fd = epoll_create(1)) < 0)
+		return 1;
+	ev.events = EPOLLIN;
+	ev.data.fd = 0;
+	epoll_ctl(fd, EPOLL_CTL_ADD, 0, &ev);
+	close(fd);
+	return 0;
+}
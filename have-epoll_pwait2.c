@@ -0,0 +1,20 @@
+#include <sys/epoll.h>
+#include <time.h>
+#include <unistd.h>
+
+int
+main(void)
+{
+	struct epoll_event ev;
+	struct timespec ts;
+	int fd;
+
+	if ((fd = epoll_create(1)) < 0)
+		return 1;
+	ts.tv_sec = 0;
+	ts.tv_nsec = 1000;
+	if (epoll_pwait2(fd, &ev, 1, &ts, NULL) < 0)
+		return 1;
+	close(fd);
+	return 0;
+}
@@ -0,0 +1,13 @@
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+int
+main(void)
+{
+	struct io_uring_buf_reg reg;
+	struct io_uring_recvmsg_out out;
+
+	reg.ring_entries = IORING_REGISTER_PBUF_RING;
+	out.payloadlen = IORING_RECV_MULTISHOT;
+	return __NR_io_uring_setup < 0 || reg.ring_entries == out.payloadlen;
+}
@@ -0,0 +1,24 @@
+#include <pthread.h>
+#include <unistd.h>
+
+static void *
+run(void *arg)
+{
+	return arg;
+}
+
+int
+main(void)
+{
+	static int arg;
+	pthread_t t;
+	void *ret;
+
+	if (sysconf(_SC_NPROCESSORS_ONLN) < 1)
+		return 1;
+	if (pthread_create(&t, NULL, run, &arg) != 0)
+		return 1;
+	if (pthread_join(t, &ret) != 0)
+		return 1;
+	return ret != &arg;
+}
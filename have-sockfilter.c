@@ -0,0 +1,24 @@
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <linux/filter.h>
+#include <unistd.h>
+
+int
+main(void)
+{
+	struct sock_filter insn[] = {
+		BPF_STMT(BPF_RET | BPF_K, 0)
+	};
+	struct sock_fprog prog;
+	int fd;
+
+	if ((fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+		return 1;
+	prog.len = 1;
+	prog.filter = insn;
+	if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog,
+	    sizeof(prog)) < 0)
+		return 1;
+	close(fd);
+	return 0;
+}
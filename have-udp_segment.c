@@ -0,0 +1,18 @@
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <unistd.h>
+
+int
+main(void)
+{
+	int fd, size = 1000;
+
+	if ((fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+		return 1;
+	if (setsockopt(fd, SOL_UDP, UDP_SEGMENT, &size, sizeof(size)) < 0)
+		return 1;
+	close(fd);
+	return 0;
+}
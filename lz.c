@@ -0,0 +1,189 @@
+/*
+ * (c) 1998-2018 by Columbia University; all rights reserved
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * LZ77 codec for compressed rtpdump files; see lz.h for the format.
+ *
+ * The compressor finds matches through a hash table of the positions of
+ * recent 4-byte sequences, and takes the first candidate that matches.
+ * The longer it finds nothing, the larger its steps, so that data that
+ * does not compress, such as encrypted payload, passes quickly.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "lz.h"
+
+#define LZ_HASH_BITS  12
+#define LZ_SKIP_BITS  6           /* step grows every 64 bytes without match */
+
+
+static uint32_t read32(const unsigned char *p)
+{
+  uint32_t v;
+
+  memcpy(&v, p, sizeof(v));
+  return v;
+} /* read32 */
+
+
+static unsigned hash(uint32_t v)
+{
+  return (v * 2654435761U) >> (32 - LZ_HASH_BITS);
+} /* hash */
+
+
+/*
+* Write count 'n', of which the token holds up to 15, as continuation
+* bytes.
+*/
+static unsigned char *put_count(unsigned char *op, int n)
+{
+  for (n -= 15; n >= 255; n -= 255) *op++ = 255;
+  *op++ = n;
+  return op;
+} /* put_count */
+
+
+/*
+* Write a sequence of 'lit' literals at 'src' and, unless 'mlen' is 0,
+* a match of 'mlen' bytes 'dist' bytes back. Return the new end of the
+* output, or NULL if it would pass 'oend'.
+*/
+static unsigned char *put_sequence(unsigned char *op, unsigned char *oend,
+  const unsigned char *src, int lit, int dist, int mlen)
+{
+  int ml = mlen ? mlen - LZ_MIN_MATCH : 0;
+
+  /* worst case: token, counts, literals, distance */
+  if (oend - op < 1 + lit + lit / 255 + 1 + 2 + ml / 255 + 1) return NULL;
+  *op++ = ((lit < 15 ? lit : 15) << 4) | (ml < 15 ? ml : 15);
+  if (lit >= 15) op = put_count(op, lit);
+  memcpy(op, src, lit);
+  op += lit;
+  if (mlen) {
+    *op++ = dist & 0xff;
+    *op++ = dist >> 8;
+    if (ml >= 15) op = put_count(op, ml);
+  }
+  return op;
+} /* put_sequence */
+
+
+int lz_compress(const unsigned char *src, int n, unsigned char *dst,
+  int size)
+{
+  int table[1 << LZ_HASH_BITS];
+  unsigned char *op = dst, *oend = dst + size;
+  int ip = 0, anchor = 0, i;
+
+  for (i = 0; i < (1 << LZ_HASH_BITS); i++) table[i] = -1;
+
+  while (ip + LZ_MIN_MATCH <= n) {
+    uint32_t v = read32(src + ip);
+    unsigned h = hash(v);
+    int ref = table[h], len;
+
+    table[h] = ip;
+    if (ref < 0 || ip - ref > LZ_MAX_DIST || read32(src + ref) != v) {
+      ip += 1 + ((ip - anchor) >> LZ_SKIP_BITS);
+      continue;
+    }
+
+    /* extend the match forward, and backward over pending literals */
+    for (len = LZ_MIN_MATCH; ip + len < n && src[ref + len] == src[ip + len];
+         len++) ;
+    while (ip > anchor && ref > 0 && src[ip - 1] == src[ref - 1]) {
+      ip--;
+      ref--;
+      len++;
+    }
+    if (!(op = put_sequence(op, oend, src + anchor, ip - anchor, ip - ref,
+      len))) return 0;
+    ip += len;
+    anchor = ip;
+    /* so that runs and repeats right after the match are found */
+    if (ip - 2 >= 0 && ip + 2 <= n) table[hash(read32(src + ip - 2))] = ip - 2;
+  }
+  if (!(op = put_sequence(op, oend, src + anchor, n - anchor, 0, 0)))
+    return 0;
+  return op - dst;
+} /* lz_compress */
+
+
+/*
+* Read a count continued after the token at 'src[*ip]'. Return -1 if
+* the input ends first.
+*/
+static int get_count(const unsigned char *src, int n, int *ip, int count)
+{
+  int b;
+
+  do {
+    if (*ip >= n) return -1;
+    b = src[(*ip)++];
+    count += b;
+  } while (b == 255);
+  return count;
+} /* get_count */
+
+
+int lz_decompress(const unsigned char *src, int n, unsigned char *dst,
+  int size)
+{
+  int ip = 0, op = 0, i;
+
+  while (ip < n) {
+    int token = src[ip++];
+    int lit = token >> 4, len = token & 15, dist;
+
+    if (lit == 15 && (lit = get_count(src, n, &ip, lit)) < 0) return -1;
+    if (lit > n - ip || lit > size - op) return -1;
+    memcpy(dst + op, src + ip, lit);
+    ip += lit;
+    op += lit;
+    if (ip == n) break;   /* the last sequence */
+
+    if (n - ip < 2) return -1;
+    dist = src[ip] | (src[ip + 1] << 8);
+    ip += 2;
+    if (len == 15 && (len = get_count(src, n, &ip, len)) < 0) return -1;
+    len += LZ_MIN_MATCH;
+    if (dist == 0 || dist > op || len > size - op) return -1;
+    if (dist >= len) memcpy(dst + op, dst + op - dist, len);
+    else {
+      /* overlapping: a repeat of the last 'dist' bytes */
+      for (i = 0; i < len; i++) dst[op + i] = dst[op - dist + i];
+    }
+    op += len;
+  }
+  return op;
+} /* lz_decompress */
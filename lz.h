@@ -0,0 +1,55 @@
+/*
+ * (c) 1998-2018 by Columbia University; all rights reserved
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * A small LZ77 codec in the manner of LZ4, for the blocks of compressed
+ * rtpdump files. Compressed data is a series of sequences: a token whose
+ * high four bits are the number of literals and whose low four bits are
+ * the match length minus LZ_MIN_MATCH, the literals, a two-byte
+ * little-endian distance back to the match and the match. A count of
+ * 15 is continued in the following bytes, each adding up to 255. The
+ * last sequence only has literals. Both functions are reentrant.
+ */
+#define LZ_MIN_MATCH  4
+#define LZ_MAX_DIST   65535
+
+/*
+* Compress 'n' bytes at 'src' into 'dst' of 'size' bytes. Return the
+* compressed length, or 0 if it would not fit.
+*/
+extern int lz_compress(const unsigned char *src, int n, unsigned char *dst,
+  int size);
+
+/*
+* Decompress 'n' bytes at 'src' into 'dst' of 'size' bytes. Return the
+* decompressed length, or -1 if the data is invalid or does not fit.
+*/
+extern int lz_decompress(const unsigned char *src, int n, unsigned char *dst,
+  int size);
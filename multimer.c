@@ -62,11 +62,15 @@ typedef struct TQE {
     int  which;                 /* type; currently always ITIMER_REAL */
 } TQE;
 
-/* active timer queue, in time order */
-static TQE *timerQ = (TQE *)0;
-
-/* queue of free Timer Queue Elements */
-static TQE *freeTQEQ = (TQE *)0;
+/*
+ * Each event loop has its own timer queue; the functions below use the
+ * queue of the calling thread's current loop (see notify_timers()).
+ */
+struct timer_queue {
+    TQE *timerQ;                /* active timers, in time order */
+    TQE *freeTQEQ;              /* free Timer Queue Elements */
+    int running;                /* timer_get() is running a handler */
+};
 
 #ifndef timeradd
 void timeradd(struct timeval *a, struct timeval *b,
@@ -93,11 +97,11 @@ static int timerless(struct timeval *a, struct timeval *b)
   return 0;
 } /* timerless */
 
-static void timer_check(void)
+static void timer_check(Timer_queue *q)
 {
   register struct TQE *np;
 
-  for (np = timerQ; np; np = np->link) {
+  for (np = q->timerQ; np; np = np->link) {
     assert(np->time.tv_usec < 1000000);
     assert(np->interval.tv_usec < 1000000);
   }
@@ -120,11 +124,12 @@ static void timer_check(void)
 struct timeval *timer_set(struct timeval *interval,
   Notify_func func, Notify_client client, int relative)
 {
+  Timer_queue *q = notify_timers();
   register struct TQE *np, *op, *tp;    /* To scan the timer queue */
 
   /* scan the timer queue to see if client has pending timer */
-  op = (struct TQE *)&timerQ;           /* Fudge OK since link is first */
-  for (np = timerQ; np; op = np, np = np->link)
+  op = (struct TQE *)&q->timerQ;        /* Fudge OK since link is first */
+  for (np = q->timerQ; np; op = np, np = np->link)
     if (np->client == client) {
       op->link = np->link;              /* Yes, remove the timer from Q */
       break;                            /*  and stop the search */
@@ -133,8 +138,8 @@ struct timeval *timer_set(struct timeval *interval,
   /*  if the requested interval is zero, just free the timer  */
   if (interval == 0) {
     if (np) {                   /* If we found a timer, */
-      np->link = freeTQEQ;      /* link TQE at head of free Q */
-      freeTQEQ = np;
+      np->link = q->freeTQEQ;   /* link TQE at head of free Q */
+      q->freeTQEQ = np;
     }
     return 0;                   /* return, no timer set */
   }
@@ -142,14 +147,14 @@ struct timeval *timer_set(struct timeval *interval,
   /*  nonzero interval, calculate new expiration time  */
   if (!(tp = np)) {     /* If no previous timer, get a TQE */
     /* allocate timer */
-    if (!freeTQEQ) {
-      freeTQEQ = (TQE *)malloc(sizeof(TQE));
-      freeTQEQ->link = (TQE *)0;
-      freeTQEQ->interval.tv_usec = 0;
-      freeTQEQ->interval.tv_sec  = 0;
+    if (!q->freeTQEQ) {
+      q->freeTQEQ = (TQE *)malloc(sizeof(TQE));
+      q->freeTQEQ->link = (TQE *)0;
+      q->freeTQEQ->interval.tv_usec = 0;
+      q->freeTQEQ->interval.tv_sec  = 0;
     }
-    tp = freeTQEQ;
-    freeTQEQ = tp->link;
+    tp = q->freeTQEQ;
+    q->freeTQEQ = tp->link;
   }
 
   /* calculate expiration time */
@@ -167,14 +172,21 @@ struct timeval *timer_set(struct timeval *interval,
   tp->which  = ITIMER_REAL;
 
   /*  insert new timer into timer queue  */
-  op = (struct TQE *)&timerQ;           /* fudge OK since link is first */
-  for (np = timerQ; np; op = np, np=np->link) {
+  op = (struct TQE *)&q->timerQ;        /* fudge OK since link is first */
+  for (np = q->timerQ; np; op = np, np=np->link) {
     if (timerless(&tp->time, &np->time)) break;
   }
   op->link = tp;    /* point prev TQE to new one */
   tp->link = np;    /* point new TQE to next one */
 
-  timer_check(); /*DEBUG*/
+  /*
+   * A new earliest timer shortens the time the notifier may block.
+   * While timer_get() runs a handler, it looks at the head of the
+   * queue again afterwards, so no wakeup is needed.
+   */
+  if (q->timerQ == tp && !q->running) notify_wakeup();
+
+  timer_check(q); /*DEBUG*/
   return &(tp->interval);
 } /* timer_set */
 
@@ -191,36 +203,46 @@ struct timeval *timer_set(struct timeval *interval,
 */
 struct timeval *timer_get(struct timeval *timeout)
 {
+  Timer_queue *q = notify_timers();
   register struct TQE *tp;      /* to scan the timer queue */
   struct timeval now;           /* current time */
+  struct timeval due;           /* expiration time of timer run */
 
-  timer_check(); /*DEBUG*/
+  timer_check(q); /*DEBUG*/
   for (;;) {
     /* return null pointer if there is no timer pending. */
-    if (!timerQ) return (struct timeval *)0;
+    if (!q->timerQ) {
+      q->running = 0;
+      return (struct timeval *)0;
+    }
 
     /* check head of timer queue to see if timer has expired */
     (void) gettimeofday(&now, NULL);
-    if (timerless(&now, &timerQ->time)) { /* unexpired, calc timeout */
-      timeout->tv_sec  = timerQ->time.tv_sec  - now.tv_sec;
-      timeout->tv_usec = timerQ->time.tv_usec - now.tv_usec;
+    if (timerless(&now, &q->timerQ->time)) { /* unexpired, calc timeout */
+      timeout->tv_sec  = q->timerQ->time.tv_sec  - now.tv_sec;
+      timeout->tv_usec = q->timerQ->time.tv_usec - now.tv_usec;
       if (timeout->tv_usec < 0) {
         timeout->tv_usec += 1000000L;
         --timeout->tv_sec;
       }
       assert(timeout->tv_usec < 1000000);
+      q->running = 0;
       return timeout;     /* timeout until timer expires */
     } else {              /* head timer has expired, */
-      tp = timerQ;        /* so remove it from the */
-      timerQ = tp->link;  /* timer queue, */
-      tp->link = freeTQEQ;
-      freeTQEQ = tp;
+      tp = q->timerQ;     /* so remove it from the */
+      q->timerQ = tp->link; /* timer queue, */
+      tp->link = q->freeTQEQ;
+      q->freeTQEQ = tp;
+      due = tp->time;
+      /* a nested timer_get() clears this when it returns */
+      q->running = 1;
       /* restart timer (absolute) */
       if (tp->interval.tv_sec || tp->interval.tv_usec) {
         timeradd(&tp->interval, &tp->time, &tp->time);
         timer_set(&tp->time, tp->func, tp->client, 0);
       }
       (*(tp->func))(tp->client); /* call the event handler */
+      notify_timer_ran(&due, &now);
     }
   } /* loop to see if another timer expired */
 } /* timer_get */
@@ -231,5 +253,34 @@ struct timeval *timer_get(struct timeval *timeout)
 */
 int timer_pending(void)
 {
-  return timerQ != 0;
+  return notify_timers()->timerQ != 0;
 } /* timer_pending */
+
+
+/*
+* Create an empty timer queue.
+*/
+Timer_queue *timer_queue_create(void)
+{
+  return (Timer_queue *)calloc(1, sizeof(Timer_queue));
+} /* timer_queue_create */
+
+
+/*
+* Free timer queue 'q' with all its timers.
+*/
+void timer_queue_destroy(Timer_queue *q)
+{
+  TQE *tp;
+
+  if (!q) return;
+  while ((tp = q->timerQ)) {
+    q->timerQ = tp->link;
+    free(tp);
+  }
+  while ((tp = q->freeTQEQ)) {
+    q->freeTQEQ = tp->link;
+    free(tp);
+  }
+  free(q);
+} /* timer_queue_destroy */
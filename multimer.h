@@ -2,3 +2,20 @@ extern struct timeval *timer_set(struct timeval *interval,
   Notify_func func, Notify_client client, int relative);
 extern struct timeval *timer_get(struct timeval *timeout);
 extern int timer_pending(void);
+
+/*
+ * Timer queue of an event loop. timer_set(), timer_get() and
+ * timer_pending() operate on the queue returned by notify_timers(),
+ * that of the calling thread's current loop.
+ */
+typedef struct timer_queue Timer_queue;
+
+extern Timer_queue *timer_queue_create(void);
+extern void timer_queue_destroy(Timer_queue *q);
+extern Timer_queue *notify_timers(void);
+
+/*
+ * Called by timer_get() after a timer handler ran, for the loop
+ * statistics (see notify_stats()).
+ */
+extern void notify_timer_ran(struct timeval *due, struct timeval *start);
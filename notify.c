@@ -10,36 +10,184 @@ Copyright 1993 by AT&T Bell Laboratories; all rights reserved
 #include <signal.h>
 #include <stdio.h>
 #include <errno.h>
+#include <stdint.h>
 
 #ifndef WIN32
 #include <sys/select.h>
 #include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <fcntl.h>
+#include <unistd.h>
 #endif
 
 #include "sysdep.h"
 #include "notify.h"
 #include "multimer.h"
 
+#if HAVE_EPOLL
+#include <sys/epoll.h>
+#endif
+#if HAVE_IO_URING
+#include "uring.h"
+#endif
+#if HAVE_UDP_SEGMENT
+#include <sys/uio.h>
+#include <netinet/udp.h>
+#endif
+
 #ifdef hp
 #define CAST int *
 #else
 #define CAST fd_set *
 #endif
 
+/* storage class of the per-thread current loop */
+#if defined(_MSC_VER)
+#define THREAD_LOCAL __declspec(thread)
+#elif defined(__GNUC__)
+#define THREAD_LOCAL __thread
+#else
+#define THREAD_LOCAL    /* all threads share one current loop */
+#endif
+
+#if HAVE_EPOLL
+#define EPOLL_BATCH 64  /* events returned per epoll_wait() */
+#endif
+
+#define HIST_BUCKETS 24 /* bucket i counts times below 2^i usec */
+
+#if HAVE_UDP_SEGMENT
+#define GSO_SEGMENTS 64     /* UDP_MAX_SEGMENTS of older kernels */
+#define GSO_MAX 65000       /* bytes per send, within the UDP limit */
+
+/*
+ * Datagrams coalesced for one send with UDP generic segmentation
+ * offload: 'n' datagrams of 'seg' bytes for socket 'fd', the last one
+ * possibly shorter, to 'to' if 'has_to'.
+ */
+typedef struct gso_t {
+  int fd;
+  int has_to;
+  struct sockaddr_in to;
+  int seg, n, len;
+  char buf[GSO_MAX];
+} gso_t;
+#endif
+
+/*
+ * Log-bucketed histogram of times in microseconds.
+ */
+typedef struct hist_t {
+  unsigned long n;      /* samples */
+  double sum;           /* total, usec */
+  long max;             /* largest sample, usec */
+  unsigned long b[HIST_BUCKETS];
+} hist_t;
+
 typedef struct event_t {
   struct event_t *next;
   Notify_client client;
   Notify_func_input func;
+  Notify_func output_func;
+  Notify_func_recv recv_func;
   int fd;
-  enum type_t {N_input, N_itimer} type;
+  int uring;            /* input is received through io_uring */
+  unsigned long drops;  /* SO_RXQ_OVFL counter of last datagram */
+  enum type_t {N_input, N_output, N_itimer} type;
+  hist_t run;           /* handler run time, if statistics are on */
 } event_t;
 
-static event_t *el;   /* event list */
-static int max_fd;    /* highest file descriptor used */
-static fd_set Readfds, Writefds, Exceptfds;
-static int stop;
+/*
+ * Statistics of a loop, see notify_stats(). Time is divided into
+ * waiting for events ('blocked') and everything else ('busy'); the
+ * counters of the last stats line are kept in 'prev'.
+ */
+typedef struct loop_stats {
+  int interval;                 /* seconds between stats lines, or 0 */
+  struct timeval start;         /* statistics enabled */
+  struct timeval line;          /* last stats line */
+  struct timeval mark;          /* end of last wait or handler */
+  sig_atomic_t signals;         /* report requests handled */
+  struct counts {
+    double busy, blocked;       /* usec */
+    unsigned long wakeups;      /* returns from waiting */
+    unsigned long handlers;     /* handlers called */
+  } c, prev;
+  long late_max;                /* largest timer lateness since line */
+  hist_t late;                  /* timer lateness */
+  hist_t timers;                /* timer handler run time */
+} loop_stats;
+
+/*
+ * All state of an event loop. Handlers and timers are registered with
+ * the current loop of the calling thread.
+ */
+struct notify_loop {
+  event_t *el;          /* event list */
+  int max_fd;           /* highest file descriptor used */
+  fd_set Readfds, Writefds, Exceptfds;
+  volatile sig_atomic_t stop;
+  Timer_queue *timers;
+
+  /*
+   * The loop blocks without a timeout when no timer is pending. Calls
+   * to notify_wakeup() (from timer_set(), notify_stop() or a signal
+   * handler) make it recompute its timeout: while the loop is running
+   * handlers ('busy'), a flag is enough; while it is about to block or
+   * blocked, or when called from another thread, a byte is written to
+   * a self-pipe that the loop also waits on.
+   */
+  volatile sig_atomic_t busy;
+  volatile sig_atomic_t wake_pending;
+#ifndef WIN32
+  int wake_fd[2];
+#endif
+
+#if HAVE_EPOLL
+  /*
+   * With epoll, each descriptor is registered with the kernel once and
+   * the ready descriptors index 'fdtab' directly, instead of scanning
+   * fd_sets up to max_fd and searching the event list.
+   */
+  int epfd;                           /* epoll instance */
+  struct fdrec {
+    event_t *in, *out;                /* handlers for this descriptor */
+  } *fdtab;
+  int fdtab_len;
+#endif
+
+#if HAVE_IO_URING
+  /*
+   * With io_uring, datagrams for receive handlers arrive through
+   * multishot receives and the loop only waits for the ring's
+   * descriptor to signal completions. Sends are queued and submitted
+   * together.
+   */
+  struct uring *uring;
+  int uring_on;         /* -1: wanted, not tried yet; 0: not used */
+  event_t **urtab;      /* receive handlers by descriptor */
+  int urtab_len;
+  int ring_fd;
+#if HAVE_EPOLL
+  int ring_watched;
+#endif
+#endif
+
+#if HAVE_UDP_SEGMENT
+  gso_t *gso;                         /* NULL unless notify_send_gso() */
+#endif
+
+  loop_stats *stats;                  /* NULL unless notify_stats() */
+  unsigned long frees;                /* events freed, see stat_handler() */
+  char rbuf[NOTIFY_RECV_MAX];         /* receive buffer for input() */
+};
+
+static THREAD_LOCAL Notify_loop *cur;   /* current loop of this thread */
+static Notify_loop *default_loop;
+static volatile sig_atomic_t stats_signals;  /* SIGUSR1 received */
 
-/* signal list */
+/* signal list; signals belong to the process, not to a loop */
 static struct {
     Notify_client client;
     Notify_func_signal signal_func;
@@ -47,7 +195,157 @@ static struct {
 } s[NSIG];
 
 
+/*
+* Create a loop without handlers or timers.
+*/
+Notify_loop *notify_loop_create(void)
+{
+  Notify_loop *lp;
+
+  if (!(lp = (Notify_loop *)calloc(1, sizeof(Notify_loop)))) return 0;
+  if (!(lp->timers = timer_queue_create())) {
+    free(lp);
+    return 0;
+  }
+  FD_ZERO(&lp->Readfds);
+  FD_ZERO(&lp->Writefds);
+  FD_ZERO(&lp->Exceptfds);
+  lp->busy = 1;
+#ifndef WIN32
+  lp->wake_fd[0] = lp->wake_fd[1] = -1;
+#endif
+#if HAVE_EPOLL
+  lp->epfd = -1;
+#endif
+#if HAVE_IO_URING
+  lp->ring_fd  = -1;
+#endif
+  return lp;
+} /* notify_loop_create */
+
+
+/*
+* Free loop 'lp', which must not be running, with its handlers and
+* timers. The descriptors of the handlers are not closed.
+*/
+void notify_loop_destroy(Notify_loop *lp)
+{
+  event_t *e;
+
+  if (!lp) return;
+  while ((e = lp->el)) {
+    lp->el = e->next;
+    free(e);
+  }
+  timer_queue_destroy(lp->timers);
+  free(lp->stats);
+#ifndef WIN32
+  if (lp->wake_fd[0] >= 0) {
+    close(lp->wake_fd[0]);
+    close(lp->wake_fd[1]);
+  }
+#endif
+#if HAVE_EPOLL
+  if (lp->epfd >= 0) close(lp->epfd);
+  free(lp->fdtab);
+#endif
+#if HAVE_IO_URING
+  if (lp->uring) uring_free(lp->uring);
+  free(lp->urtab);
+#endif
+#if HAVE_UDP_SEGMENT
+  free(lp->gso);
+#endif
+  if (cur == lp) cur = 0;
+  if (default_loop == lp) default_loop = 0;
+  free(lp);
+} /* notify_loop_destroy */
+
+
+/*
+* Make 'lp' the current loop of the calling thread; NULL selects the
+* default loop. Return the previous current loop.
+*/
+Notify_loop *notify_loop_use(Notify_loop *lp)
+{
+  Notify_loop *old = cur;
+
+  cur = lp;
+  return old;
+} /* notify_loop_use */
+
+
+/*
+* Return the current loop of the calling thread, creating the default
+* loop on first use.
+*/
+Notify_loop *notify_loop_current(void)
+{
+  if (cur) return cur;
+  if (!default_loop && !(default_loop = notify_loop_create())) {
+    perror("notify_loop_create");
+    exit(1);
+  }
+  return cur = default_loop;
+} /* notify_loop_current */
+
+
+/*
+* Timer queue of the current loop, for multimer.c.
+*/
+Timer_queue *notify_timers(void)
+{
+  return notify_loop_current()->timers;
+} /* notify_timers */
+
+
+/*
+* Microseconds from 'a' to 'b'.
+*/
+static long usec(struct timeval *a, struct timeval *b)
+{
+  return (b->tv_sec - a->tv_sec) * 1000000L + (b->tv_usec - a->tv_usec);
+} /* usec */
+
+
+/*
+* Add 'us' microseconds to histogram 'h'.
+*/
+static void hist_add(hist_t *h, long us)
+{
+  int i;
+
+  if (us < 0) us = 0;
+  for (i = 0; i < HIST_BUCKETS - 1 && us >= (1L << i); i++)
+    ;
+  h->b[i]++;
+  h->n++;
+  h->sum += us;
+  if (us > h->max) h->max = us;
+} /* hist_add */
+
+
+/*
+* Print histogram 'h' as one line, listing non-empty buckets by their
+* upper bound.
+*/
+static void hist_print(const char *name, hist_t *h)
+{
+  int i;
+
+  fprintf(stderr, "notify: %s: %lu, avg %.1f max %ld usec;", name, h->n,
+    h->n ? h->sum / h->n : 0., h->max);
+  for (i = 0; i < HIST_BUCKETS; i++) {
+    if (!h->b[i]) continue;
+    if (i < HIST_BUCKETS - 1) fprintf(stderr, " <%ld:%lu", 1L << i, h->b[i]);
+    else fprintf(stderr, " >=%ld:%lu", 1L << (i - 1), h->b[i]);
+  }
+  fprintf(stderr, "\n");
+} /* hist_print */
+
+
 static event_t *search(
+  Notify_loop *lp,
   Notify_client client,  /* ignored if fd >= 0 */
   int fd,
   enum type_t type,
@@ -57,42 +355,351 @@ static event_t *search(
   event_t *e;
 
   *prev = 0;
-  for (e = el; e; *prev = e, e = e->next) {
+  for (e = lp->el; e; *prev = e, e = e->next) {
     if (e->type == type && e->fd == fd && (fd >= 0 || e->client == client))
       return e;
   }
   return 0;
 } /* search */
 
-/* Clear all three "fd-set"s.
- * This is called only once in the first call for initilaization.
- */
-static void check_clr_fd(void)
+/*
+* Account the time since the last mark as busy, and to handler 'e',
+* called when 'frees' events had been freed. If more have been freed
+* since, 'e' may have removed itself and is not touched.
+*/
+static void stat_handler(Notify_loop *lp, event_t *e, unsigned long frees)
+{
+  loop_stats *st = lp->stats;
+  struct timeval now;
+  long us;
+
+  gettimeofday(&now, NULL);
+  us = usec(&st->mark, &now);
+  if (lp->frees == frees) hist_add(&e->run, us);
+  st->c.busy += us;
+  st->c.handlers++;
+  st->mark = now;
+} /* stat_handler */
+
+
+/*
+* Called by timer_get() after running a timer handler that was due at
+* 'due' and started at 'start'.
+*/
+void notify_timer_ran(struct timeval *due, struct timeval *start)
+{
+  Notify_loop *lp = notify_loop_current();
+  loop_stats *st = lp->stats;
+  struct timeval now;
+  long late;
+
+  if (!st) return;
+  gettimeofday(&now, NULL);
+  late = usec(due, start);
+  hist_add(&st->late, late);
+  if (late > st->late_max) st->late_max = late;
+  hist_add(&st->timers, usec(start, &now));
+  st->c.busy += usec(&st->mark, &now);  /* from the wakeup, with the run */
+  st->c.handlers++;
+  st->mark = now;
+} /* notify_timer_ran */
+
+
+/*
+* Print a full report of the statistics of 'lp'.
+*/
+static void stats_report(Notify_loop *lp)
+{
+  loop_stats *st = lp->stats;
+  struct timeval now;
+  event_t *e;
+  char name[32];
+  double t = st->c.busy + st->c.blocked;
+
+  gettimeofday(&now, NULL);
+  fprintf(stderr, "notify: %.3f s, %lu wakeups (%.1f/s), "
+    "%.2f handlers/wakeup, %.1f%% busy\n",
+    usec(&st->start, &now) / 1e6, st->c.wakeups,
+    t > 0 ? st->c.wakeups * 1e6 / t : 0.,
+    st->c.wakeups ? (double)st->c.handlers / st->c.wakeups : 0.,
+    t > 0 ? 100 * st->c.busy / t : 0.);
+  if (st->timers.n) {
+    hist_print("timer lateness", &st->late);
+    hist_print("timer handlers", &st->timers);
+  }
+  for (e = lp->el; e; e = e->next) {
+    if (!e->run.n) continue;
+    sprintf(name, "fd %d %s", e->fd, e->type == N_output ? "output" :
+      e->recv_func ? "recv" : "input");
+    hist_print(name, &e->run);
+  }
+} /* stats_report */
+
+
+/*
+* Print the stats line if it is due, or the full report if requested,
+* and account the time since the last mark as busy. Return the timeout
+* 'tvp', shortened to the next stats line.
+*/
+static struct timeval *stats_poll(Notify_loop *lp, struct timeval *tvp,
+  struct timeval *timeout)
+{
+  loop_stats *st = lp->stats;
+  struct timeval now;
+  long next;
+
+  gettimeofday(&now, NULL);
+  st->c.busy += usec(&st->mark, &now);
+  st->mark = now;
+
+  if (st->signals != stats_signals) {
+    st->signals = stats_signals;
+    stats_report(lp);
+  }
+  if (!st->interval) return tvp;
+
+  next = st->interval * 1000000L - usec(&st->line, &now);
+  if (next <= 0) {
+    struct counts d;
+    double t;
+
+    d.busy     = st->c.busy     - st->prev.busy;
+    d.blocked  = st->c.blocked  - st->prev.blocked;
+    d.wakeups  = st->c.wakeups  - st->prev.wakeups;
+    d.handlers = st->c.handlers - st->prev.handlers;
+    t = d.busy + d.blocked;
+    fprintf(stderr, "notify: %.1f wakeups/s, %.2f handlers/wakeup, "
+      "%.1f%% busy", t > 0 ? d.wakeups * 1e6 / t : 0.,
+      d.wakeups ? (double)d.handlers / d.wakeups : 0.,
+      t > 0 ? 100 * d.busy / t : 0.);
+    if (st->late_max >= 0)
+      fprintf(stderr, ", timers late max %ld usec", st->late_max);
+    fprintf(stderr, "\n");
+    st->prev = st->c;
+    st->late_max = -1;
+    st->line = now;
+    next = st->interval * 1000000L;
+  }
+  if (!tvp || tvp->tv_sec * 1000000L + tvp->tv_usec > next) {
+    timeout->tv_sec  = next / 1000000L;
+    timeout->tv_usec = next % 1000000L;
+    tvp = timeout;
+  }
+  return tvp;
+} /* stats_poll */
+
+
+/*
+* Account the time since the last mark as blocked after a wakeup.
+*/
+static void stats_woke(Notify_loop *lp)
+{
+  struct timeval now;
+
+  gettimeofday(&now, NULL);
+  lp->stats->c.blocked += usec(&lp->stats->mark, &now);
+  lp->stats->c.wakeups++;
+  lp->stats->mark = now;
+} /* stats_woke */
+
+
+/*
+* SIGUSR1: have the loops print their reports.
+*/
+static Notify_value stats_signal(Notify_client client, int sig,
+  Notify_signal_mode mode)
+{
+  stats_signals++;
+  notify_wakeup();
+  return NOTIFY_DONE;
+} /* stats_signal */
+
+
+/*
+* Collect statistics for the current loop.
+*/
+void notify_stats(int interval)
 {
-  static int cleared = -1;
+  Notify_loop *lp = notify_loop_current();
 
-  if (cleared == -1) {
-    FD_ZERO(&Readfds);
-    FD_ZERO(&Writefds);
-    FD_ZERO(&Exceptfds);
-    cleared = 0;  /* set for only once */
+  if (!lp->stats) {
+    if (!(lp->stats = (loop_stats *)calloc(1, sizeof(loop_stats)))) {
+      perror("notify_stats");
+      return;
+    }
+    gettimeofday(&lp->stats->start, NULL);
+    lp->stats->line = lp->stats->mark = lp->stats->start;
+    lp->stats->late_max = -1;
+    lp->stats->signals = stats_signals;
+#ifdef SIGUSR1
+    notify_set_signal_func(0, stats_signal, SIGUSR1, NOTIFY_ASYNC);
+#endif
   }
-}
+  lp->stats->interval = interval;
+} /* notify_stats */
+
+
+/*
+* Print the statistics of the current loop.
+*/
+void notify_stats_report(void)
+{
+  Notify_loop *lp = notify_loop_current();
+
+  if (lp->stats) stats_report(lp);
+} /* notify_stats_report */
+
+
+#if HAVE_EPOLL
+/*
+* Create the epoll instance on first use.
+*/
+static int epoll_init(Notify_loop *lp)
+{
+  if (lp->epfd < 0 && (lp->epfd = epoll_create(EPOLL_BATCH)) < 0) {
+    perror("epoll_create");
+    return -1;
+  }
+  return 0;
+} /* epoll_init */
+#endif
+
+#if HAVE_IO_URING
+/*
+* Enter (on = 1) or remove receive event 'e' in the table by which
+* uring_input() finds it.
+*/
+static void uring_index(Notify_loop *lp, event_t *e, int on)
+{
+  int fd = e->fd;
+
+  if (fd >= lp->urtab_len) {
+    int len = lp->urtab_len ? lp->urtab_len : 64;
+    event_t **t;
+
+    if (!on) return;
+    while (len <= fd) len *= 2;
+    if (!(t = (event_t **)realloc(lp->urtab, len * sizeof(*t)))) {
+      perror("watch");
+      return;
+    }
+    memset(t + lp->urtab_len, 0, (len - lp->urtab_len) * sizeof(*t));
+    lp->urtab = t;
+    lp->urtab_len = len;
+  }
+  lp->urtab[fd] = on ? e : 0;
+} /* uring_index */
+#endif
+
+
+/*
+* Start (on = 1) or stop (on = 0) waiting for input or output event 'e'.
+*/
+static void watch(Notify_loop *lp, event_t *e, int on)
+{
+#if HAVE_EPOLL
+  struct epoll_event ev;
+  int fd = e->fd;
+  int had, op;
+#endif
+
+#if HAVE_IO_URING
+  if (e->uring) {
+    if (!on) uring_recv_cancel(lp->uring, e->fd);
+    uring_index(lp, e, on);
+    return;
+  }
+#endif
+#if HAVE_EPOLL
+  if (epoll_init(lp) < 0) return;
+  if (fd >= lp->fdtab_len) {
+    int len = lp->fdtab_len ? lp->fdtab_len : 64;
+    struct fdrec *t;
+
+    while (len <= fd) len *= 2;
+    if (!(t = (struct fdrec *)realloc(lp->fdtab, len * sizeof(*t)))) {
+      perror("watch");
+      return;
+    }
+    memset(t + lp->fdtab_len, 0, (len - lp->fdtab_len) * sizeof(*t));
+    lp->fdtab = t;
+    lp->fdtab_len = len;
+  }
+
+  had = lp->fdtab[fd].in || lp->fdtab[fd].out;
+  if (e->type == N_input) lp->fdtab[fd].in  = on ? e : 0;
+  else                    lp->fdtab[fd].out = on ? e : 0;
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events  = (lp->fdtab[fd].in  ? EPOLLIN  : 0) |
+               (lp->fdtab[fd].out ? EPOLLOUT : 0);
+  ev.data.fd = fd;
+  if (!ev.events) op = EPOLL_CTL_DEL;
+  else op = had ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+  if (epoll_ctl(lp->epfd, op, fd, &ev) < 0) perror("epoll_ctl");
+#else
+  fd_set *set = e->type == N_input ? &lp->Readfds : &lp->Writefds;
+
+  if (on) FD_SET(e->fd, set);
+  else    FD_CLR(e->fd, set);
+#endif
+} /* watch */
+
 
 /*
 * Find maximum file descriptor number used.
 */
-static void set_max_fd(void)
+static void set_max_fd(Notify_loop *lp)
 {
   event_t *e;
 
-  max_fd = 0;
-  for (e = el; e; e = e->next) {
-    if (e->fd > max_fd) max_fd = e->fd;
+  lp->max_fd = 0;
+  for (e = lp->el; e; e = e->next) {
+    if (e->fd > lp->max_fd) lp->max_fd = e->fd;
   }
 } /* set_max */
 
 
+/*
+* Add a new event to the event list of 'lp'.
+*/
+static event_t *event_new(Notify_loop *lp, Notify_client client, int fd,
+  enum type_t type)
+{
+  event_t *e;
+
+  e = (event_t *)malloc(sizeof(event_t));
+  if (!e) return 0;
+  e->next = lp->el;   /* put at head of list */
+  lp->el = e;
+  if (fd > lp->max_fd) lp->max_fd = fd;
+  e->type        = type;
+  e->client      = client;
+  e->func        = 0;
+  e->output_func = 0;
+  e->recv_func   = 0;
+  e->fd          = fd;
+  e->uring       = 0;
+  e->drops       = 0;
+  memset(&e->run, 0, sizeof(e->run));
+  return e;
+} /* event_new */
+
+
+/*
+* Remove event 'e', which follows 'prev', from the event list of 'lp'.
+*/
+static void event_free(Notify_loop *lp, event_t *e, event_t *prev)
+{
+  watch(lp, e, 0);
+  if (prev) prev->next = e->next;
+  else lp->el = e->next;
+  free(e);
+  lp->frees++;
+  set_max_fd(lp);  /* find new maximum fd */
+} /* event_free */
+
+
 /*
 * Install input handler function 'func' for file descriptor 'fd'.
 * func=NOTIFY_FUNC_NULL removes handler.
@@ -102,30 +709,19 @@ Notify_func_input notify_set_input_func(
   Notify_func_input func, /* function to be called: func(client, fd) */
   int fd)                 /* file descriptor */
 {
+  Notify_loop *lp = notify_loop_current();
   event_t *e, *prev;
 
-  check_clr_fd();
-  e = search(client, fd, N_input, &prev);
+  e = search(lp, client, fd, N_input, &prev);
   if (!e) {  /* create new event */
     if (func == NOTIFY_FUNC_INPUT_NULL) return func;
-    e = (event_t *)malloc(sizeof(event_t));
-    if (!e) return 0;
-    e->next = el;   /* put at head of list */
-    el = e;
-    if (fd > max_fd) max_fd = fd;
-    e->type   = N_input;
-    e->client = client;
-    e->func   = func;
-    e->fd     = fd;
-    FD_SET(fd, &Readfds);
+    if (!(e = event_new(lp, client, fd, N_input))) return 0;
+    e->func = func;
+    watch(lp, e, 1);
   }
   else {
     if (func == NOTIFY_FUNC_INPUT_NULL) {
-      FD_CLR(fd, &Readfds);
-      if (prev) prev->next = e->next;
-      else el = e->next;
-      free(e);
-      set_max_fd();  /* find new maximum fd */
+      event_free(lp, e, prev);
       return func;
     }
     else e->func = func;
@@ -134,8 +730,393 @@ Notify_func_input notify_set_input_func(
 } /* notify_set_input_func */
 
 
+/*
+* Install output handler function 'func' for file descriptor 'fd'.
+* func=NOTIFY_FUNC_NULL removes handler.
+*/
+Notify_func notify_set_output_func(
+  Notify_client client,   /* argument passed to function */
+  Notify_func func,       /* function to be called: func(client) */
+  int fd)                 /* file descriptor */
+{
+  Notify_loop *lp = notify_loop_current();
+  event_t *e, *prev;
+
+  e = search(lp, client, fd, N_output, &prev);
+  if (!e) {  /* create new event */
+    if (func == NOTIFY_FUNC_NULL) return func;
+    if (!(e = event_new(lp, client, fd, N_output))) return 0;
+    e->output_func = func;
+    watch(lp, e, 1);
+  }
+  else {
+    if (func == NOTIFY_FUNC_NULL) {
+      event_free(lp, e, prev);
+      return func;
+    }
+    else e->output_func = func;
+  }
+  return 0;
+} /* notify_set_output_func */
+
+
+#if HAVE_IO_URING
+/*
+* Pass a datagram received through io_uring of loop 'arg' to its
+* handler.
+*/
+static void uring_input(void *arg, int fd, char *buf, int len,
+  struct sockaddr_in *from, long drops)
+{
+  Notify_loop *lp = (Notify_loop *)arg;
+  event_t *e = fd >= 0 && fd < lp->urtab_len ? lp->urtab[fd] : 0;
+  unsigned long frees;
+
+  if (!e || !e->uring || !e->recv_func) return;
+  if (len < 0) {
+    /* e.g., no multishot receive in this kernel: wait for input instead */
+    uring_index(lp, e, 0);
+    e->uring = 0;
+    watch(lp, e, 1);
+    return;
+  }
+  if (drops >= 0) e->drops = drops;
+  frees = lp->frees;
+  (e->recv_func)(e->client, fd, buf, len, from);
+  if (lp->stats) stat_handler(lp, e, frees);
+} /* uring_input */
+
+
+/*
+* Set up io_uring for 'lp' on first use, if notify_uring() asked for
+* it. Return 1 if it is in use.
+*/
+static int uring_start(Notify_loop *lp)
+{
+  if (lp->uring_on < 0) {
+    lp->uring = uring_init(uring_input, lp);
+    lp->uring_on = lp->uring != 0;
+    if (lp->uring_on) lp->ring_fd = uring_fd(lp->uring);
+  }
+  return lp->uring_on;
+} /* uring_start */
+#endif
+
+
+/*
+* Install receive handler function 'func' for socket 'fd'.
+* func=NOTIFY_FUNC_RECV_NULL removes handler.
+*/
+Notify_func_recv notify_set_recv_func(
+  Notify_client client,   /* argument passed to function */
+  Notify_func_recv func,  /* func(client, fd, buf, len, from) */
+  int fd)                 /* socket */
+{
+  Notify_loop *lp = notify_loop_current();
+  event_t *e, *prev;
+
+  e = search(lp, client, fd, N_input, &prev);
+  if (!e) {  /* create new event */
+    if (func == NOTIFY_FUNC_RECV_NULL) return func;
+    if (!(e = event_new(lp, client, fd, N_input))) return 0;
+    e->recv_func = func;
+#if HAVE_IO_URING
+    e->uring = uring_start(lp) && uring_recv(lp->uring, fd) == 0;
+#endif
+    watch(lp, e, 1);
+  }
+  else {
+    if (func == NOTIFY_FUNC_RECV_NULL) {
+      event_free(lp, e, prev);
+      return func;
+    }
+    else e->recv_func = func;
+  }
+  return 0;
+} /* notify_set_recv_func */
+
+
+/*
+* Call the input handler for 'fd', or receive a datagram and call the
+* receive handler.
+*/
+static void input(Notify_loop *lp, event_t *e, int fd)
+{
+  struct sockaddr_in from;
+  unsigned long frees = lp->frees;
+  int n;
+#ifdef SO_RXQ_OVFL
+  union {
+    struct cmsghdr hdr;
+    char buf[CMSG_SPACE(sizeof(uint32_t))];
+  } ctl;
+  struct msghdr msg;
+  struct cmsghdr *c;
+  struct iovec iov;
+#else
+  socklen_t len = sizeof(from);
+#endif
+
+  if (!e->recv_func) {
+    if (e->func) (e->func)(e->client, fd);
+    if (lp->stats) stat_handler(lp, e, frees);
+    return;
+  }
+#ifdef SO_RXQ_OVFL
+  /* with the drop counter, if the socket has SO_RXQ_OVFL set */
+  memset(&msg, 0, sizeof(msg));
+  iov.iov_base = lp->rbuf;
+  iov.iov_len  = sizeof(lp->rbuf);
+  msg.msg_name       = &from;
+  msg.msg_namelen    = sizeof(from);
+  msg.msg_iov        = &iov;
+  msg.msg_iovlen     = 1;
+  msg.msg_control    = &ctl;
+  msg.msg_controllen = sizeof(ctl);
+  n = recvmsg(fd, &msg, 0);
+  if (n < 0) {
+    perror("recvmsg");
+    return;
+  }
+  for (c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+    if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SO_RXQ_OVFL)
+      e->drops = *(uint32_t *)CMSG_DATA(c);
+  }
+#else
+  n = recvfrom(fd, lp->rbuf, sizeof(lp->rbuf), 0,
+    (struct sockaddr *)&from, &len);
+  if (n < 0) {
+    perror("recvfrom");
+    return;
+  }
+#endif
+  (e->recv_func)(e->client, fd, lp->rbuf, n, &from);
+  if (lp->stats) stat_handler(lp, e, frees);
+} /* input */
+
+
+/*
+* Return the kernel's count of datagrams dropped on socket 'fd', as
+* last reported with a received datagram.
+*/
+unsigned long notify_recv_drops(int fd)
+{
+  event_t *e, *prev;
+
+  e = search(notify_loop_current(), (Notify_client)0, fd, N_input, &prev);
+  return e ? e->drops : 0;
+} /* notify_recv_drops */
+
+
+#if HAVE_UDP_SEGMENT
+/*
+* Send a datagram, or the coalesced ones, one by one.
+*/
+static void gso_send_one(gso_t *g, const char *buf, int len)
+{
+  int n;
+
+  if (g->has_to)
+    n = sendto(g->fd, buf, len, 0, (struct sockaddr *)&g->to,
+      sizeof(g->to));
+  else
+    n = send(g->fd, buf, len, 0);
+  if (n < 0) perror("send");
+} /* gso_send_one */
+
+
+/*
+* Send the coalesced datagrams of loop 'lp' with one sendmsg(). If the
+* kernel or the device refuses, send them one by one and stop
+* coalescing.
+*/
+static void gso_flush(Notify_loop *lp)
+{
+  gso_t *g = lp->gso;
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr *cmsg;
+  union {
+    char buf[CMSG_SPACE(sizeof(uint16_t))];
+    struct cmsghdr align;
+  } control;
+  int i;
+
+  if (!g || g->n == 0) return;
+  if (g->n == 1) {
+    gso_send_one(g, g->buf, g->len);
+    g->n = g->len = 0;
+    return;
+  }
+
+  memset(&msg, 0, sizeof(msg));
+  iov.iov_base = g->buf;
+  iov.iov_len  = g->len;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  if (g->has_to) {
+    msg.msg_name = &g->to;
+    msg.msg_namelen = sizeof(g->to);
+  }
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+  cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_UDP;
+  cmsg->cmsg_type  = UDP_SEGMENT;
+  cmsg->cmsg_len   = CMSG_LEN(sizeof(uint16_t));
+  *(uint16_t *)CMSG_DATA(cmsg) = g->seg;
+
+  if (sendmsg(g->fd, &msg, 0) < 0) {
+    if (errno == EIO || errno == EINVAL || errno == ENOPROTOOPT ||
+        errno == EOPNOTSUPP) {
+      for (i = 0; i < g->len; i += g->seg) {
+        gso_send_one(g, g->buf + i,
+          g->len - i < g->seg ? g->len - i : g->seg);
+      }
+      free(lp->gso);
+      lp->gso = 0;
+      return;
+    }
+    perror("sendmsg");
+  }
+  g->n = g->len = 0;
+} /* gso_flush */
+
+
+/*
+* Add a datagram to those coalesced, sending them first if it does not
+* continue their run.
+*/
+static int gso_send(Notify_loop *lp, int fd, const char *buf, int len,
+  struct sockaddr_in *to)
+{
+  gso_t *g = lp->gso;
+
+  if (g->n > 0 && (fd != g->fd || (to != 0) != g->has_to ||
+      (to && (to->sin_addr.s_addr != g->to.sin_addr.s_addr ||
+              to->sin_port != g->to.sin_port)) ||
+      len > g->seg || g->len + len > GSO_MAX || g->n == GSO_SEGMENTS)) {
+    gso_flush(lp);
+    if (!(g = lp->gso)) return notify_send(fd, buf, len, to, 0, 0);
+  }
+  if (len <= 0 || len > GSO_MAX) {
+    return to ? sendto(fd, buf, len, 0, (struct sockaddr *)to, sizeof(*to))
+              : send(fd, buf, len, 0);
+  }
+  if (g->n == 0) {
+    g->fd = fd;
+    g->has_to = to != 0;
+    if (to) g->to = *to;
+    g->seg = len;
+  }
+  memcpy(g->buf + g->len, buf, len);
+  g->len += len;
+  g->n++;
+  /* only the last segment may be shorter */
+  if (len < g->seg) gso_flush(lp);
+  return len;
+} /* gso_send */
+#endif
+
+
+/*
+* Receive and send through io_uring, if the kernel supports it.
+*/
+int notify_uring(void)
+{
+#if HAVE_IO_URING
+  Notify_loop *lp = notify_loop_current();
+
+  if (!lp->uring) lp->uring_on = -1;
+  return uring_start(lp);
+#else
+  return 0;
+#endif
+} /* notify_uring */
+
+
+/*
+* Coalesce datagrams with UDP_SEGMENT, if the kernel supports it.
+*/
+int notify_send_gso(int on)
+{
+#if HAVE_UDP_SEGMENT
+  Notify_loop *lp = notify_loop_current();
+  int fd, size = 1000, ok;
+
+  if (!on) {
+    gso_flush(lp);
+    free(lp->gso);
+    lp->gso = 0;
+    return 0;
+  }
+  if (lp->gso) return 1;
+  if ((fd = socket(PF_INET, SOCK_DGRAM, 0)) < 0) return 0;
+  ok = setsockopt(fd, SOL_UDP, UDP_SEGMENT, &size, sizeof(size)) == 0;
+  close(fd);
+  if (ok) lp->gso = (gso_t *)calloc(1, sizeof(gso_t));
+  return lp->gso != 0;
+#else
+  return 0;
+#endif
+} /* notify_send_gso */
+
+
+/*
+* Send a datagram, queueing it if io_uring is used or it is coalesced.
+*/
+int notify_send(int fd, const char *buf, int len, struct sockaddr_in *to,
+  Notify_func_sent func, Notify_client client)
+{
+#if HAVE_IO_URING || HAVE_UDP_SEGMENT
+  Notify_loop *lp = notify_loop_current();
+#endif
+#if HAVE_IO_URING
+  int n;
+#endif
+
+#if HAVE_UDP_SEGMENT
+  if (lp->gso) return gso_send(lp, fd, buf, len, to);
+#endif
+#if HAVE_IO_URING
+  if (uring_start(lp) &&
+      (n = uring_send(lp->uring, fd, buf, len, to, func, client)) >= 0)
+    return n;
+#endif
+  if (to) return sendto(fd, buf, len, 0, (struct sockaddr *)to, sizeof(*to));
+  return send(fd, buf, len, 0);
+} /* notify_send */
+
+
+/*
+* Submit queued sends and handle the completions that are ready.
+*/
+void notify_flush(void)
+{
+#if HAVE_IO_URING || HAVE_UDP_SEGMENT
+  Notify_loop *lp = notify_loop_current();
+#endif
+#if HAVE_IO_URING
+  int i;
+#endif
+
+#if HAVE_UDP_SEGMENT
+  gso_flush(lp);
+#endif
+#if HAVE_IO_URING
+  /* receive handlers may send again; leave the rest to the next round */
+  if (lp->uring_on > 0) {
+    uring_submit(lp->uring);
+    for (i = 0; i < 4 && uring_reap(lp->uring) > 0; i++)
+      uring_submit(lp->uring);
+  }
+#endif
+} /* notify_flush */
+
+
 /*
 * Don't wait if there are no other events.
+* Return NULL to wait until input arrives or notify_wakeup() is called.
 */
 static struct timeval *timer_get_pending(struct timeval *timeout, int max_fd)
 {
@@ -147,34 +1128,254 @@ static struct timeval *timer_get_pending(struct timeval *timeout, int max_fd)
     notify_stop();
     return timeout;     /* added by Akira 12/11/01 */
   }
-  if (!tvp)
-    return timeout;     /* return 0.100000 sec, by Akira 12/11/01 */
+#if defined(WIN32)
+  /* no self-pipe; look for new timers every 0.1 sec */
+  if (!tvp) {
+    timeout->tv_sec  = 0;
+    timeout->tv_usec = 100000;
+    return timeout;
+  }
+#endif
 
   return tvp;           /* return first timer event, by Akira 12/11/01 */
 } /* timer_get_pending */
 
 
+/*
+* Create the self-pipe used by notify_wakeup().
+*/
+static void wake_init(Notify_loop *lp)
+{
+#ifndef WIN32
+  int i;
+
+  if (lp->wake_fd[0] >= 0) return;
+  if (pipe(lp->wake_fd) < 0) {
+    perror("pipe");
+    lp->wake_fd[0] = lp->wake_fd[1] = -1;
+    return;
+  }
+  for (i = 0; i < 2; i++) {
+    fcntl(lp->wake_fd[i], F_SETFL,
+      fcntl(lp->wake_fd[i], F_GETFL, 0) | O_NONBLOCK);
+    fcntl(lp->wake_fd[i], F_SETFD, FD_CLOEXEC);
+  }
+#if HAVE_EPOLL
+  {
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events  = EPOLLIN;
+    ev.data.fd = lp->wake_fd[0];
+    if (epoll_ctl(lp->epfd, EPOLL_CTL_ADD, lp->wake_fd[0], &ev) < 0)
+      perror("epoll_ctl");
+  }
+#endif
+#endif
+} /* wake_init */
+
+
+/*
+* Empty the self-pipe after a wakeup.
+*/
+static void wake_drain(Notify_loop *lp)
+{
+#ifndef WIN32
+  char buf[64];
+
+  while (read(lp->wake_fd[0], buf, sizeof(buf)) > 0)
+    ;
+#endif
+} /* wake_drain */
+
+
+/*
+* Make loop 'lp' recompute its timeout. Safe to call from a signal
+* handler or from another thread.
+*/
+void notify_loop_wakeup(Notify_loop *lp)
+{
+  if (!lp) return;
+  /* the flag is only seen in time if we run on the loop's own thread */
+  if (lp == cur && lp->busy) {
+    lp->wake_pending = 1;
+    return;
+  }
+#ifndef WIN32
+  if (lp->wake_fd[1] >= 0) {
+    int saved = errno;
+    char c = 0;
+
+    if (write(lp->wake_fd[1], &c, 1) < 0) {
+      /* pipe full: a wakeup is pending anyway */
+    }
+    errno = saved;
+  }
+#endif
+} /* notify_loop_wakeup */
+
+
+/*
+* Make the current loop recompute its timeout. Safe to call from a
+* signal handler.
+*/
+void notify_wakeup(void)
+{
+  notify_loop_wakeup(cur ? cur : default_loop);
+} /* notify_wakeup */
+
+
+#if HAVE_EPOLL
 /*
 * Main loop. Return 0 if stopped, -1 if error.
 */
 Notify_error notify_start(void)
 {
-  struct timeval timeout;
+  Notify_loop *lp = notify_loop_current();
+  struct timeval timeout, stats_timeout, *tvp;
+  struct epoll_event events[EPOLL_BATCH];
+  struct fdrec *r;
+  int found, ms, i;
+#if HAVE_EPOLL_PWAIT2
+  static int pwait2 = 1;  /* epoll_pwait2() works */
+#endif
+
+  if (epoll_init(lp) < 0) return -1;
+  wake_init(lp);
+  lp->stop = 0;
+  while (!lp->stop) {
+#if HAVE_IO_URING
+    if (lp->ring_fd >= 0 && !lp->ring_watched) {
+      struct epoll_event ev;
+
+      memset(&ev, 0, sizeof(ev));
+      ev.events  = EPOLLIN;
+      ev.data.fd = lp->ring_fd;
+      if (epoll_ctl(lp->epfd, EPOLL_CTL_ADD, lp->ring_fd, &ev) < 0)
+        perror("epoll_ctl");
+      lp->ring_watched = 1;
+    }
+#endif
+    lp->busy = 1;
+    tvp = timer_get_pending(&timeout, lp->max_fd);
+    notify_flush();
+    lp->busy = 0;
+    if (lp->stop) break;
+    if (lp->wake_pending) {
+      lp->wake_pending = 0;
+      continue;
+    }
+
+    if (lp->stats) tvp = stats_poll(lp, tvp, &stats_timeout);
+
+#if HAVE_EPOLL_PWAIT2
+    /* wait to the microsecond, unless the kernel is too old */
+    if (pwait2) {
+      struct timespec ts;
+
+      if (tvp) {
+        ts.tv_sec  = tvp->tv_sec;
+        ts.tv_nsec = tvp->tv_usec * 1000L;
+      }
+      found = epoll_pwait2(lp->epfd, events, EPOLL_BATCH, tvp ? &ts : NULL,
+        NULL);
+      if (found < 0 && errno == ENOSYS) pwait2 = 0;
+    }
+    if (!pwait2)
+#endif
+    {
+      /* round up, so that we do not wake up before the timer expires */
+      ms = tvp ? tvp->tv_sec * 1000 + (tvp->tv_usec + 999) / 1000 : -1;
+      found = epoll_wait(lp->epfd, events, EPOLL_BATCH, ms);
+    }
+    lp->busy = 1;
+    if (lp->stats) stats_woke(lp);
+    if (found < 0 && errno != EINTR) {
+      perror("epoll_wait");
+      return -1;
+    }
+
+    /* a handler may remove events, so look them up again each time */
+    for (i = 0; i < found; i++) {
+      int fd = events[i].data.fd;
+
+      if (fd == lp->wake_fd[0]) {
+        wake_drain(lp);
+        continue;
+      }
+#if HAVE_IO_URING
+      if (fd == lp->ring_fd) continue;  /* reaped by notify_flush() */
+#endif
+      if (fd >= lp->fdtab_len) continue;
+      r = &lp->fdtab[fd];
+      if ((events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) &&
+          r->in)
+        input(lp, r->in, fd);
+      r = &lp->fdtab[fd];  /* fdtab may have grown */
+      if ((events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) &&
+          r->out && r->out->output_func) {
+        event_t *e = r->out;
+        unsigned long frees = lp->frees;
+
+        (e->output_func)(e->client);
+        if (lp->stats) stat_handler(lp, e, frees);
+      }
+    }
+  } /* while() */
+
+  lp->busy = 1;
+  return 0;
+} /* notify_start */
+
+#else /* !HAVE_EPOLL */
+
+/*
+* Main loop. Return 0 if stopped, -1 if error.
+*/
+Notify_error notify_start(void)
+{
+  Notify_loop *lp = notify_loop_current();
+  struct timeval timeout, stats_timeout, *tvp;
   event_t *e, *prev;
-  int fd;
+  int fd, nfds;
   int found;
   fd_set readfds, writefds, exceptfds;
 
-  stop = 0;
-  while (!stop) {
-    readfds   = Readfds;
-    writefds  = Writefds;
-    exceptfds = Exceptfds;
-    timeout.tv_sec  = 0;
-    timeout.tv_usec = 100000;     /* modified from 0 by Akira 12/11/01 */
+  wake_init(lp);
+  lp->stop = 0;
+  while (!lp->stop) {
+    lp->busy = 1;
+    tvp = timer_get_pending(&timeout, lp->max_fd);
+    notify_flush();
+    lp->busy = 0;
+    if (lp->stop) break;
+    if (lp->wake_pending) {
+      lp->wake_pending = 0;
+      continue;
+    }
 
-    found = select(max_fd+1, (CAST)&readfds, (CAST)&writefds, (CAST)&exceptfds,
-                    timer_get_pending(&timeout, max_fd));
+    readfds   = lp->Readfds;
+    writefds  = lp->Writefds;
+    exceptfds = lp->Exceptfds;
+    nfds = lp->max_fd;
+#ifndef WIN32
+    if (lp->wake_fd[0] >= 0) {
+      FD_SET(lp->wake_fd[0], &readfds);
+      if (lp->wake_fd[0] > nfds) nfds = lp->wake_fd[0];
+    }
+#endif
+#if HAVE_IO_URING
+    if (lp->ring_fd >= 0) {
+      FD_SET(lp->ring_fd, &readfds);
+      if (lp->ring_fd > nfds) nfds = lp->ring_fd;
+    }
+#endif
+
+    if (lp->stats) tvp = stats_poll(lp, tvp, &stats_timeout);
+    found = select(nfds+1, (CAST)&readfds, (CAST)&writefds, (CAST)&exceptfds,
+                    tvp);
+    lp->busy = 1;
+    if (lp->stats) stats_woke(lp);
 
 #if defined(WIN32)
     if (found < 0 && WSAGetLastError() != WSAEINVAL) {
@@ -193,32 +1394,64 @@ Notify_error notify_start(void)
     /* found = 0: just a timer -> do nothing,
                   timer_get() will execute the handler */
     /* found > 0: scan the fd_event */
-    if (found) {
-      for (fd = 0; fd <= max_fd && found > 0; fd++) {
+    if (found > 0) {
+#ifndef WIN32
+      if (lp->wake_fd[0] >= 0 && FD_ISSET(lp->wake_fd[0], &readfds)) {
+        wake_drain(lp);
+        FD_CLR(lp->wake_fd[0], &readfds);
+      }
+#endif
+#if HAVE_IO_URING
+      if (lp->ring_fd >= 0)
+        FD_CLR(lp->ring_fd, &readfds);  /* see notify_flush() */
+#endif
+      for (fd = 0; fd <= lp->max_fd && found > 0; fd++) {
         if (FD_ISSET(fd, &readfds)) {
-          e = search((Notify_client)0, fd, N_input, &prev);
-          if (e) {
-            if (e->func) (e->func)(e->client, fd);
-          }
+          e = search(lp, (Notify_client)0, fd, N_input, &prev);
+          if (e) input(lp, e, fd);
           else {
             fprintf(stderr, "No handler for fd %d\n", fd);
           }
         }
+        if (FD_ISSET(fd, &writefds)) {
+          e = search(lp, (Notify_client)0, fd, N_output, &prev);
+          if (e && e->output_func) {
+            unsigned long frees = lp->frees;
+
+            (e->output_func)(e->client);
+            if (lp->stats) stat_handler(lp, e, frees);
+          }
+        }
       } /* for() */
     }
 
   } /* while() */
 
+  lp->busy = 1;
   return 0;
 } /* notify_start */
 
+#endif /* HAVE_EPOLL */
+
 
 /*
-* Stop the event loop. Noticed only at next event.
+* Stop loop 'lp'. The loop is woken up if it is waiting. Safe to call
+* from a signal handler or from another thread.
+*/
+void notify_loop_stop(Notify_loop *lp)
+{
+  if (!lp) return;
+  lp->stop = 1;
+  notify_loop_wakeup(lp);
+} /* notify_loop_stop */
+
+
+/*
+* Stop the event loop. The loop is woken up if it is waiting.
 */
 Notify_error notify_stop(void)
 {
-  stop = 1;
+  notify_loop_stop(cur ? cur : default_loop);
   return 0;  /* kludge */
 } /* notify_stop */
 
@@ -250,19 +1483,22 @@ Notify_func_signal notify_set_signal_func(Notify_client client,
 
 /*
  * Sets the value of fd_sets Rreadfds, Writefds, Exceptfds.
+ * Only used by the select() loop; descriptors without a handler
+ * are not watched when using epoll.
  */
 void notify_set_socket(int sock, int flag)
 {
-  check_clr_fd();
+  Notify_loop *lp = notify_loop_current();
+
   switch (flag) {
   case 0:
-    FD_SET(sock, &Readfds);
+    FD_SET(sock, &lp->Readfds);
     break;
   case 1:
-    FD_SET(sock, &Writefds);
+    FD_SET(sock, &lp->Writefds);
     break;
   case 2:
-    FD_SET(sock, &Exceptfds);
+    FD_SET(sock, &lp->Exceptfds);
     break;
   default:
     break;
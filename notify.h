@@ -6,6 +6,8 @@ patents pending in the U.S. and foreign countries. OPEN LOOK is
 a trademark of USL. Used by written permission of the owners.
 */
 
+struct sockaddr_in;
+
 /*
  * Client notification function return values for notifier to client calls.
  */
@@ -54,10 +56,20 @@ typedef	Notify_value (*Notify_func)(Notify_client client);
 typedef	Notify_value (*Notify_func_input)(Notify_client client, int fd);
 typedef	Notify_value (*Notify_func_signal)(Notify_client client, int
   signal, Notify_signal_mode mode);
+typedef	Notify_value (*Notify_func_recv)(Notify_client client, int fd,
+  char *buf, int len, struct sockaddr_in *from);
+typedef	void (*Notify_func_sent)(Notify_client client, int error);
 
 #define	NOTIFY_FUNC_NULL        ((Notify_func)0)
 #define	NOTIFY_FUNC_INPUT_NULL  ((Notify_func_input)0)
 #define	NOTIFY_FUNC_SIGNAL_NULL ((Notify_func_signal)0)
+#define	NOTIFY_FUNC_RECV_NULL   ((Notify_func_recv)0)
+
+/*
+ * Largest datagram passed to a receive handler; longer ones are
+ * truncated.
+ */
+#define	NOTIFY_RECV_MAX         8192
 
 /*
  * Establish event handler for file descriptor 'fd'. The handler
@@ -72,13 +84,67 @@ extern Notify_func_input notify_set_input_func (Notify_client nclient,
 /*
  * Establish event handler for file descriptor 'fd'. The handler
  * 'func' is called whenever 'fd' is ready for output. Calling
- * notify_set_input_func with func=NOTIFY_FUNC_NULL removes
+ * notify_set_output_func with func=NOTIFY_FUNC_NULL removes
  * the handler. Return 'func' on success, NOTIFY_FUNC_NULL
  * on failure.
  */
 extern Notify_func notify_set_output_func (Notify_client nclient,
   Notify_func func, int fd);
 
+/*
+ * Establish handler for datagrams arriving on socket 'fd'. The
+ * notifier receives each datagram and calls 'func' with its data,
+ * length and source address; the data is only valid during the call.
+ * With io_uring, this uses a multishot receive rather than a call
+ * per datagram. func=NOTIFY_FUNC_RECV_NULL removes the handler.
+ */
+extern Notify_func_recv notify_set_recv_func (Notify_client nclient,
+  Notify_func_recv func, int fd);
+
+/*
+ * Return the number of datagrams the kernel dropped on socket 'fd' for
+ * lack of buffer space, as reported with the last datagram received
+ * by the handler of 'fd'. The socket must have SO_RXQ_OVFL set, and
+ * the count is 0 if the kernel does not support it.
+ */
+extern unsigned long notify_recv_drops(int fd);
+
+/*
+ * Send 'len' bytes from 'buf' on socket 'fd', to address 'to' or,
+ * if 'to' is NULL, to the connected peer. With io_uring (see
+ * notify_uring()), the data is copied and queued, and all queued sends
+ * are submitted together before the main loop waits again; datagrams
+ * for the same socket leave in the order given. An error is then
+ * reported to 'func' (or printed if 'func' is NULL). Otherwise the data
+ * is sent immediately. Return 'len', or -1 and errno if sending failed.
+ */
+extern int notify_send(int fd, const char *buf, int len,
+  struct sockaddr_in *to, Notify_func_sent func, Notify_client client);
+
+/*
+ * Submit queued sends now, e.g., before exiting.
+ */
+extern void notify_flush(void);
+
+/*
+ * Receive the datagrams of receive handlers installed from now on, and
+ * send those passed to notify_send(), through io_uring in the current
+ * loop. It is not used unless asked for. Return 1 if io_uring is
+ * available and in use.
+ */
+extern int notify_uring(void);
+
+/*
+ * Coalesce datagrams passed to notify_send() (on = 1) or stop (on = 0).
+ * A run of datagrams of the same size, the last one possibly shorter,
+ * for the same socket and address is queued and handed to the kernel
+ * in one send with UDP generic segmentation offload (UDP_SEGMENT) by
+ * notify_flush(); send errors are then printed. If the kernel or the
+ * device does not support it, the datagrams are sent one by one. Return
+ * 1 if datagrams are coalesced.
+ */
+extern int notify_send_gso(int on);
+
 /*
  * Establish event handler that is called periodically.
  * The function 'func' is called every 'interval' milliseconds.
@@ -100,13 +166,71 @@ extern  Notify_error  notify_start(void);
 */
 extern  Notify_error  notify_stop(void);
 
+/*
+* Make the main loop re-examine its timers. Safe in signal handlers.
+*/
+extern  void  notify_wakeup(void);
+
 /*
 * Establish signal handler.
 */
 extern Notify_func_signal notify_set_signal_func(Notify_client nclient,
   Notify_func_signal func, int sig, Notify_signal_mode mode);
 
+/*
+* Collect statistics for the current loop: wakeups per second,
+* handlers called per wakeup, run time of each handler and timer
+* lateness (as histograms with power-of-two buckets in microseconds),
+* and the fraction of time not spent waiting for events. Every
+* 'interval' seconds (never if 0) a line with the figures for the
+* interval is printed to stderr; SIGUSR1 prints the full report.
+* Collecting costs a gettimeofday() per handler and wakeup.
+*/
+extern void notify_stats(int interval);
+
+/*
+* Print the full statistics report of the current loop to stderr.
+*/
+extern void notify_stats_report(void);
+
 /*
 * Initialize Readfds (flag = 0), Writefds (1), Exceptfds (2).
 */
 extern void notify_set_socket(int sock, int flag);
+
+/*
+ * Event loops. Each thread has a current loop, which all of the
+ * functions above operate on; signal handlers are shared by all loops.
+ * Unless notify_loop_use() selects another one, the current loop is a
+ * default loop created on first use. To run loops on several threads,
+ * create one per thread and select it there before installing handlers.
+ */
+typedef struct notify_loop Notify_loop;
+
+/*
+* Create a loop, or return NULL if out of memory.
+*/
+extern Notify_loop *notify_loop_create(void);
+
+/*
+* Free a loop that is not running, with its handlers and timers.
+*/
+extern void notify_loop_destroy(Notify_loop *loop);
+
+/*
+* Make 'loop' the current loop of the calling thread (NULL selects the
+* default loop). Return the previous one.
+*/
+extern Notify_loop *notify_loop_use(Notify_loop *loop);
+
+/*
+* Return the current loop of the calling thread.
+*/
+extern Notify_loop *notify_loop_current(void);
+
+/*
+* notify_stop() and notify_wakeup() for 'loop'. Safe to call from any
+* thread and in signal handlers.
+*/
+extern void notify_loop_stop(Notify_loop *loop);
+extern void notify_loop_wakeup(Notify_loop *loop);
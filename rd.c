@@ -29,6 +29,7 @@
  */
 
 #include <sys/types.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <time.h>
@@ -41,48 +42,758 @@
 #endif
 
 #include "rtpdump.h"
+#include "lz.h"
 
 #define RTPFILE_VERSION "1.0"
+#define RTPFILE_BLOCK_VERSION "2.0"  /* compressed, see rtpdump.h */
 
 /*
-* Read header. Return -1 if not valid, 0 if ok.
+* Besides rtpdump files, RD_header() and RD_read() accept pcap and
+* pcapng captures and return the UDP packets in them as if they had
+* been recorded by rtpdump. They are read one record at a time, so the
+* memory needed does not depend on the size of the capture.
+*
+* What a reader needs to know about a file, such as its format, the
+* pending first packet of a capture or the current block of a
+* compressed file, is kept per stream, looked up by its FILE pointer.
+* RD_header() starts it over, so several files can be read at once.
 */
-int RD_header(FILE *in, struct sockaddr_in *sin, struct timeval *start, int verbose)
+#define PCAP_MAGIC      0xa1b2c3d4  /* microsecond timestamps */
+#define PCAP_MAGIC_NSEC 0xa1b23c4d  /* nanosecond timestamps */
+#define PCAPNG_SHB      0x0a0d0d0a  /* section header block */
+#define PCAPNG_BOM      0x1a2b3c4d  /* byte-order magic */
+#define PCAPNG_IFS      64          /* interfaces per section we track */
+#define PCAP_BUF        16384       /* part of a record we look at */
+
+/* what is needed to decode the following records */
+typedef struct {
+  int swap;                   /* file not in host byte order */
+  int nsec;                   /* pcap: nanosecond timestamps */
+  int linktype;               /* pcap: link-layer header type */
+  int nif;                    /* pcapng: interfaces in this section */
+  struct {
+    int linktype;
+    uint64_t units;           /* timestamp units per second */
+  } ifs[PCAPNG_IFS];
+} pcap_state_t;
+
+typedef struct rd_stream {
+  struct rd_stream *next;     /* streams, most recently used first */
+  FILE *in;
+  enum {RD_DUMP, RD_BLOCK, RD_PCAP, RD_PCAPNG} type;
+  pcap_state_t s;
+  pcap_state_t s0;            /* 's' after the header, for RD_rewind() */
+  fpos_t data;                /* position after the header */
+  int seekable;               /* 'data' is valid */
+  struct timeval start;       /* time of the first packet */
+  uint32_t addr;              /* destination of the last packet */
+  uint16_t dport;
+  int has_first;              /* 'first' was read with the header */
+  int pending;                /* 'first' not yet returned */
+  RD_buffer_t first;
+  int held;                   /* 'hold' not yet returned, see RD_skip() */
+  RD_buffer_t hold;
+  int zpos, zlen;             /* next record and end of 'block' */
+  unsigned char *block;       /* records of the current block */
+  unsigned char *zbuf;        /* the block as in the file */
+  unsigned char *buf;         /* part of a pcap record, PCAP_BUF bytes */
+} rd_stream_t;
+
+static rd_stream_t *streams;
+static int pcap_port;         /* only this port and the next, if set */
+
+/* compressed file being written */
+struct RD_block {
+  FILE *out;
+  RD_block_hdr_t h;           /* for the records in 'buf', in host order */
+  int len;
+  unsigned char buf[RD_BLOCK_SIZE];
+};
+
+static unsigned char zout[RD_BLOCK_SIZE];  /* block being written */
+
+
+/*
+* Only read packets to UDP port 'port' (RTP) and 'port'+1 (RTCP) from
+* pcap files; 0 reads all UDP packets.
+*/
+void RD_pcap_port(int port)
+{
+  pcap_port = port & ~1;
+} /* RD_pcap_port */
+
+
+/*
+* Return the state of input 'in', which is created empty if there is
+* none. Streams are few, so a list in order of use will do.
+*/
+static rd_stream_t *stream(FILE *in)
+{
+  rd_stream_t **p, *rd;
+
+  for (p = &streams; (rd = *p); p = &rd->next) {
+    if (rd->in == in) {
+      *p = rd->next;
+      break;
+    }
+  }
+  if (!rd) {
+    if (!(rd = (rd_stream_t *)calloc(1, sizeof(rd_stream_t)))) {
+      perror("RD_read");
+      exit(1);
+    }
+    rd->in = in;
+  }
+  rd->next = streams;
+  streams = rd;
+  return rd;
+} /* stream */
+
+
+/*
+* Start reading 'in' over, as a file of type 'type'. Return NULL if
+* its buffers can not be allocated.
+*/
+static rd_stream_t *stream_start(FILE *in, int type)
+{
+  rd_stream_t *rd = stream(in);
+
+  rd->type = type;
+  rd->pending = rd->has_first = rd->held = 0;
+  rd->zpos = rd->zlen = 0;
+  if (type == RD_BLOCK && !rd->block) {
+    rd->block = (unsigned char *)malloc(RD_BLOCK_SIZE);
+    rd->zbuf  = (unsigned char *)malloc(RD_BLOCK_SIZE);
+    if (!rd->block || !rd->zbuf) return NULL;
+  }
+  if ((type == RD_PCAP || type == RD_PCAPNG) && !rd->buf) {
+    if (!(rd->buf = (unsigned char *)malloc(PCAP_BUF))) return NULL;
+  }
+  return rd;
+} /* stream_start */
+
+
+/*
+* Forget the state of input 'in', e.g., before closing it.
+*/
+void RD_close(FILE *in)
+{
+  rd_stream_t **p, *rd;
+
+  for (p = &streams; (rd = *p); p = &rd->next) {
+    if (rd->in == in) {
+      *p = rd->next;
+      free(rd->block);
+      free(rd->zbuf);
+      free(rd->buf);
+      free(rd);
+      return;
+    }
+  }
+} /* RD_close */
+
+
+static uint32_t swap32(uint32_t v)
+{
+  return (v >> 24) | ((v >> 8) & 0xff00) | ((v << 8) & 0xff0000) | (v << 24);
+} /* swap32 */
+
+
+/*
+* Read 32 and 16 bit values in the byte order of file 'rd'.
+*/
+static uint32_t get32(rd_stream_t *rd, const unsigned char *p)
+{
+  uint32_t v;
+
+  memcpy(&v, p, sizeof(v));
+  return rd->s.swap ? swap32(v) : v;
+} /* get32 */
+
+static uint16_t get16(rd_stream_t *rd, const unsigned char *p)
+{
+  uint16_t v;
+
+  memcpy(&v, p, sizeof(v));
+  if (rd->s.swap) v = (v >> 8) | (v << 8);
+  return v;
+} /* get16 */
+
+
+/*
+* Read 'n' bytes of a record, at most 'size' of them into 'buf', and
+* skip the rest. Return the number of bytes in 'buf', or -1 at the end
+* of the file.
+*/
+static long pcap_fill(FILE *in, unsigned char *buf, unsigned long size,
+  unsigned long n)
+{
+  unsigned long keep = n < size ? n : size;
+  unsigned char skip[1024];
+
+  if (keep && fread(buf, keep, 1, in) != 1) return -1;
+  for (n -= keep; n > 0; ) {
+    unsigned long k = n < sizeof(skip) ? n : sizeof(skip);
+
+    if (fread(skip, k, 1, in) != 1) return -1;
+    n -= k;
+  }
+  return keep;
+} /* pcap_fill */
+
+
+/*
+* Find the UDP packet in frame 'p' of 'caplen' captured bytes of link
+* type 'linktype' and fill in 'b' as RD_read() does, except for the
+* offset. Return the length of the packet, or 0 if the frame is not a
+* wanted UDP datagram. IP fragments and IPv6 extension headers are not
+* handled.
+*/
+static int pcap_udp(rd_stream_t *rd, int linktype, const unsigned char *p,
+  long caplen, RD_buffer_t *b)
+{
+  long off, ulen, len;
+  unsigned type = 0;  /* ethertype, 0 if given by the IP version */
+  uint32_t addr = 0;
+  uint16_t dport;
+
+  switch (linktype) {
+    case 1:    /* Ethernet, with any VLAN tags */
+      off = 14;
+      if (caplen < off) return 0;
+      type = (p[12] << 8) | p[13];
+      while ((type == 0x8100 || type == 0x88a8 || type == 0x9100) &&
+             caplen >= off + 4) {
+        type = (p[off + 2] << 8) | p[off + 3];
+        off += 4;
+      }
+      if (type != 0x0800 && type != 0x86dd) return 0;
+      break;
+    case 0:    /* BSD loopback, family in the capturing host's order */
+    case 108:  /* OpenBSD loopback */
+      off = 4;
+      break;
+    case 12:   /* raw IP, as written by some systems */
+    case 14:
+    case 101:  /* raw IP */
+    case 228:  /* IPv4 */
+    case 229:  /* IPv6 */
+      off = 0;
+      break;
+    case 113:  /* Linux cooked capture */
+      off = 16;
+      break;
+    case 276:  /* Linux cooked capture v2 */
+      off = 20;
+      break;
+    default:
+      return 0;
+  }
+  if (caplen < off + 1) return 0;
+
+  /* IP */
+  if ((p[off] >> 4) == 4) {
+    long ihl = (p[off] & 0x0f) * 4;
+
+    if (caplen < off + 20 || ihl < 20 || p[off + 9] != 17) return 0;
+    if (((p[off + 6] << 8) | p[off + 7]) & 0x3fff) return 0;  /* fragment */
+    memcpy(&addr, p + off + 16, sizeof(addr));
+    off += ihl;
+  }
+  else if ((p[off] >> 4) == 6) {
+    if (caplen < off + 40 || p[off + 6] != 17) return 0;
+    off += 40;
+  }
+  else return 0;
+
+  /* UDP */
+  if (caplen < off + 8) return 0;
+  dport = (p[off + 2] << 8) | p[off + 3];
+  ulen  = ((p[off + 4] << 8) | p[off + 5]) - 8;
+  off += 8;
+  if (ulen <= 0) return 0;
+  if (pcap_port && (dport & ~1) != pcap_port) return 0;
+
+  len = caplen - off;
+  if (len > ulen) len = ulen;
+  if (len > (long)sizeof(b->p.data)) len = sizeof(b->p.data);
+  if (len <= 0) return 0;
+  memcpy(b->p.data, p + off, len);
+  b->p.hdr.length = len;
+
+  /*
+   * RTCP goes to the odd port; without a port to tell, packet types
+   * 192-223 are RTCP (see RFC 5761).
+   */
+  if (pcap_port) b->p.hdr.plen = (dport & 1) ? 0 : ulen;
+  else if (len >= 2 && (p[off] >> 6) == 2 && p[off + 1] >= 192 &&
+    p[off + 1] <= 223) b->p.hdr.plen = 0;
+  else b->p.hdr.plen = ulen;
+
+  rd->addr  = addr;
+  rd->dport = dport;
+  return len;
+} /* pcap_udp */
+
+
+/*
+* Read pcapng section header body 'p' of 'n' bytes (beyond the block
+* type and length). Return -1 if it is not valid.
+*/
+static int pcapng_section(rd_stream_t *rd, const unsigned char *p, long n)
+{
+  uint32_t bom;
+
+  if (n < 4) return -1;
+  memcpy(&bom, p, sizeof(bom));
+  if (bom == PCAPNG_BOM) rd->s.swap = 0;
+  else if (bom == swap32(PCAPNG_BOM)) rd->s.swap = 1;
+  else return -1;
+  rd->s.nif = 0;
+  return 0;
+} /* pcapng_section */
+
+
+/*
+* Read pcapng interface description body 'p' of 'n' bytes.
+*/
+static void pcapng_interface(rd_stream_t *rd, const unsigned char *p,
+  long n)
+{
+  long off;
+  int i = rd->s.nif++;
+
+  if (i >= PCAPNG_IFS || n < 8) return;
+  rd->s.ifs[i].linktype = get16(rd, p);
+  rd->s.ifs[i].units = 1000000;
+  /* options: code, length, value padded to 32 bits */
+  for (off = 8; off + 4 <= n; ) {
+    int code = get16(rd, p + off), olen = get16(rd, p + off + 2);
+
+    if (code == 0) break;
+    if (code == 9 && olen == 1 && off + 5 <= n) {  /* if_tsresol */
+      int v = p[off + 4];
+
+      if (v & 0x80) {
+        if ((v & 0x7f) < 64) rd->s.ifs[i].units = (uint64_t)1 << (v & 0x7f);
+      }
+      else {
+        rd->s.ifs[i].units = 1;
+        while (v-- > 0 && rd->s.ifs[i].units < 10000000000000000000ULL)
+          rd->s.ifs[i].units *= 10;
+      }
+    }
+    off += 4 + ((olen + 3) & ~3);
+  }
+} /* pcapng_interface */
+
+
+/*
+* Read the next wanted UDP packet from a pcap or pcapng file into 'b',
+* and its capture time into 'tv'. Return its length, or 0 at the end.
+*/
+static int pcap_next(rd_stream_t *rd, FILE *in, RD_buffer_t *b,
+  struct timeval *tv)
+{
+  unsigned char h[16];
+  long n;
+  int len;
+
+  while (1) {
+    if (rd->type == RD_PCAP) {
+      uint32_t caplen;
+
+      if (fread(h, sizeof(h), 1, in) != 1) return 0;
+      caplen = get32(rd, h + 8);
+      if ((n = pcap_fill(in, rd->buf, PCAP_BUF, caplen)) < 0) return 0;
+      tv->tv_sec  = get32(rd, h);
+      tv->tv_usec = rd->s.nsec ? get32(rd, h + 4) / 1000 : get32(rd, h + 4);
+      len = pcap_udp(rd, rd->s.linktype, rd->buf, n, b);
+    }
+    else {
+      uint32_t type, blen, caplen;
+      unsigned i;
+
+      if (fread(h, 8, 1, in) != 1) return 0;
+      memcpy(&type, h, sizeof(type));  /* same in either byte order */
+      if (type == PCAPNG_SHB) {
+        /* byte order is that of the new section */
+        if (fread(h + 8, 4, 1, in) != 1 || pcapng_section(rd, h + 8, 4) < 0)
+          return 0;
+        blen = get32(rd, h + 4);
+        if (blen < 12 || pcap_fill(in, rd->buf, 0, blen - 12) < 0) return 0;
+        continue;
+      }
+      type = get32(rd, h);
+      blen = get32(rd, h + 4);
+      if (blen < 12) return 0;
+      /* block body, without the trailing length */
+      if ((n = pcap_fill(in, rd->buf, PCAP_BUF, blen - 8)) < 0)
+        return 0;
+      if (n > (long)blen - 12) n = blen - 12;
+      len = 0;
+      switch (type) {
+        case 1:  /* interface description */
+          pcapng_interface(rd, rd->buf, n);
+          break;
+        case 2:  /* (obsolete) packet */
+        case 6:  /* enhanced packet */
+          if (n < 20) break;
+          i = type == 6 ? get32(rd, rd->buf) : get16(rd, rd->buf);
+          if (i >= (unsigned)rd->s.nif || i >= PCAPNG_IFS) break;
+          {
+            uint64_t ts = ((uint64_t)get32(rd, rd->buf + 4) << 32) |
+              get32(rd, rd->buf + 8);
+            uint64_t units = rd->s.ifs[i].units;
+
+            tv->tv_sec  = ts / units;
+            tv->tv_usec = (double)(ts % units) * 1000000 / units;
+          }
+          caplen = get32(rd, rd->buf + 12);
+          if (caplen > n - 20) caplen = n - 20;
+          len = pcap_udp(rd, rd->s.ifs[i].linktype, rd->buf + 20, caplen, b);
+          break;
+        case 3:  /* simple packet, no timestamp */
+          if (n < 4 || rd->s.nif == 0) break;
+          tv->tv_sec = rd->start.tv_sec;
+          tv->tv_usec = rd->start.tv_usec;
+          len = pcap_udp(rd, rd->s.ifs[0].linktype, rd->buf + 4, n - 4, b);
+          break;
+      }
+    }
+    if (len > 0) return len;
+  }
+} /* pcap_next */
+
+
+/*
+* Set the offset of packet 'b', captured at 'tv', since the first one.
+*/
+static void pcap_offset(rd_stream_t *rd, RD_buffer_t *b,
+  struct timeval *tv)
+{
+  int64_t usec = (int64_t)(tv->tv_sec - rd->start.tv_sec) * 1000000 +
+    (tv->tv_usec - rd->start.tv_usec);
+
+  b->p.hdr.offset = usec > 0 ? usec / 1000 : 0;
+} /* pcap_offset */
+
+
+/*
+* Read the header of a pcap or pcapng file, after its first 4 bytes
+* in 'magic', and the first packet, whose time is the start time.
+*/
+static int pcap_header(rd_stream_t *rd, FILE *in,
+  const unsigned char *magic, struct timeval *start)
+{
+  unsigned char h[24];
+  uint32_t m;
+  struct timeval tv;
+
+  memcpy(&m, magic, sizeof(m));
+  memcpy(h, magic, 4);
+  if (m == PCAPNG_SHB) {
+    uint32_t blen;
+
+    if (fread(h + 4, 8, 1, in) != 1 || pcapng_section(rd, h + 8, 4) < 0)
+      return -1;
+    blen = get32(rd, h + 4);
+    if (blen < 12 || pcap_fill(in, rd->buf, 0, blen - 12) < 0) return -1;
+  }
+  else {
+    rd->s.swap = m != PCAP_MAGIC && m != PCAP_MAGIC_NSEC;
+    rd->s.nsec = get32(rd, h) == PCAP_MAGIC_NSEC;
+    if (fread(h + 4, sizeof(h) - 4, 1, in) != 1) return -1;
+    rd->s.linktype = get32(rd, h + 20) & 0xffff;
+  }
+
+  rd->start.tv_sec = rd->start.tv_usec = 0;
+  rd->has_first = rd->pending = pcap_next(rd, in, &rd->first, &tv) > 0;
+  if (rd->pending) {
+    rd->start = tv;
+    rd->first.p.hdr.offset = 0;
+  }
+  *start = rd->start;
+  rd->s0 = rd->s;
+  return 0;
+} /* pcap_header */
+
+
+/*
+* Finish reading a header 'hdr' that starts at 'start', as RD_header().
+*/
+static int header_end(rd_stream_t *rd, FILE *in, RD_hdr_t *hdr,
+  struct sockaddr_in *sin, struct timeval *start, int verbose)
 {
-  RD_hdr_t hdr;
   time_t tt;
-  char line[80], magic[80];
+  char line[80];
 
-  if (fgets(line, sizeof(line), in) == NULL) return -1;
-  sprintf(magic, "#!rtpplay%s ", RTPFILE_VERSION);
-  if (strncmp(line, magic, strlen(magic)) != 0) return -1;
-  if (fread((char *)&hdr, sizeof(hdr), 1, in) == 0) return -1;
-  start->tv_sec  = ntohl(hdr.start.tv_sec);
-  start->tv_usec = ntohl(hdr.start.tv_usec);
+  rd->seekable = fgetpos(in, &rd->data) == 0;
   if (verbose) {
     struct tm *tm;
     struct in_addr in;
 
-    in.s_addr = hdr.source;
-    tt = (time_t)(hdr.start.tv_sec);
+    in.s_addr = hdr->source;
+    tt = (time_t)(start->tv_sec);
     tm = localtime(&tt);
     strftime(line, sizeof(line), "%C", tm);
     printf("Start:  %s\n", line);
-    printf("Source: %s (%d)\n", inet_ntoa(in), ntohs(hdr.port));
+    printf("Source: %s (%d)\n", inet_ntoa(in), ntohs(hdr->port));
   }
   if (sin && sin->sin_addr.s_addr == 0) {
-    sin->sin_addr.s_addr = hdr.source;
-    sin->sin_port        = hdr.port;
+    sin->sin_addr.s_addr = hdr->source;
+    sin->sin_port        = hdr->port;
   }
-  return 0;
+  return rd->type == RD_BLOCK;
+} /* header_end */
+
+
+/*
+* Read the header of an rtpdump file after its first line, 'line',
+* which the caller has read already. Return as RD_header().
+*/
+int RD_header_line(FILE *in, const char *line, struct sockaddr_in *sin,
+  struct timeval *start, int verbose)
+{
+  RD_hdr_t hdr;
+  rd_stream_t *rd;
+  char magic[80];
+  int type;
+
+  sprintf(magic, "#!rtpplay%s ", RTPFILE_VERSION);
+  if (strncmp(line, magic, strlen(magic)) == 0) type = RD_DUMP;
+  else {
+    sprintf(magic, "#!rtpplay%s ", RTPFILE_BLOCK_VERSION);
+    if (strncmp(line, magic, strlen(magic)) != 0) return -1;
+    type = RD_BLOCK;
+  }
+  if (!(rd = stream_start(in, type))) return -1;
+  if (fread((char *)&hdr, sizeof(hdr), 1, in) == 0) return -1;
+  start->tv_sec  = ntohl(hdr.start.tv_sec);
+  start->tv_usec = ntohl(hdr.start.tv_usec);
+  return header_end(rd, in, &hdr, sin, start, verbose);
+} /* RD_header_line */
+
+
+/*
+* Read header. Return -1 if not valid, 1 for a compressed rtpdump file,
+* 0 otherwise.
+*/
+int RD_header(FILE *in, struct sockaddr_in *sin, struct timeval *start, int verbose)
+{
+  RD_hdr_t hdr;
+  rd_stream_t *rd;
+  char line[80];
+  uint32_t m;
+
+  /* pcap files are recognized by their first 4 bytes */
+  if (fread(line, 4, 1, in) != 1) return -1;
+  memcpy(&m, line, sizeof(m));
+  if (m == PCAP_MAGIC || m == PCAP_MAGIC_NSEC || m == PCAPNG_SHB ||
+    m == swap32(PCAP_MAGIC) || m == swap32(PCAP_MAGIC_NSEC)) {
+    if (!(rd = stream_start(in, m == PCAPNG_SHB ? RD_PCAPNG : RD_PCAP)) ||
+        pcap_header(rd, in, (unsigned char *)line, start) < 0) return -1;
+    hdr.source = rd->addr;
+    hdr.port   = htons(rd->dport & ~1);
+  }
+  else {
+    if (fgets(line + 4, sizeof(line) - 4, in) == NULL) return -1;
+    return RD_header_line(in, line, sin, start, verbose);
+  }
+  return header_end(rd, in, &hdr, sin, start, verbose);
 } /* RD_header */
 
 
+/*
+* Go back to the first record, e.g., after reading ahead to find the
+* last one. Return -1 if the input is not seekable.
+*/
+int RD_rewind(FILE *in)
+{
+  rd_stream_t *rd = stream(in);
+
+  if (!rd->seekable || fsetpos(in, &rd->data) != 0) return -1;
+  if (rd->type == RD_PCAP || rd->type == RD_PCAPNG) {
+    rd->s = rd->s0;
+    rd->pending = rd->has_first;
+  }
+  rd->held = 0;
+  rd->zpos = rd->zlen = 0;
+  return 0;
+} /* RD_rewind */
+
+
+/*
+* Read the next block header of a compressed file into 'h', in host
+* byte order. Return 1, 0 at the end of the file, or -1 if it is not
+* valid.
+*/
+static int block_header(FILE *in, RD_block_hdr_t *h)
+{
+  if (fread((char *)h, sizeof(*h), 1, in) == 0) return 0;
+  h->clen  = ntohl(h->clen);
+  h->ulen  = ntohl(h->ulen);
+  h->first = ntohl(h->first);
+  h->last  = ntohl(h->last);
+  h->count = ntohl(h->count);
+  if (h->ulen > RD_BLOCK_SIZE || h->clen > h->ulen) {
+    fprintf(stderr, "RD_read: invalid block header\n");
+    return -1;
+  }
+  return 1;
+} /* block_header */
+
+
+/*
+* Read the data of block 'h' and decompress its records into rd->block.
+*/
+static int block_load(rd_stream_t *rd, FILE *in, RD_block_hdr_t *h)
+{
+  unsigned char *data = h->clen == h->ulen ? rd->block : rd->zbuf;
+
+  if (h->clen && fread(data, h->clen, 1, in) == 0) {
+    fprintf(stderr, "RD_read: truncated block\n");
+    return -1;
+  }
+  if (data == rd->zbuf &&
+    lz_decompress(rd->zbuf, h->clen, rd->block, h->ulen) != (int)h->ulen) {
+    fprintf(stderr, "RD_read: invalid compressed block\n");
+    return -1;
+  }
+  rd->zpos = 0;
+  rd->zlen = h->ulen;
+  return 0;
+} /* block_load */
+
+
+/*
+* Pass over the data of block 'h', seeking if the input allows.
+*/
+static int block_skip(rd_stream_t *rd, FILE *in, RD_block_hdr_t *h)
+{
+  if (rd->seekable && fseek(in, h->clen, SEEK_CUR) == 0) return 0;
+  if (h->clen && fread(rd->zbuf, h->clen, 1, in) == 0) return -1;
+  return 0;
+} /* block_skip */
+
+
+/*
+* Return the next record of a compressed file in 'b', as RD_read().
+*/
+static int block_read(rd_stream_t *rd, FILE *in, RD_buffer_t *b)
+{
+  RD_block_hdr_t h;
+  unsigned char *p;
+  int len;
+
+  while (rd->zpos >= rd->zlen) {
+    if (block_header(in, &h) <= 0 || block_load(rd, in, &h) < 0) return 0;
+  }
+  p = rd->block + rd->zpos;
+  len = (p[0] << 8) | p[1];
+  if (rd->zlen - rd->zpos < (int)sizeof(RD_packet_t) ||
+    len < (int)sizeof(RD_packet_t) || len > rd->zlen - rd->zpos ||
+    len > (int)sizeof(b->p)) {
+    fprintf(stderr, "RD_read: invalid record in block\n");
+    rd->zpos = rd->zlen;
+    return 0;
+  }
+  memcpy(b->byte, p, len);
+  rd->zpos += len;
+
+  /* convert to host byte order */
+  b->p.hdr.length = len - sizeof(b->p.hdr);
+  b->p.hdr.offset = ntohl(b->p.hdr.offset);
+  b->p.hdr.plen   = ntohs(b->p.hdr.plen);
+  return b->p.hdr.length;
+} /* block_read */
+
+
+/*
+* Skip the records before 'offset' ms, so that RD_read() returns the
+* first one at or after it. In a compressed file, blocks whose records
+* are all earlier are passed over by their headers, without being
+* decompressed. Return -1 if there is no such record.
+*/
+int RD_skip(FILE *in, uint32_t offset)
+{
+  rd_stream_t *rd = stream(in);
+  RD_block_hdr_t h;
+
+  if (rd->held) {
+    if (rd->hold.p.hdr.offset >= offset) return 0;
+    rd->held = 0;
+  }
+  if (rd->type == RD_BLOCK) {
+    while (rd->zpos >= rd->zlen) {
+      if (block_header(in, &h) <= 0) return -1;
+      if (h.count && h.last >= offset) {
+        if (block_load(rd, in, &h) < 0) return -1;
+      }
+      else if (block_skip(rd, in, &h) < 0) return -1;
+    }
+  }
+  while (RD_read(in, &rd->hold) > 0) {
+    if (rd->hold.p.hdr.offset >= offset) {
+      rd->held = 1;
+      return 0;
+    }
+  }
+  return -1;
+} /* RD_skip */
+
+
+/*
+* Find the latest offset of the records, reading from just after the
+* header, and rewind. Of compressed files, only the block headers are
+* read. Return -1 if the input is not seekable.
+*/
+int RD_last(FILE *in, uint32_t *last)
+{
+  rd_stream_t *rd = stream(in);
+  RD_block_hdr_t h;
+  RD_buffer_t b;
+
+  *last = 0;
+  if (rd->type == RD_BLOCK) {
+    while (block_header(in, &h) > 0 && block_skip(rd, in, &h) == 0) {
+      if (h.count && h.last > *last) *last = h.last;
+    }
+  }
+  else {
+    while (RD_read(in, &b) > 0) {
+      if (b.p.hdr.offset > *last) *last = b.p.hdr.offset;
+    }
+  }
+  return RD_rewind(in);
+} /* RD_last */
+
+
 /*
 * Read next record from input file.
 */
 int RD_read(FILE *in, RD_buffer_t *b)
 {
+  rd_stream_t *rd = stream(in);
+  struct timeval tv;
+
+  if (rd->held) {
+    rd->held = 0;
+    memcpy(b, &rd->hold, sizeof(b->p.hdr) + rd->hold.p.hdr.length);
+    return b->p.hdr.length;
+  }
+  if (rd->type == RD_BLOCK) return block_read(rd, in, b);
+  if (rd->type != RD_DUMP) {
+    if (rd->pending) {
+      rd->pending = 0;
+      memcpy(b, &rd->first, sizeof(b->p.hdr) + rd->first.p.hdr.length);
+      return b->p.hdr.length;
+    }
+    if (pcap_next(rd, in, b, &tv) == 0) return 0;
+    pcap_offset(rd, b, &tv);
+    return b->p.hdr.length;
+  }
+
   /* read packet header from file */
   if (fread((char *)b->byte, sizeof(b->p.hdr), 1, in) == 0) {
     /* we are done */
@@ -100,3 +811,129 @@ int RD_read(FILE *in, RD_buffer_t *b)
   }
   return b->p.hdr.length;
 } /* RD_read */
+
+
+/*
+* Write a file header of version 'version'.
+*/
+static int write_header(FILE *out, const char *version,
+  struct sockaddr_in *sin, struct timeval *start)
+{
+  RD_hdr_t hdr;
+
+  fprintf(out, "#!rtpplay%s %s/%d\n", version,
+    inet_ntoa(sin->sin_addr), ntohs(sin->sin_port));
+  hdr.start.tv_sec  = htonl(start->tv_sec);
+  hdr.start.tv_usec = htonl(start->tv_usec);
+  hdr.source = sin->sin_addr.s_addr;
+  hdr.port   = sin->sin_port;
+  hdr.padding = 0; /* value will be compiler dependent unless clear it */
+  if (fwrite((char *)&hdr, sizeof(hdr), 1, out) < 1) return -1;
+  return 0;
+} /* write_header */
+
+
+/*
+* Write the file header, as read by RD_header(). Return -1 on error.
+*/
+int RD_write_header(FILE *out, struct sockaddr_in *sin,
+  struct timeval *start)
+{
+  return write_header(out, RTPFILE_VERSION, sin, start);
+} /* RD_write_header */
+
+
+/*
+* Write record 'b', whose header is in host byte order as returned by
+* RD_read(). Return -1 on error.
+*/
+int RD_write(FILE *out, RD_buffer_t *b)
+{
+  RD_packet_t hdr;
+
+  hdr.length = htons(b->p.hdr.length + sizeof(hdr));
+  hdr.plen   = htons(b->p.hdr.plen);
+  hdr.offset = htonl(b->p.hdr.offset);
+  if (fwrite((char *)&hdr, sizeof(hdr), 1, out) < 1 ||
+      fwrite(b->p.data, b->p.hdr.length, 1, out) < 1) return -1;
+  return 0;
+} /* RD_write */
+
+
+/*
+* Start writing a compressed file to 'out'. If 'sin' is not NULL, write
+* its file header first; otherwise blocks are appended to a file that
+* has one. Return NULL on error.
+*/
+RD_block_t *RD_block_open(FILE *out, struct sockaddr_in *sin,
+  struct timeval *start)
+{
+  RD_block_t *z;
+
+  if (sin && write_header(out, RTPFILE_BLOCK_VERSION, sin, start) < 0)
+    return NULL;
+  if (!(z = (RD_block_t *)calloc(1, sizeof(RD_block_t)))) return NULL;
+  z->out = out;
+  return z;
+} /* RD_block_open */
+
+
+/*
+* Compress and write the records collected in 'z', unless there are none.
+*/
+static int block_flush(RD_block_t *z)
+{
+  RD_block_hdr_t h;
+  unsigned char *data = zout;
+  int clen;
+
+  if (z->h.count == 0) return 0;
+  /* stored as they are unless that saves something */
+  if ((clen = lz_compress(z->buf, z->len, zout, z->len - 1)) == 0) {
+    data = z->buf;
+    clen = z->len;
+  }
+  h.clen  = htonl(clen);
+  h.ulen  = htonl(z->len);
+  h.first = htonl(z->h.first);
+  h.last  = htonl(z->h.last);
+  h.count = htonl(z->h.count);
+  z->len = 0;
+  z->h.count = 0;
+  if (fwrite((char *)&h, sizeof(h), 1, z->out) < 1 ||
+      fwrite(data, clen, 1, z->out) < 1) return -1;
+  return 0;
+} /* block_flush */
+
+
+/*
+* Add record 'rec' of 'len' bytes, in network byte order as in an
+* uncompressed file, to compressed file 'z'. Return -1 on error.
+*/
+int RD_block_write(RD_block_t *z, const void *rec, int len)
+{
+  uint32_t offset;
+
+  if (z->len + len > RD_BLOCK_SIZE && block_flush(z) < 0) return -1;
+  memcpy(&offset, (const char *)rec + 4, sizeof(offset));
+  offset = ntohl(offset);
+  if (z->h.count == 0 || offset < z->h.first) z->h.first = offset;
+  if (z->h.count == 0 || offset > z->h.last) z->h.last = offset;
+  memcpy(z->buf + z->len, rec, len);
+  z->len += len;
+  z->h.count++;
+  return 0;
+} /* RD_block_write */
+
+
+/*
+* Write the last block of 'z' and free it; 'out' stays open. Return -1
+* on error.
+*/
+int RD_block_close(RD_block_t *z)
+{
+  int r = block_flush(z);
+
+  free(z);
+  return r;
+} /* RD_block_close */
@@ -51,10 +51,17 @@
 #include "rtp.h"
 #include "vat.h"
 #include "payload.h"
+#include "stats.h"
+#include "filter.h"
 #include "rtpdump.h"
 #include "sysdep.h"
+#include "notify.h"
+#include "multimer.h"
+
+#if HAVE_SOCKFILTER
+#include <linux/filter.h>
+#endif
 
-#define RTPFILE_VERSION "1.0"
 
 extern int hpt(char*, struct sockaddr_in*, unsigned char*);
 extern struct pt payload[];
@@ -62,6 +69,8 @@ extern struct pt payload[];
 typedef uint32_t member_t;
 
 static int verbose = 0; /* decode */
+static int compress = 0; /* -z: compressed dump files */
+static RD_block_t *zout; /* compressed output, unless demultiplexing */
 
 typedef enum {
 	F_invalid,
@@ -71,14 +80,17 @@ typedef enum {
 	F_rtcp,
 	F_short,
 	F_payload,
-	F_ascii
+	F_pcap,
+	F_ascii,
+	F_stats
 } t_format;
 
 static void usage(const char *argv0)
 {
   fprintf(stderr, "usage: %s "
-	"[-F hex|ascii|rtcp|short|payload|dump|header] "
-	"[-f infile] [-o outfile] [-t minutes] [-x bytes] "
+	"[-F hex|ascii|rtcp|short|payload|pcap|dump|header|stats] "
+	"[-b bytes] [-d directory] [-e filter] [-f infile] [-i seconds] "
+	"[-o outfile] [-p port] [-t minutes] [-U] [-x bytes] [-z] "
 	"[address]/port > file\n", argv0);
 }
 
@@ -98,14 +110,153 @@ static double tdbl(struct timeval *a)
 
 
 /*
-* Print buffer 'buf' of length 'len' bytes in hex format to file 'out'.
+ * Text output is formatted into a buffer that is written out with one
+ * fwrite() per packet. Numbers are converted by hand and bytes to hex
+ * through a table; the output is the same as with the printf() formats
+ * noted at each call.
+ */
+typedef struct {
+  FILE *out;
+  int len;
+  char buf[8192];
+} obuf_t;
+
+static obuf_t ob;
+
+static char hexpair[256][2];   /* "00" .. "ff" */
+static char fraction[256][16]; /* "%g" of 0/256 .. 255/256 */
+
+/*
+* Fill the conversion tables.
 */
-static void hex(FILE *out, char *buf, int len)
+static void ob_init(void)
 {
+  static const char digit[] = "0123456789abcdef";
   int i;
 
-  for (i = 0; i < len; i++) {
-    fprintf(out, "%02x", (unsigned char)buf[i]);
+  for (i = 0; i < 256; i++) {
+    hexpair[i][0] = digit[i >> 4];
+    hexpair[i][1] = digit[i & 15];
+    sprintf(fraction[i], "%g", i / 256.);
+  }
+} /* ob_init */
+
+
+/*
+* Write the buffer to its file.
+*/
+static void ob_flush(obuf_t *o)
+{
+  if (o->len) fwrite(o->buf, 1, o->len, o->out);
+  o->len = 0;
+} /* ob_flush */
+
+
+/*
+* Make room for 'n' <= sizeof(o->buf) bytes.
+*/
+#define ob_room(o, n) \
+  do { if ((o)->len + (n) > (int)sizeof((o)->buf)) ob_flush(o); } while (0)
+
+static void ob_mem(obuf_t *o, const char *s, int n)
+{
+  int k;
+
+  while (n > 0) {
+    ob_room(o, 1);
+    k = sizeof(o->buf) - o->len;
+    if (k > n) k = n;
+    memcpy(o->buf + o->len, s, k);
+    o->len += k;
+    s += k;
+    n -= k;
+  }
+} /* ob_mem */
+
+/* "%s" */
+static void ob_str(obuf_t *o, const char *s)
+{
+  ob_mem(o, s ? s : "(null)", strlen(s ? s : "(null)"));
+} /* ob_str */
+
+/* "%lu" */
+static void ob_ulong(obuf_t *o, unsigned long v)
+{
+  char tmp[24];
+  int i = sizeof(tmp);
+
+  do {
+    tmp[--i] = '0' + v % 10;
+    v /= 10;
+  } while (v);
+  ob_mem(o, tmp + i, sizeof(tmp) - i);
+} /* ob_ulong */
+
+/* "%ld" */
+static void ob_long(obuf_t *o, long v)
+{
+  if (v < 0) {
+    ob_mem(o, "-", 1);
+    ob_ulong(o, -(unsigned long)v);
+  }
+  else ob_ulong(o, v);
+} /* ob_long */
+
+/* "%06lu" */
+static void ob_usec(obuf_t *o, unsigned long v)
+{
+  char tmp[24];
+  int i = sizeof(tmp);
+
+  do {
+    tmp[--i] = '0' + v % 10;
+    v /= 10;
+  } while (v || i > (int)sizeof(tmp) - 6);
+  ob_mem(o, tmp + i, sizeof(tmp) - i);
+} /* ob_usec */
+
+/* "%lx" */
+static void ob_xlong(obuf_t *o, unsigned long v)
+{
+  char tmp[24];
+  int i = sizeof(tmp);
+
+  do {
+    tmp[--i] = hexpair[v & 15][1];
+    v >>= 4;
+  } while (v);
+  ob_mem(o, tmp + i, sizeof(tmp) - i);
+} /* ob_xlong */
+
+/* "%*.*s" with width and precision 'len' >= 0 */
+static void ob_field(obuf_t *o, const char *s, int len)
+{
+  const char *nul = memchr(s, 0, len);
+  int n = nul ? nul - s : len;
+
+  while (n < len--) ob_mem(o, " ", 1);
+  ob_mem(o, s, n);
+} /* ob_field */
+
+
+/*
+* Print buffer 'buf' of length 'len' bytes in hex format, 16 bytes at a
+* time.
+*/
+static void hex(obuf_t *o, char *buf, int len)
+{
+  unsigned char *b = (unsigned char *)buf;
+  char *p;
+  int i, n;
+
+  while (len > 0) {
+    n = len < 16 ? len : 16;
+    ob_room(o, 32);
+    p = o->buf + o->len;
+    for (i = 0; i < n; i++, p += 2) memcpy(p, hexpair[b[i]], 2);
+    o->len += 2 * n;
+    b += n;
+    len -= n;
   }
 } /* hex */
 
@@ -114,7 +265,7 @@ static void hex(FILE *out, char *buf, int len)
 * Open network sockets.
 */
 static int open_network(char *host, int data, int sock[], struct
-  sockaddr_in *sin)
+  sockaddr_in *sin, int rcvbuf)
 {
   struct ip_mreq mreq;      /* multicast group */
   int i;
@@ -159,6 +310,24 @@ static int open_network(char *host, int data, int sock[], struct
       perror("setsockopt: reuseport");
 #endif
 
+    if (rcvbuf > 0) {
+      int r = -1;
+
+#ifdef SO_RCVBUFFORCE /* Linux: beyond rmem_max, if privileged */
+      r = setsockopt(sock[i], SOL_SOCKET, SO_RCVBUFFORCE, (char *) &rcvbuf,
+            sizeof(rcvbuf));
+#endif
+      if (r == -1 && setsockopt(sock[i], SOL_SOCKET, SO_RCVBUF,
+            (char *) &rcvbuf, sizeof(rcvbuf)) == -1)
+        perror("setsockopt: rcvbuf");
+    }
+
+#ifdef SO_RXQ_OVFL /* Linux: report the kernel's drop counter */
+    if (setsockopt(sock[i], SOL_SOCKET, SO_RXQ_OVFL, (char *) &one,
+           sizeof(one)) == -1)
+      perror("setsockopt: rxq_ovfl");
+#endif
+
     sin->sin_port = htons(ntohs(sin->sin_port) + i);
     if (bind(sock[i], (struct sockaddr *)sin, sizeof(*sin)) < 0) {
       if (errno == EADDRNOTAVAIL) {
@@ -194,20 +363,122 @@ static int open_network(char *host, int data, int sock[], struct
 static void rtpdump_header(FILE *out, struct sockaddr_in *sin,
   struct timeval *start)
 {
-  RD_hdr_t hdr;
+  if (RD_write_header(out, sin, start) < 0) {
+    perror("fwrite");
+    exit(1);
+  }
+} /* rtpdump_header */
+
+
+/*
+* Start compressed output to 'out', with a file header unless 'sin' is
+* NULL.
+*/
+static RD_block_t *block_open(FILE *out, struct sockaddr_in *sin,
+  struct timeval *start)
+{
+  RD_block_t *z = RD_block_open(out, sin, start);
+
+  if (!z) {
+    perror("compressed output");
+    exit(1);
+  }
+  return z;
+} /* block_open */
+
+
+/*
+* pcap output: each packet is written as an IPv4/UDP datagram (link
+* type "raw IP") from its source to the capture address, the data port
+* for RTP and the next one for RTCP. File input has no source address,
+* so 0.0.0.0:0 is used.
+*/
+static struct {
+  struct sockaddr_in dst;    /* capture address */
+  struct timeval base;       /* added to packet times from file input */
+} pcap_out;
 
-  fprintf(out, "#!rtpplay%s %s/%d\n", RTPFILE_VERSION,
-    inet_ntoa(sin->sin_addr), ntohs(sin->sin_port));
-  hdr.start.tv_sec  = htonl(start->tv_sec);
-  hdr.start.tv_usec = htonl(start->tv_usec);
-  hdr.source = sin->sin_addr.s_addr;
-  hdr.port   = sin->sin_port;
-  hdr.padding = 0; /* value will be compiler dependent unless clear it */
+
+/*
+* Write the pcap file header to 'out'.
+*/
+static void pcap_header(FILE *out)
+{
+  struct {
+    uint32_t magic;
+    uint16_t major, minor;
+    int32_t  thiszone;
+    uint32_t sigfigs, snaplen, linktype;
+  } hdr;
+
+  hdr.magic    = 0xa1b2c3d4;  /* host byte order, microseconds */
+  hdr.major    = 2;
+  hdr.minor    = 4;
+  hdr.thiszone = 0;
+  hdr.sigfigs  = 0;
+  hdr.snaplen  = 65535;
+  hdr.linktype = 101;         /* LINKTYPE_RAW */
   if (fwrite((char *)&hdr, sizeof(hdr), 1, out) < 1) {
     perror("fwrite");
     exit(1);
   }
-} /* rtpdump_header */
+} /* pcap_header */
+
+
+/*
+* Write the first 'caplen' bytes of packet 'buf' of 'len' bytes,
+* received at 'now' from 'sin', to pcap file 'out'.
+*/
+static void pcap_packet(FILE *out, struct timeval now, int ctrl,
+  struct sockaddr_in *sin, const char *buf, int len, int caplen)
+{
+  struct {
+    uint32_t sec, usec, caplen, len;
+  } rec;
+  unsigned char h[28];
+  uint32_t sum = 0;
+  uint16_t port = htons(ntohs(pcap_out.dst.sin_port) + ctrl);
+  int i;
+
+  now.tv_sec  += pcap_out.base.tv_sec;
+  now.tv_usec += pcap_out.base.tv_usec;
+  if (now.tv_usec >= 1000000) {
+    now.tv_sec++;
+    now.tv_usec -= 1000000;
+  }
+  rec.sec    = now.tv_sec;
+  rec.usec   = now.tv_usec;
+  rec.caplen = sizeof(h) + caplen;
+  rec.len    = sizeof(h) + len;
+
+  /* IPv4 header, without options and with don't fragment */
+  memset(h, 0, sizeof(h));
+  h[0] = 0x45;
+  h[2] = rec.len >> 8;
+  h[3] = rec.len;
+  h[6] = 0x40;
+  h[8] = 64;   /* TTL */
+  h[9] = 17;   /* UDP */
+  memcpy(h + 12, &sin->sin_addr, 4);
+  memcpy(h + 16, &pcap_out.dst.sin_addr, 4);
+  for (i = 0; i < 20; i += 2) sum += (h[i] << 8) | h[i + 1];
+  while (sum >> 16) sum = (sum & 0xffff) + (sum >> 16);
+  h[10] = ~sum >> 8;
+  h[11] = ~sum;
+
+  /* UDP header, without checksum */
+  memcpy(h + 20, &sin->sin_port, 2);
+  memcpy(h + 22, &port, 2);
+  h[24] = (8 + len) >> 8;
+  h[25] = 8 + len;
+
+  if (fwrite((char *)&rec, sizeof(rec), 1, out) < 1 ||
+      fwrite((char *)h, sizeof(h), 1, out) < 1 ||
+      (caplen > 0 && fwrite(buf, caplen, 1, out) < 1)) {
+    perror("fwrite");
+    exit(1);
+  }
+} /* pcap_packet */
 
 
 /*
@@ -256,7 +527,7 @@ static int parse_header(char *buf)
 /*
 * Return header length.
 */
-static int parse_data(FILE *out, char *buf, int len)
+static int parse_data(obuf_t *o, char *buf, int len)
 {
   rtp_hdr_t *r = (rtp_hdr_t *)buf;
   rtp_hdr_ext_t *ext;
@@ -266,68 +537,137 @@ static int parse_data(FILE *out, char *buf, int len)
   /* Show vat format packets. */
   if (r->version == 0) {
     vat_hdr_t *v = (vat_hdr_t *)buf;
-    fprintf(out, "nsid=%d flags=0x%x confid=%u ts=%u\n",
-      v->nsid, v->flags, v->confid, v->ts);
+    /* "nsid=%d flags=0x%x confid=%u ts=%u\n" */
+    ob_str(o, "nsid=");       ob_long(o, v->nsid);
+    ob_str(o, " flags=0x");   ob_xlong(o, v->flags);
+    ob_str(o, " confid=");    ob_ulong(o, v->confid);
+    ob_str(o, " ts=");        ob_ulong(o, v->ts);
+    ob_str(o, "\n");
     hlen = 8 + v->nsid * 4;
   }
   else if (r->version == RTP_VERSION) {
     hlen = 12 + r->cc * 4;
     if (len < hlen) {
-      fprintf(out, "RTP header too short (%d bytes for %d CSRCs).\n",
-         len, r->cc);
+      ob_str(o, "RTP header too short (");
+      ob_long(o, len);
+      ob_str(o, " bytes for ");
+      ob_long(o, r->cc);
+      ob_str(o, " CSRCs).\n");
       return hlen;
     }
-    fprintf(out,
-    "v=%d p=%d x=%d cc=%d m=%d pt=%d (%s,%d,%d) seq=%u ts=%lu ssrc=0x%lx ",
-      r->version, r->p, r->x, r->cc, r->m,
-      r->pt, payload[r->pt].enc, payload[r->pt].ch, payload[r->pt].rate,
-      ntohs(r->seq),
-      (unsigned long)ntohl(r->ts),
-      (unsigned long)ntohl(r->ssrc));
+    /* "v=%d p=%d x=%d cc=%d m=%d pt=%d (%s,%d,%d) seq=%u ts=%lu ssrc=0x%lx " */
+    ob_str(o, "v=");          ob_long(o, r->version);
+    ob_str(o, " p=");         ob_long(o, r->p);
+    ob_str(o, " x=");         ob_long(o, r->x);
+    ob_str(o, " cc=");        ob_long(o, r->cc);
+    ob_str(o, " m=");         ob_long(o, r->m);
+    ob_str(o, " pt=");        ob_long(o, r->pt);
+    ob_str(o, " (");          ob_str(o, payload[r->pt].enc);
+    ob_str(o, ",");           ob_long(o, payload[r->pt].ch);
+    ob_str(o, ",");           ob_long(o, (int)payload[r->pt].rate);
+    ob_str(o, ") seq=");      ob_ulong(o, ntohs(r->seq));
+    ob_str(o, " ts=");        ob_ulong(o, (unsigned long)ntohl(r->ts));
+    ob_str(o, " ssrc=0x");    ob_xlong(o, (unsigned long)ntohl(r->ssrc));
+    ob_str(o, " ");
     for (i = 0; i < r->cc; i++) {
-      fprintf(out, "csrc[%d]=0x%0lx ", i, (long)r->csrc[i]);
+      /* "csrc[%d]=0x%0lx " */
+      ob_str(o, "csrc[");
+      ob_long(o, i);
+      ob_str(o, "]=0x");
+      ob_xlong(o, (unsigned long)r->csrc[i]);
+      ob_str(o, " ");
     }
     if (r->x) {  /* header extension */
       ext = (rtp_hdr_ext_t *)((char *)buf + hlen);
       ext_len = ntohs(ext->len);
 
-      fprintf(out, "ext_type=0x%x ", ntohs(ext->ext_type));
-      fprintf(out, "ext_len=%d ", ext_len);
+      ob_str(o, "ext_type=0x");
+      ob_xlong(o, ntohs(ext->ext_type));
+      ob_str(o, " ext_len=");
+      ob_long(o, ext_len);
+      ob_str(o, " ");
 
       if (ext_len) {
-        fprintf(out, "ext_data=");
-        hex(out, (char *)(ext+1), (ext_len*4));
-        fprintf(out, " ");
+        ob_str(o, "ext_data=");
+        hex(o, (char *)(ext+1), (ext_len*4));
+        ob_str(o, " ");
       }
     }
   }
   else {
-    fprintf(out, "RTP version wrong (%d).\n", r->version);
+    ob_str(o, "RTP version wrong (");
+    ob_long(o, r->version);
+    ob_str(o, ").\n");
   }
   return hlen;
 } /* parse_data */
 
 
+/*
+* Print time 'now' as "%ld.%06ld", negated if 'neg' is set.
+*/
+static void parse_time(obuf_t *o, struct timeval now, int neg)
+{
+  ob_long(o, neg ? -now.tv_sec : now.tv_sec);
+  ob_str(o, ".");
+  ob_usec(o, now.tv_usec);
+} /* parse_time */
+
+
+/*
+* Print the start of a packet line, "%ld.%06ld %s len=%d from=%s:%u ".
+* The source address is converted only when it changes.
+*/
+static void parse_prefix(obuf_t *o, struct timeval now, const char *type,
+  int len, struct sockaddr_in *sin)
+{
+  static struct sockaddr_in last;
+  static char from[40];
+  static int from_len = 0;
+
+  if (!from_len || last.sin_addr.s_addr != sin->sin_addr.s_addr ||
+      last.sin_port != sin->sin_port) {
+    last = *sin;
+    from_len = sprintf(from, " from=%s:%u ", inet_ntoa(sin->sin_addr),
+      ntohs(sin->sin_port));
+  }
+  parse_time(o, now, 0);
+  ob_str(o, " ");
+  ob_str(o, type);
+  ob_str(o, " len=");
+  ob_long(o, len);
+  ob_mem(o, from, from_len);
+} /* parse_prefix */
+
+
 /*
 * Print minimal per-packet information: time, timestamp, sequence number.
 */
-static void parse_short(FILE *out, struct timeval now, char *buf, int len)
+static void parse_short(obuf_t *o, struct timeval now, char *buf, int len)
 {
   rtp_hdr_t *r = (rtp_hdr_t *)buf;
 
   if (r->version == 0) {
     vat_hdr_t *v = (vat_hdr_t *)buf;
-    fprintf(out, "%ld.%06ld %lu\n",
-      (v->flags ? -now.tv_sec : now.tv_sec), (long)now.tv_usec,
-      (unsigned long)ntohl(v->ts));
+    /* "%ld.%06ld %lu\n" */
+    parse_time(o, now, v->flags);
+    ob_str(o, " ");
+    ob_ulong(o, (unsigned long)ntohl(v->ts));
+    ob_str(o, "\n");
   }
   else if (r->version == 2) {
-    fprintf(out, "%ld.%06ld %lu %u\n",
-      (r->m ? -now.tv_sec : now.tv_sec), (long)now.tv_usec,
-      (unsigned long)ntohl(r->ts), ntohs(r->seq));
+    /* "%ld.%06ld %lu %u\n" */
+    parse_time(o, now, r->m);
+    ob_str(o, " ");
+    ob_ulong(o, (unsigned long)ntohl(r->ts));
+    ob_str(o, " ");
+    ob_ulong(o, ntohs(r->seq));
+    ob_str(o, "\n");
   }
   else {
-    fprintf(out, "RTP version wrong (%d).\n", r->version);
+    ob_str(o, "RTP version wrong (");
+    ob_long(o, r->version);
+    ob_str(o, ").\n");
   }
 } /* parse_short */
 
@@ -335,7 +675,7 @@ static void parse_short(FILE *out, struct timeval now, char *buf, int len)
 /*
 * Show SDES information for one member.
 */
-static void member_sdes(FILE *out, member_t m, rtcp_sdes_type_t t, char *b, int len)
+static void member_sdes(obuf_t *o, member_t m, rtcp_sdes_type_t t, char *b, int len)
 {
   static struct {
     rtcp_sdes_type_t t;
@@ -354,14 +694,16 @@ static void member_sdes(FILE *out, member_t m, rtcp_sdes_type_t t, char *b, int
     {0,0}
   };
   int i;
-  char num[10];
 
-  sprintf(num, "%d", t);
   for (i = 0; map[i].name; i++) {
     if (map[i].t == t) break;
   }
-  fprintf(out, "%s=\"%*.*s\" ",
-    map[i].name ? map[i].name : num, len, len, b);
+  /* "%s=\"%*.*s\" " */
+  if (map[i].name) ob_str(o, map[i].name);
+  else ob_long(o, t);
+  ob_str(o, "=\"");
+  ob_field(o, b, len);
+  ob_str(o, "\" ");
 } /* member_sdes */
 
 
@@ -369,7 +711,7 @@ static void member_sdes(FILE *out, member_t m, rtcp_sdes_type_t t, char *b, int
 * Parse one SDES chunk (one SRC description). Total length is 'len'.
 * Return new buffer position or zero if error.
 */
-static char *rtp_read_sdes(FILE *out, char *b, int len)
+static char *rtp_read_sdes(obuf_t *o, char *b, int len)
 {
   rtcp_sdes_item_t *rsp;
   uint32_t src = *(uint32_t *)b;
@@ -381,7 +723,7 @@ static char *rtp_read_sdes(FILE *out, char *b, int len)
   }
   rsp = (rtcp_sdes_item_t *)(b + 4);
   for (; rsp->type; rsp = (rtcp_sdes_item_t *)((char *)rsp + rsp->length + 2)) {
-    member_sdes(out, src, rsp->type, rsp->data, rsp->length);
+    member_sdes(o, src, rsp->type, rsp->data, rsp->length);
     total_len += rsp->length + 2;
   }
   if (total_len >= len) {
@@ -396,10 +738,39 @@ static char *rtp_read_sdes(FILE *out, char *b, int len)
 } /* rtp_read_sdes */
 
 
+/*
+* Print one report block:
+* "  (ssrc=0x%lx fraction=%g lost=%ld last_seq=%lu jit=%lu lsr=%lu dlsr=%lu )\n"
+*/
+static void parse_rr(obuf_t *o, rtcp_rr_t *rr)
+{
+  ob_str(o, "  (ssrc=0x");    ob_xlong(o, (unsigned long)ntohl(rr->ssrc));
+  ob_str(o, " fraction=");    ob_str(o, fraction[rr->fraction]);
+  ob_str(o, " lost=");        ob_long(o, (long)RTCP_GET_LOST(rr));
+  ob_str(o, " last_seq=");    ob_ulong(o, (unsigned long)ntohl(rr->last_seq));
+  ob_str(o, " jit=");         ob_ulong(o, (unsigned long)ntohl(rr->jitter));
+  ob_str(o, " lsr=");         ob_ulong(o, (unsigned long)ntohl(rr->lsr));
+  ob_str(o, " dlsr=");        ob_ulong(o, (unsigned long)ntohl(rr->dlsr));
+  ob_str(o, " )\n");
+} /* parse_rr */
+
+
+/*
+* Print " p=%d count=%d len=%d\n" of RTCP header 'r'.
+*/
+static void parse_common(obuf_t *o, rtcp_t *r)
+{
+  ob_str(o, " p=");           ob_long(o, r->common.p);
+  ob_str(o, " count=");       ob_long(o, r->common.count);
+  ob_str(o, " len=");         ob_long(o, ntohs(r->common.length));
+  ob_str(o, "\n");
+} /* parse_common */
+
+
 /*
 * Return length parsed, -1 on error.
 */
-static int parse_control(FILE *out, char *buf, int len)
+static int parse_control(obuf_t *o, char *buf, int len)
 {
   rtcp_t *r;         /* RTCP header */
   int i;
@@ -409,74 +780,67 @@ static int parse_control(FILE *out, char *buf, int len)
   if (r->common.version == 0) {
     struct CtrlMsgHdr *v = (struct CtrlMsgHdr *)buf;
 
-    fprintf(out, "flags=0x%x type=0x%x confid=%u\n",
-      v->flags, v->type, v->confid);
+    /* "flags=0x%x type=0x%x confid=%u\n" */
+    ob_str(o, "flags=0x");    ob_xlong(o, v->flags);
+    ob_str(o, " type=0x");    ob_xlong(o, v->type);
+    ob_str(o, " confid=");    ob_ulong(o, v->confid);
+    ob_str(o, "\n");
   }
   else if (r->common.version == RTP_VERSION) {
-    fprintf(out, "\n");
+    ob_str(o, "\n");
     while (len > 0) {
       len -= (ntohs(r->common.length) + 1) << 2;
       if (len < 0) {
         /* something wrong with packet format */
-        fprintf(out, "Illegal RTCP packet length %d words.\n",
-           ntohs(r->common.length));
+        ob_str(o, "Illegal RTCP packet length ");
+        ob_long(o, ntohs(r->common.length));
+        ob_str(o, " words.\n");
         return -1;
       }
 
       switch (r->common.pt) {
       case RTCP_SR:
-        fprintf(out, " (SR ssrc=0x%lx p=%d count=%d len=%d\n",
-          (unsigned long)ntohl(r->r.rr.ssrc),
-          r->common.p, r->common.count,
-          ntohs(r->common.length));
-        fprintf(out, "  ntp=%lu.%lu ts=%lu psent=%lu osent=%lu\n",
-          (unsigned long)ntohl(r->r.sr.ntp_sec),
-          (unsigned long)ntohl(r->r.sr.ntp_frac),
-          (unsigned long)ntohl(r->r.sr.rtp_ts),
-          (unsigned long)ntohl(r->r.sr.psent),
-          (unsigned long)ntohl(r->r.sr.osent));
+        /* " (SR ssrc=0x%lx p=%d count=%d len=%d\n" */
+        ob_str(o, " (SR ssrc=0x");
+        ob_xlong(o, (unsigned long)ntohl(r->r.rr.ssrc));
+        parse_common(o, r);
+        /* "  ntp=%lu.%lu ts=%lu psent=%lu osent=%lu\n" */
+        ob_str(o, "  ntp=");    ob_ulong(o, (unsigned long)ntohl(r->r.sr.ntp_sec));
+        ob_str(o, ".");         ob_ulong(o, (unsigned long)ntohl(r->r.sr.ntp_frac));
+        ob_str(o, " ts=");      ob_ulong(o, (unsigned long)ntohl(r->r.sr.rtp_ts));
+        ob_str(o, " psent=");   ob_ulong(o, (unsigned long)ntohl(r->r.sr.psent));
+        ob_str(o, " osent=");   ob_ulong(o, (unsigned long)ntohl(r->r.sr.osent));
+        ob_str(o, "\n");
         for (i = 0; i < r->common.count; i++) {
-          fprintf(out, "  (ssrc=0x%lx fraction=%g lost=%ld last_seq=%lu jit=%lu lsr=%lu dlsr=%lu )\n",
-           (unsigned long)ntohl(r->r.sr.rr[i].ssrc),
-           r->r.sr.rr[i].fraction / 256.,
-           (long)RTCP_GET_LOST(&r->r.sr.rr[i]),
-           (unsigned long)ntohl(r->r.sr.rr[i].last_seq),
-           (unsigned long)ntohl(r->r.sr.rr[i].jitter),
-           (unsigned long)ntohl(r->r.sr.rr[i].lsr),
-           (unsigned long)ntohl(r->r.sr.rr[i].dlsr));
+          parse_rr(o, &r->r.sr.rr[i]);
         }
-        fprintf(out, " )\n");
+        ob_str(o, " )\n");
         break;
 
       case RTCP_RR:
-        fprintf(out, " (RR ssrc=0x%lx p=%d count=%d len=%d\n",
-          (unsigned long)ntohl(r->r.rr.ssrc), r->common.p, r->common.count,
-          ntohs(r->common.length));
+        ob_str(o, " (RR ssrc=0x");
+        ob_xlong(o, (unsigned long)ntohl(r->r.rr.ssrc));
+        parse_common(o, r);
         for (i = 0; i < r->common.count; i++) {
-          fprintf(out, "  (ssrc=0x%lx fraction=%g lost=%ld last_seq=%lu jit=%lu lsr=%lu dlsr=%lu )\n",
-            (unsigned long)ntohl(r->r.rr.rr[i].ssrc),
-            r->r.rr.rr[i].fraction / 256.,
-            (long)RTCP_GET_LOST(&r->r.rr.rr[i]),
-            (unsigned long)ntohl(r->r.rr.rr[i].last_seq),
-            (unsigned long)ntohl(r->r.rr.rr[i].jitter),
-            (unsigned long)ntohl(r->r.rr.rr[i].lsr),
-            (unsigned long)ntohl(r->r.rr.rr[i].dlsr));
+          parse_rr(o, &r->r.rr.rr[i]);
         }
-        fprintf(out, " )\n");
+        ob_str(o, " )\n");
         break;
 
       case RTCP_SDES:
-        fprintf(out, " (SDES p=%d count=%d len=%d\n",
-          r->common.p, r->common.count, ntohs(r->common.length));
+        ob_str(o, " (SDES");
+        parse_common(o, r);
         buf = (char *)&r->r.sdes;
         for (i = 0; i < r->common.count; i++) {
           int remaining = (ntohs(r->common.length) << 2) -
                           (buf - (char *)&r->r.sdes);
 
-          fprintf(out, "  (src=0x%lx ",
-            (unsigned long)ntohl(((struct rtcp_sdes *)buf)->src));
+          /* "  (src=0x%lx " */
+          ob_str(o, "  (src=0x");
+          ob_xlong(o, (unsigned long)ntohl(((struct rtcp_sdes *)buf)->src));
+          ob_str(o, " ");
           if (remaining > 0) {
-            buf = rtp_read_sdes(out, buf,
+            buf = rtp_read_sdes(o, buf,
               (ntohs(r->common.length) << 2) - (buf - (char *)&r->r.sdes));
             if (!buf) return -1;
           }
@@ -484,42 +848,341 @@ static int parse_control(FILE *out, char *buf, int len)
             fprintf(stderr, "Missing at least %d bytes.\n", -remaining);
             return -1;
           }
-          fprintf(out, ")\n");
+          ob_str(o, ")\n");
         }
-        fprintf(out, " )\n");
+        ob_str(o, " )\n");
         break;
 
       case RTCP_BYE:
-        fprintf(out, " (BYE p=%d count=%d len=%d\n",
-          r->common.p, r->common.count, ntohs(r->common.length));
+        ob_str(o, " (BYE");
+        parse_common(o, r);
         for (i = 0; i < r->common.count; i++) {
-          fprintf(out, "  (ssrc[%d]=0x%0lx ", i,
-            (unsigned long)ntohl(r->r.bye.src[i]));
+          /* "  (ssrc[%d]=0x%0lx " */
+          ob_str(o, "  (ssrc[");
+          ob_long(o, i);
+          ob_str(o, "]=0x");
+          ob_xlong(o, (unsigned long)ntohl(r->r.bye.src[i]));
+          ob_str(o, " ");
         }
-        fprintf(out, ")\n");
+        ob_str(o, ")\n");
         if (ntohs(r->common.length) > r->common.count) {
           buf = (char *)&r->r.bye.src[r->common.count];
-          fprintf(out, "reason=\"%*.*s\"", *buf, *buf, buf+1);
+          /* "reason=\"%*.*s\"" */
+          if (*buf >= 0) {
+            ob_str(o, "reason=\"");
+            ob_field(o, buf+1, *buf);
+            ob_str(o, "\"");
+          }
+          else {
+            ob_flush(o);
+            fprintf(o->out, "reason=\"%*.*s\"", *buf, *buf, buf+1);
+          }
         }
-        fprintf(out, " )\n");
+        ob_str(o, " )\n");
         break;
 
       /* invalid type */
       default:
-        fprintf(out, "(? pt=%d src=0x%lx)\n", r->common.pt,
-          (unsigned long)ntohl(r->r.sdes.src));
+        /* "(? pt=%d src=0x%lx)\n" */
+        ob_str(o, "(? pt=");
+        ob_long(o, r->common.pt);
+        ob_str(o, " src=0x");
+        ob_xlong(o, (unsigned long)ntohl(r->r.sdes.src));
+        ob_str(o, ")\n");
       break;
       }
       r = (rtcp_t *)((uint32_t *)r + ntohs(r->common.length) + 1);
     }
   }
   else {
-    fprintf(out, "invalid version %d\n", r->common.version);
+    ob_str(o, "invalid version ");
+    ob_long(o, r->common.version);
+    ob_str(o, "\n");
   }
   return len;
 } /* parse_control */
 
 
+/*
+ * Per-SSRC statistics for -F stats, see stats.h.
+ */
+static struct {
+  stats_table_t t;
+  FILE *out;
+  double interval;              /* seconds between reports, or 0 */
+  double next;                  /* time of next report */
+} stats;
+
+
+/*
+* Print the sources that sent packets in the interval ending at 'now'.
+*/
+static void stats_interval(double now)
+{
+  source_t *s;
+  char when[32];
+
+  sprintf(when, "%.3f", now);
+  for (s = stats.t.first; s; s = s->list) {
+    if (s->c.packets == s->prior.packets) continue;
+    stats_line(stats.out, when, s, &s->prior);
+    s->prior = s->c;
+    s->prior.expected = stats_expected(s);
+  }
+  fflush(stats.out);
+} /* stats_interval */
+
+
+/*
+* Print an interval report if one is due at time 'now' (in seconds
+* since the start of recording).
+*/
+static void stats_tick(double now)
+{
+  if (!stats.interval) return;
+  if (stats.next < 0) stats.next = now + stats.interval;
+  if (now < stats.next) return;
+  stats_interval(now);
+  while (stats.next <= now) stats.next += stats.interval;
+} /* stats_tick */
+
+
+/*
+* Print the totals for all sources at exit.
+*/
+static void stats_summary(void)
+{
+  static stats_count_t zero;
+  source_t *s;
+
+  for (s = stats.t.first; s; s = s->list) {
+    stats_line(stats.out, "total", s, &zero);
+  }
+  fflush(stats.out);
+} /* stats_summary */
+
+
+/* capture filter (-e), also compiled for the kernel by filter_attach() */
+static filter_t filter;
+
+
+#if HAVE_SOCKFILTER
+/*
+* Set BPF instruction 'p'.
+*/
+static void bpf_insn(struct sock_filter *p, unsigned short code,
+  uint32_t k, unsigned char jt, unsigned char jf)
+{
+  p->code = code;
+  p->jt = jt;
+  p->jf = jf;
+  p->k = k;
+} /* bpf_insn */
+
+
+/*
+* Compile the filter for the data (ctrl=0) or control socket into a
+* classic BPF program and attach it, so that the kernel drops packets
+* that do not match before they are queued. The program sees the UDP
+* header at offset 0, so the RTP or RTCP packet starts at offset 8.
+* Loads beyond the end of a short packet reject it, as filter_match()
+* does. If attaching fails, filter_match() still does the work.
+* Return whether a program was attached.
+*/
+static int filter_attach(int sock, int ctrl)
+{
+  struct sock_filter insn[5 + 128 + FILTER_SSRC_MAX];
+  struct sock_fprog prog;
+  int n = 0, i;
+
+  if (!(filter.kinds & (1 << ctrl))) {
+    bpf_insn(&insn[n++], BPF_RET | BPF_K, 0, 0, 0);
+  }
+  else {
+    /* on a match, each test skips the remaining ones and the reject */
+    if (!ctrl && filter.npt) {
+      bpf_insn(&insn[n++], BPF_LD | BPF_B | BPF_ABS, 8+1, 0, 0);
+      bpf_insn(&insn[n++], BPF_ALU | BPF_AND | BPF_K, 0x7f, 0, 0);
+      for (i = 0; i < filter.npt; i++) {
+        bpf_insn(&insn[n++], BPF_JMP | BPF_JEQ | BPF_K, filter.pt[i],
+          filter.npt - i, 0);
+      }
+      bpf_insn(&insn[n++], BPF_RET | BPF_K, 0, 0, 0);
+    }
+    if (filter.nssrc) {
+      bpf_insn(&insn[n++], BPF_LD | BPF_W | BPF_ABS, ctrl ? 8+4 : 8+8, 0, 0);
+      for (i = 0; i < filter.nssrc; i++) {
+        bpf_insn(&insn[n++], BPF_JMP | BPF_JEQ | BPF_K, filter.ssrc[i],
+          filter.nssrc - i, 0);
+      }
+      bpf_insn(&insn[n++], BPF_RET | BPF_K, 0, 0, 0);
+    }
+    if (n == 0) return 0;  /* everything passes */
+    bpf_insn(&insn[n++], BPF_RET | BPF_K, 0xffffffff, 0, 0);
+  }
+  prog.len = n;
+  prog.filter = insn;
+  if (setsockopt(sock, SOL_SOCKET, SO_ATTACH_FILTER, &prog,
+        sizeof(prog)) < 0) {
+    perror("setsockopt: attach_filter");
+    return 0;
+  }
+  return 1;
+} /* filter_attach */
+#endif
+
+
+/*
+* Demultiplexing (-d): the packets of each SSRC go to a dump file of
+* their own, named after the SSRC; RTCP goes to the file of the sender
+* SSRC of its first report. At most DEMUX_OPEN files are open at a
+* time; when another one is needed, the least recently used one is
+* closed, and reopened for appending if that SSRC shows up again.
+*/
+#define DEMUX_BUCKETS 256  /* hash table size, a power of two */
+#define DEMUX_OPEN    64   /* maximum number of open files */
+
+typedef struct demux_file {
+  uint32_t ssrc;
+  FILE *fp;                           /* NULL if closed */
+  int created;                        /* file exists, with header */
+  RD_block_t *z;                      /* compressed output, if -z */
+  struct demux_file *next;            /* hash chain */
+  struct demux_file *newer, *older;   /* LRU list of open files */
+} demux_file_t;
+
+static struct {
+  const char *dir;                    /* NULL: no demultiplexing */
+  struct sockaddr_in sin;             /* address for file headers */
+  struct timeval start;               /* start time for file headers */
+  demux_file_t *table[DEMUX_BUCKETS];
+  demux_file_t *newest, *oldest;
+  int open;                           /* number of open files */
+} demux;
+
+
+/*
+* Remove open file 'd' from the LRU list.
+*/
+static void demux_unlink(demux_file_t *d)
+{
+  if (d->newer) d->newer->older = d->older;
+  else demux.newest = d->older;
+  if (d->older) d->older->newer = d->newer;
+  else demux.oldest = d->newer;
+  demux.open--;
+} /* demux_unlink */
+
+
+/*
+* Insert open file 'd' as the most recently used one.
+*/
+static void demux_push(demux_file_t *d)
+{
+  d->newer = NULL;
+  d->older = demux.newest;
+  if (demux.newest) demux.newest->newer = d;
+  else demux.oldest = d;
+  demux.newest = d;
+  demux.open++;
+} /* demux_push */
+
+
+/*
+* Return the output file for packet 'buf' of 'len' bytes (RTCP if
+* 'ctrl'), or NULL if it is too short to carry an SSRC.
+*/
+static demux_file_t *demux_file(int ctrl, const char *buf, int len)
+{
+  demux_file_t *d;
+  uint32_t ssrc;
+  unsigned h;
+  char path[1024];
+
+  if (len < (ctrl ? 8 : 12)) return NULL;
+  memcpy(&ssrc, buf + (ctrl ? 4 : 8), sizeof(ssrc));
+  ssrc = ntohl(ssrc);
+  h = (ssrc ^ (ssrc >> 16)) & (DEMUX_BUCKETS - 1);
+
+  for (d = demux.table[h]; d; d = d->next) {
+    if (d->ssrc == ssrc) break;
+  }
+  if (!d) {
+    if (!(d = (demux_file_t *)calloc(1, sizeof(demux_file_t)))) {
+      perror("can not create a new file entry");
+      exit(1);
+    }
+    d->ssrc = ssrc;
+    d->next = demux.table[h];
+    demux.table[h] = d;
+  }
+
+  /* most recently used file: nothing to do */
+  if (d == demux.newest) return d;
+  if (d->fp) {
+    demux_unlink(d);
+    demux_push(d);
+    return d;
+  }
+
+  if (demux.open == DEMUX_OPEN) {
+    demux_file_t *old = demux.oldest;
+
+    demux_unlink(old);
+    if ((old->z && RD_block_close(old->z) < 0) || fclose(old->fp) == EOF) {
+      perror("fclose");
+      exit(1);
+    }
+    old->fp = NULL;
+    old->z = NULL;
+  }
+  snprintf(path, sizeof(path), "%s/%08lx.rtp", demux.dir,
+    (unsigned long)ssrc);
+  if (!(d->fp = fopen(path, d->created ? "ab" : "wb"))) {
+    perror(path);
+    exit(1);
+  }
+  /* blocks are appended to a compressed file after its header */
+  if (compress)
+    d->z = block_open(d->fp, d->created ? NULL : &demux.sin, &demux.start);
+  else if (!d->created) rtpdump_header(d->fp, &demux.sin, &demux.start);
+  d->created = 1;
+  demux_push(d);
+  return d;
+} /* demux_file */
+
+
+/*
+* Write the last blocks of the compressed output files, at exit.
+*/
+static void block_close_all(void)
+{
+  demux_file_t *d;
+
+  if (zout && RD_block_close(zout) < 0) perror("fwrite");
+  zout = NULL;
+  for (d = demux.newest; d; d = d->older) {
+    if (d->z && RD_block_close(d->z) < 0) perror("fwrite");
+    d->z = NULL;
+  }
+} /* block_close_all */
+
+
+/*
+* Write record 'packet' of 'len' bytes, in network byte order, to 'out'
+* or, if 'z' is set, to compressed file 'z'.
+*/
+static void dump_write(FILE *out, RD_block_t *z, RD_buffer_t *packet,
+  int len)
+{
+  if (z ? RD_block_write(z, packet, len) < 0 :
+    fwrite((char *)packet, len, 1, out) == 0) {
+    perror("fwrite");
+    exit(1);
+  }
+} /* dump_write */
+
+
 /*
 * Process one packet and write it to file 'out' using format 'format'.
 */
@@ -530,33 +1193,38 @@ static void packet_handler(FILE *out, t_format format, int trunc,
   double dnow = tdbl(&now);
   int hlen;   /* header length */
   int offset;
+  RD_block_t *z = zout;
+
+  if (filter.on && !filter_match(&filter, ctrl, packet->p.data, len))
+    return;
+  if (demux.dir) {
+    demux_file_t *d = demux_file(ctrl, packet->p.data, len);
+
+    if (!d) return;
+    out = d->fp;
+    z = d->z;
+  }
 
   switch(format) {
     case F_header:
-      offset = (dnow - dstart) * 1000;
+      offset = (dnow - dstart) * 1000 + 0.5;  /* nearest ms */
       packet->p.hdr.offset = htonl(offset);
       packet->p.hdr.plen   = ctrl ? 0 : htons(len);
       /* leave only header */
       if (ctrl == 0) len = parse_header(packet->p.data);
       packet->p.hdr.length = htons(len + sizeof(packet->p.hdr));
-      if (fwrite((char *)&packet, len + sizeof(packet->p.hdr), 1, out) == 0) {
-        perror("fwrite");
-        exit(1);
-      }
+      dump_write(out, z, packet, len + sizeof(packet->p.hdr));
       break;
 
     case F_dump:
       hlen = ctrl ? len : parse_header(packet->p.data);
-      offset = (dnow - dstart) * 1000;
+      offset = (dnow - dstart) * 1000 + 0.5;  /* nearest ms */
       packet->p.hdr.offset = htonl(offset);
       packet->p.hdr.plen   = ctrl ? 0 : htons(len);
       /* truncation of payload */
       if (!ctrl && (len - hlen > trunc)) len = hlen + trunc;
       packet->p.hdr.length = htons(len + sizeof(packet->p.hdr));
-      if (fwrite((char *)packet, len + sizeof(packet->p.hdr), 1, out) == 0) {
-        perror("fwrite");
-        exit(1);
-      }
+      dump_write(out, z, packet, len + sizeof(packet->p.hdr));
       break;
 
     case F_payload:
@@ -569,39 +1237,158 @@ static void packet_handler(FILE *out, t_format format, int trunc,
       }
       break;
 
+    case F_pcap:
+      hlen = ctrl ? len : parse_header(packet->p.data);
+      pcap_packet(out, now, ctrl, &sin, packet->p.data, len,
+        !ctrl && len - hlen > trunc ? hlen + trunc : len);
+      break;
+
     case F_short:
-      if (ctrl == 0) parse_short(out, now, packet->p.data, len);
+      if (ctrl == 0) {
+        ob.out = out;
+        parse_short(&ob, now, packet->p.data, len);
+        ob_flush(&ob);
+      }
       break;
 
     case F_hex:
     case F_ascii:
+      ob.out = out;
       if (ctrl == 0) {
-        fprintf(out, "%ld.%06ld %s len=%d from=%s:%u ",
-                now.tv_sec, (long)now.tv_usec, parse_type(ctrl, packet->p.data),
-                len, inet_ntoa(sin.sin_addr), ntohs(sin.sin_port));
-        parse_data(out, packet->p.data, len);
+        parse_prefix(&ob, now, parse_type(ctrl, packet->p.data), len, &sin);
+        parse_data(&ob, packet->p.data, len);
         if (format == F_hex) {
           hlen = parse_header(packet->p.data);
-          fprintf(out, "data=");
-          hex(out, packet->p.data + hlen, trunc < len ? trunc : len - hlen);
+          ob_str(&ob, "data=");
+          hex(&ob, packet->p.data + hlen, trunc < len ? trunc : len - hlen);
         }
-        fprintf(out, "\n");
+        ob_str(&ob, "\n");
+        ob_flush(&ob);
       }
     case F_rtcp:
       if (ctrl == 1) {
-        fprintf(out, "%ld.%06ld %s len=%d from=%s:%u ",
-                now.tv_sec, (long)now.tv_usec, parse_type(ctrl, packet->p.data),
-                len, inet_ntoa(sin.sin_addr), ntohs(sin.sin_port));
-        parse_control(out, packet->p.data, len);
+        ob.out = out;
+        parse_prefix(&ob, now, parse_type(ctrl, packet->p.data), len, &sin);
+        parse_control(&ob, packet->p.data, len);
+        ob_flush(&ob);
       }
       break;
 
+    case F_stats:
+      if (ctrl == 0 && len >= 12 &&
+          ((rtp_hdr_t *)packet->p.data)->version == RTP_VERSION) {
+        stats_packet(&stats.t, (rtp_hdr_t *)packet->p.data,
+          packet->p.hdr.plen, dnow - dstart);
+      }
+      stats_tick(dnow - dstart);
+      break;
+
     case F_invalid:
       break;
   }
 } /* packet_handler */
 
 
+/* what to do with packets received from the network */
+static struct {
+  FILE *out;
+  t_format format;
+  int trunc;
+  double dstart;
+  double period;                  /* seconds between reports */
+  int report;                     /* print capture report each period */
+  int sock[2];
+  int rcvbuf[2];                  /* socket buffer size in effect */
+  int filtered[2];                /* kernel filter attached, see -e */
+  unsigned long packets[2], bytes[2];
+} capture;
+
+/*
+* Receive handler: process a packet arriving on socket 'client' (0: data,
+* 1: control).
+*/
+static Notify_value capture_handler(Notify_client client, int fd,
+  char *buf, int len, struct sockaddr_in *from)
+{
+  RD_buffer_t packet;
+  struct timeval now;
+
+  gettimeofday(&now, 0);
+  capture.packets[client]++;
+  capture.bytes[client] += len;
+  if (len > (int)sizeof(packet.p.data)) len = sizeof(packet.p.data);
+  memcpy(packet.p.data, buf, len);
+  packet.p.hdr.plen = client ? 0 : len;  /* as from RD_read() */
+  packet_handler(capture.out, capture.format, capture.trunc,
+    capture.dstart, now, (int)client, *from, len, &packet);
+  return NOTIFY_DONE;
+} /* capture_handler */
+
+
+/*
+* Timer handler: end of recording time reached.
+*/
+static Notify_value time_limit(Notify_client client)
+{
+  if (verbose)
+    fprintf(stderr, "Time limit reached.\n");
+  exit(0);
+  return NOTIFY_DONE;
+} /* time_limit */
+
+
+/*
+* Print, for each socket, the packets and bytes received and the
+* packets the kernel dropped since the start, at time 'when'. The
+* kernel counts packets rejected by an attached filter as drops, so
+* then the figure is labelled as both.
+*/
+static void capture_report(const char *when)
+{
+  static const char *name[2] = {"data", "control"};
+  int i;
+
+  for (i = 0; i < 2; i++) {
+    if (capture.sock[i] < 0) continue;
+    fprintf(stderr, "%s %s packets=%lu bytes=%lu %s=%lu rcvbuf=%d\n",
+      when, name[i], capture.packets[i], capture.bytes[i],
+      capture.filtered[i] ? "drops+filtered" : "drops",
+      notify_recv_drops(capture.sock[i]), capture.rcvbuf[i]);
+  }
+} /* capture_report */
+
+
+/*
+* Print the capture report at exit.
+*/
+static void capture_total(void)
+{
+  capture_report("total");
+} /* capture_total */
+
+
+/*
+* Timer handler: print the capture report and the statistics of the
+* last interval, also if no packets arrived.
+*/
+static Notify_value interval_timer(Notify_client client)
+{
+  struct timeval now, next;
+  char when[32];
+
+  gettimeofday(&now, 0);
+  if (capture.format == F_stats) stats_tick(tdbl(&now) - capture.dstart);
+  if (capture.report) {
+    sprintf(when, "%.3f", tdbl(&now) - capture.dstart);
+    capture_report(when);
+  }
+  next.tv_sec  = capture.period;
+  next.tv_usec = (capture.period - next.tv_sec) * 1000000;
+  timer_set(&next, interval_timer, client, 1);
+  return NOTIFY_DONE;
+} /* interval_timer */
+
+
 int main(int argc, char *argv[])
 {
   int c;
@@ -615,7 +1402,9 @@ int main(int argc, char *argv[])
     {"rtcp",    F_rtcp},
     {"short",   F_short},
     {"payload", F_payload},
+    {"pcap",    F_pcap},
     {"ascii",   F_ascii},
+    {"stats",   F_stats},
     {0,0}
   };
   t_format format = F_ascii;
@@ -625,19 +1414,21 @@ int main(int argc, char *argv[])
   double dstart;            /* time as double */
   float duration = 1000000; /* maximum duration in seconds */
   int trunc    = 1000000;   /* bytes to show for F_hex and F_dump */
+  double interval = -1;     /* seconds between reports, -1: default */
+  int rcvbuf = 0;           /* socket receive buffer size */
+  int uring = 0;            /* receive through io_uring */
   enum {FromFile, FromNetwork} source;
   int sock[2];
   FILE *in = stdin;         /* input file to use instead of sockets */
   FILE *out = stdout;       /* output file */
-  fd_set readfds;
   extern char *optarg;
   extern int optind;
   int i;
-  int nfds = 0;
   extern double tdbl(struct timeval *);
 
   startupSocket();
-  while ((c = getopt(argc, argv, "F:f:o:t:x:h")) != EOF) {
+  ob_init();
+  while ((c = getopt(argc, argv, "b:d:e:F:f:i:o:p:t:Ux:zh")) != EOF) {
     switch(c) {
     /* output format */
     case 'F':
@@ -654,6 +1445,28 @@ int main(int argc, char *argv[])
       }
       break;
 
+    /* socket receive buffer size */
+    case 'b':
+      rcvbuf = atoi(optarg);
+      if (rcvbuf <= 0) {
+        usage(argv[0]);
+        exit(1);
+      }
+      break;
+
+    /* directory for one dump file per SSRC */
+    case 'd':
+      demux.dir = optarg;
+      break;
+
+    /* capture filter */
+    case 'e':
+      if (filter_parse(&filter, optarg)) {
+        usage(argv[0]);
+        exit(1);
+      }
+      break;
+
     /* input file (instead of network connection) */
     case 'f':
       if (!(in = fopen(optarg, "rb"))) {
@@ -662,6 +1475,15 @@ int main(int argc, char *argv[])
       }
       break;
 
+    /* interval between statistics and capture reports */
+    case 'i':
+      interval = atof(optarg);
+      if (interval < 0) {
+        usage(argv[0]);
+        exit(1);
+      }
+      break;
+
     /* output file */
     case 'o':
       if (!(out = fopen(optarg, "wb"))) {
@@ -670,11 +1492,21 @@ int main(int argc, char *argv[])
       }
       break;
 
+    /* port to read from pcap input */
+    case 'p':
+      RD_pcap_port(atoi(optarg));
+      break;
+
     /* recording duration in minutes or fractions thereof */
     case 't':
       duration = atof(optarg) * 60;
       break;
 
+    /* receive through io_uring */
+    case 'U':
+      uring = 1;
+      break;
+
     /* bytes to show for F_hex or F_dump */
     case 'x':
       if (0 == (trunc = atoi(optarg))) {
@@ -684,6 +1516,11 @@ int main(int argc, char *argv[])
       }
       break;
 
+    /* compressed dump files */
+    case 'z':
+      compress = 1;
+      break;
+
     case '?':
     case 'h':
       usage(argv[0]);
@@ -692,10 +1529,19 @@ int main(int argc, char *argv[])
     }
   }
 
+  if (demux.dir && format != F_dump && format != F_header) {
+    warnx("-d requires -F dump or -F header");
+    exit(1);
+  }
+  if (compress && format != F_dump && format != F_header) {
+    warnx("-z requires -F dump or -F header");
+    exit(1);
+  }
+
 #if defined(WIN32)
   /* On Windows, make sure stdout and stdin use the binary format
-   * if using F_dump or F_header. */
-  if (format == F_dump || format == F_header) {
+   * if using F_dump, F_header or F_pcap. */
+  if (format == F_dump || format == F_header || format == F_pcap) {
     if (out == stdout) {
       setmode(fileno(stdout), O_BINARY);
     }
@@ -716,6 +1562,7 @@ int main(int argc, char *argv[])
     sock[1] = -1;          /* not used */
     memset(&sin, 0, sizeof(struct sockaddr_in));
     RD_header(in, &sin, &start, 0);
+    rtp = sin;
     dstart = 0.;
   }
   else {
@@ -725,70 +1572,91 @@ int main(int argc, char *argv[])
       exit(1);
     }
     rtp = sin;
-    nfds = open_network(argv[optind], format != F_rtcp, sock, &sin);
+    open_network(argv[optind], format != F_rtcp, sock, &sin, rcvbuf);
     gettimeofday(&start, 0);
     dstart = tdbl(&start);
   }
 
-  /* write header for dump file */
-  if (format == F_dump || format == F_header)
-    rtpdump_header(out, &rtp, &start);
+  /* write header for dump file, or those of the files per SSRC */
+  if (demux.dir) {
+    demux.sin   = rtp;
+    demux.start = start;
+  }
+  else if (format == F_dump || format == F_header) {
+    if (compress) zout = block_open(out, &rtp, &start);
+    else rtpdump_header(out, &rtp, &start);
+  }
+  else if (format == F_pcap) {
+    pcap_out.dst = rtp;
+    if (source == FromFile) pcap_out.base = start;
+    pcap_header(out);
+  }
+
+  if (format == F_stats) {
+    stats.out  = out;
+    stats_init(&stats.t);
+    stats.interval = interval < 0 ? 10 : interval;
+    stats.next = -1;  /* one interval after the first packet */
+    atexit(stats_summary);
+  }
+  if (compress) atexit(block_close_all);
 
   /* signal handler */
   signal(SIGINT, done);
   signal(SIGTERM, done);
   signal(SIGHUP, done);
 
+  /* network: the notifier calls capture_handler() for each packet */
+  if (source == FromNetwork) {
+    if (uring && !notify_uring())
+      fprintf(stderr, "%s: io_uring not available\n", argv[0]);
+    capture.out    = out;
+    capture.format = format;
+    capture.trunc  = trunc;
+    capture.dstart = dstart;
+    capture.report = interval > 0;
+    capture.period = format == F_stats ? stats.interval : interval;
+    for (i = 0; i < 2; i++) {
+      socklen_t len = sizeof(capture.rcvbuf[i]);
+
+      capture.sock[i] = sock[i];
+      if (sock[i] < 0) continue;
+#if HAVE_SOCKFILTER
+      if (filter.on) capture.filtered[i] = filter_attach(sock[i], i);
+#endif
+      notify_set_recv_func((Notify_client)i, capture_handler, sock[i]);
+      if (getsockopt(sock[i], SOL_SOCKET, SO_RCVBUF,
+            (char *)&capture.rcvbuf[i], &len) < 0)
+        perror("getsockopt: rcvbuf");
+    }
+    if (rcvbuf > 0 || interval > 0) atexit(capture_total);
+    timer_set(&timeout, time_limit, 0, 1);
+    if (capture.period > 0) {
+      struct timeval next;
+
+      next.tv_sec  = capture.period;
+      next.tv_usec = (capture.period - next.tv_sec) * 1000000;
+      timer_set(&next, interval_timer, 1, 1);
+    }
+    if (notify_start() != NOTIFY_OK) exit(1);
+    return 0;
+  }
+
   /* main loop */
   while (1) {
     int len;
     RD_buffer_t packet;
     struct timeval now;
-    double dnow;
-
-    if (source == FromNetwork) {
-      FD_ZERO(&readfds);
-      if (sock[0] >= 0) FD_SET(sock[0], &readfds);
-      if (sock[1] >= 0) FD_SET(sock[1], &readfds);
-      c = select(nfds+1, &readfds, 0, 0, &timeout);
-      if (c < 0) {
-        perror("select");
-        exit(1);
-      }
-      /* end of recording time reached */
-      else if (c == 0) {
-        if (verbose)
-          fprintf(stderr, "Time limit reached.\n");
-        exit(0);
-      }
-      for (i = 0; i < 2; i++) {
-        if (sock[i] >= 0 && FD_ISSET(sock[i], &readfds)) {
-          socklen_t alen = sizeof(sin);
-
-          /* subtract elapsed time from remaining timeout */
-          gettimeofday(&now, 0);
-          dnow = tdbl(&now);
-          timeout.tv_sec = duration - (dnow - dstart);
-          if (timeout.tv_sec < 0) timeout.tv_sec = 0;
-
-          len = recvfrom(sock[i], packet.p.data, sizeof(packet.p.data),
-            0, (struct sockaddr *)&sin, &alen);
-          packet_handler(out, format, trunc, dstart, now, i, sin, len, &packet);
-        }
-      }
-    }
-    else {
-      len = RD_read(in, &packet);
-      if (len == 0) exit(0);
-      now.tv_sec = packet.p.hdr.offset / 1000.;
-      now.tv_usec = (packet.p.hdr.offset % 1000) * 1000;
-      dnow = tdbl(&now);
-      /* plen>0: data =0: control */
-      i = (packet.p.hdr.plen == 0);
-      /* arbitrary, obviously invalid value */
-      sin.sin_addr.s_addr = INADDR_ANY; sin.sin_port = 0;
-      packet_handler(out, format, trunc, dstart, now, i, sin, len, &packet);
-    }
+
+    len = RD_read(in, &packet);
+    if (len == 0) exit(0);
+    now.tv_sec = packet.p.hdr.offset / 1000.;
+    now.tv_usec = (packet.p.hdr.offset % 1000) * 1000;
+    /* plen>0: data =0: control */
+    i = (packet.p.hdr.plen == 0);
+    /* arbitrary, obviously invalid value */
+    sin.sin_addr.s_addr = INADDR_ANY; sin.sin_port = 0;
+    packet_handler(out, format, trunc, dstart, now, i, sin, len, &packet);
   }
   return 0;
 } /* main */
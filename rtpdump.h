@@ -42,6 +42,13 @@
 * based on SSRC.  This saves (a little) space, avoids non-IPv4
 * problems and privacy/security concerns. The header is followed by
 * the RTP/RTCP header and (optionally) the actual payload.
+*
+* A compressed file (rtpdump -z) starts with "#!rtpplay2.0" and the same
+* header, followed by blocks instead of records. Each block is an
+* RD_block_hdr_t and the records of up to RD_BLOCK_SIZE bytes, as they
+* would be in an uncompressed file, compressed as described in lz.h or,
+* if that does not make them smaller, stored as they are. A reader can
+* skip a block by its header, without decompressing it.
 */
 #include <stdint.h>
 #include "sysdep.h"
@@ -63,6 +70,18 @@ typedef struct {
   uint32_t offset;   /* milliseconds since the start of recording */
 } RD_packet_t;
 
+#define RD_BLOCK_SIZE 65536  /* most bytes of records in a block */
+
+typedef struct {
+  uint32_t clen;     /* length of the block data following this header */
+  uint32_t ulen;     /* length of the records; clen = ulen if stored */
+  uint32_t first;    /* earliest offset of the records (ms) */
+  uint32_t last;     /* latest offset of the records (ms) */
+  uint32_t count;    /* number of records */
+} RD_block_hdr_t;
+
+typedef struct RD_block RD_block_t;
+
 typedef union {
   struct {
     RD_packet_t hdr;
@@ -72,4 +91,15 @@ typedef union {
 } RD_buffer_t;
 
 extern int RD_header(FILE *in, struct sockaddr_in *sin, struct timeval *start, int verbose);
+extern int RD_header_line(FILE *in, const char *line, struct sockaddr_in *sin, struct timeval *start, int verbose);
 extern int RD_read(FILE *in, RD_buffer_t *b);
+extern int RD_skip(FILE *in, uint32_t offset);
+extern int RD_last(FILE *in, uint32_t *last);
+extern int RD_rewind(FILE *in);
+extern void RD_close(FILE *in);
+extern int RD_write_header(FILE *out, struct sockaddr_in *sin, struct timeval *start);
+extern int RD_write(FILE *out, RD_buffer_t *b);
+extern RD_block_t *RD_block_open(FILE *out, struct sockaddr_in *sin, struct timeval *start);
+extern int RD_block_write(RD_block_t *z, const void *rec, int len);
+extern int RD_block_close(RD_block_t *z);
+extern void RD_pcap_port(int port);
@@ -0,0 +1,200 @@
+/*
+ * (c) 1998-2018 by Columbia University; all rights reserved
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+* Merge rtpdump files, such as those written by multidump, into one
+* file with the packets of all of them in time order. Each input is
+* read one packet at a time; the next packet of each is kept in a
+* binary heap ordered by its absolute time, so the memory needed does
+* not depend on the size of the files and a packet costs O(log files).
+*/
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+#ifndef WIN32
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <err.h>
+#else
+#include <fcntl.h>       /* O_BINARY */
+#endif
+
+#include "sysdep.h"
+#include "rtpdump.h"
+
+typedef struct {
+  FILE *in;
+  char *name;
+  int64_t start;       /* start of recording relative to the earliest (us) */
+  int64_t time;        /* time of the packet in 'b' (us) */
+  RD_buffer_t b;       /* next packet */
+} cursor_t;
+
+static cursor_t *cursor;
+static cursor_t **heap;  /* inputs with a packet, earliest first */
+static int n;            /* inputs in 'heap' */
+
+
+static void usage(char *argv0)
+{
+  fprintf(stderr, "usage: %s [-o outfile] file ...\n", argv0);
+  exit(1);
+} /* usage */
+
+
+/*
+* Read the next packet of 'c'. Return 0 at the end of the file.
+*/
+static int advance(cursor_t *c)
+{
+  if (RD_read(c->in, &c->b) <= 0) {
+    if (ferror(c->in)) err(1, "%s", c->name);
+    return 0;
+  }
+  c->time = c->start + (int64_t)c->b.p.hdr.offset * 1000;
+  return 1;
+} /* advance */
+
+
+/*
+* Whether 'a' goes before 'b'; packets at the same time are taken from
+* the inputs in the order given.
+*/
+static int before(cursor_t *a, cursor_t *b)
+{
+  return a->time < b->time || (a->time == b->time && a < b);
+} /* before */
+
+
+/*
+* Restore the heap order after the time of the input at 'i' was
+* increased.
+*/
+static void sift(int i)
+{
+  cursor_t *c = heap[i];
+  int k;
+
+  while ((k = 2 * i + 1) < n) {
+    if (k + 1 < n && before(heap[k + 1], heap[k])) k++;
+    if (!before(heap[k], c)) break;
+    heap[i] = heap[k];
+    i = k;
+  }
+  heap[i] = c;
+} /* sift */
+
+
+int main(int argc, char *argv[])
+{
+  FILE *out = stdout;
+  struct sockaddr_in sin;
+  struct timeval first;    /* earliest start of recording */
+  struct timeval *start;
+  int files, i, c;
+  extern char *optarg;
+  extern int optind;
+
+  while ((c = getopt(argc, argv, "o:h")) != EOF) {
+    switch (c) {
+    case 'o':
+      if (!(out = fopen(optarg, "wb"))) {
+        perror(optarg);
+        exit(1);
+      }
+      break;
+    case '?':
+    case 'h':
+      usage(argv[0]);
+      break;
+    }
+  }
+  files = argc - optind;
+  if (files < 1) usage(argv[0]);
+
+#if defined(WIN32)
+  if (out == stdout) setmode(fileno(stdout), O_BINARY);
+#endif
+
+  cursor = calloc(files, sizeof(cursor_t));
+  heap   = calloc(files, sizeof(cursor_t *));
+  start  = calloc(files, sizeof(struct timeval));
+  if (!cursor || !heap || !start) err(1, "can not merge %d files", files);
+
+  /*
+  * Inputs may be rtpdump files, compressed or not, and pcap captures.
+  * The output has the address of the first one.
+  */
+  memset(&sin, 0, sizeof(sin));
+  for (i = 0; i < files; i++) {
+    cursor_t *k = &cursor[i];
+
+    k->name = argv[optind + i];
+    if (!(k->in = fopen(k->name, "rb"))) err(1, "%s", k->name);
+    if (RD_header(k->in, &sin, &start[i], 0) < 0)
+      errx(1, "%s: not an rtpdump file or capture", k->name);
+    if (i == 0 || timercmp(&start[i], &first, <)) first = start[i];
+  }
+
+  for (i = 0; i < files; i++) {
+    cursor_t *k = &cursor[i];
+    struct timeval d;
+
+    timersub(&start[i], &first, &d);
+    k->start = (int64_t)d.tv_sec * 1000000 + d.tv_usec;
+    if (advance(k)) heap[n++] = k;
+  }
+  free(start);
+  for (i = n / 2 - 1; i >= 0; i--) sift(i);
+
+  if (RD_write_header(out, &sin, &first) < 0) err(1, "write");
+  while (n > 0) {
+    cursor_t *k = heap[0];
+
+    k->b.p.hdr.offset = (k->time + 500) / 1000;
+    if (RD_write(out, &k->b) < 0) err(1, "write");
+    if (!advance(k)) {
+      RD_close(k->in);
+      fclose(k->in);
+      heap[0] = heap[--n];
+    }
+    if (n > 0) sift(0);
+  }
+  if (fclose(out) == EOF) err(1, "write");
+  return 0;
+} /* main */
@@ -35,6 +35,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <time.h>
+#include <errno.h>
 
 #ifndef WIN32
 #include <unistd.h>
@@ -104,7 +105,7 @@ insert(struct ssrc* ssrc)
 static void usage(char *argv0)
 {
   fprintf(stderr, "usage: %s "
-	"[-hTv] [-b begin] [-e end] [-f file] [-s port] "
+	"[-GhTUv] [-b begin] [-e end] [-f file] [-S seconds] [-s port] "
 	"address/port[/ttl]\n", argv0);
   exit(1);
 } /* usage */
@@ -116,14 +117,25 @@ static double tdbl(struct timeval *a)
 } /* tdbl */
 
 
+/*
+* Report a send that failed after notify_send() had queued it.
+*/
+static void play_failed(Notify_client client, int error)
+{
+  errno = error;
+  perror("write");
+} /* play_failed */
+
+
 /*
 * Transmit RTP/RTCP packet on output socket and mark as read.
 */
 static void play_transmit(int b)
 {
   if (b >= 0 && buffer[b].p.hdr.length) {
-    if (send(sock[buffer[b].p.hdr.plen == 0],
-        buffer[b].p.data, buffer[b].p.hdr.length, 0) < 0) {
+    if (notify_send(sock[buffer[b].p.hdr.plen == 0],
+        buffer[b].p.data, buffer[b].p.hdr.length, NULL,
+        play_failed, 0) < 0) {
       perror("write");
     }
 
@@ -273,6 +285,9 @@ int main(int argc, char *argv[])
   static struct sockaddr_in from;
   struct timeval start;
   int sourceport = 0;  /* source port */
+  int stats = -1;      /* seconds between loop statistics */
+  int gso = 0;         /* coalesce packets with UDP GSO */
+  int uring = 0;       /* send through io_uring */
   int on = 1;          /* flag */
   int i;
   int c;
@@ -285,7 +300,7 @@ int main(int argc, char *argv[])
   in = stdin; /* Changed below if -f specified */
 
   /* parse command line arguments */
-  while ((c = getopt(argc, argv, "b:e:f:p:Ts:vzh")) != EOF) {
+  while ((c = getopt(argc, argv, "b:e:f:Gp:S:Ts:Uvzh")) != EOF) {
     switch(c) {
     case 'b':
       begin = atof(optarg) * 1000;
@@ -299,12 +314,21 @@ int main(int argc, char *argv[])
         exit(1);
       }
       break;
+    case 'G':
+      gso = 1;
+      break;
+    case 'S':
+      stats = atoi(optarg);
+      break;
     case 'T':
       wallclock = 1;
       break;
     case 's':  /* locked source port */
       sourceport = atoi(optarg);
       break;
+    case 'U':
+      uring = 1;
+      break;
     case 'v':
       verbose = 1;
       break;
@@ -344,25 +368,13 @@ int main(int argc, char *argv[])
     exit(1);
   }
 
-  /* find last offset */
-  fpos_t oldPos;
-  if (fgetpos(in, &oldPos) != 0) {
-      fprintf(stderr, "Failed to save file pos\n");
-      exit(1);
-  }
-  RD_buffer_t lastBuffer;
-  // printf("\n-------\n");
-  do {
-      if (RD_read(in, &lastBuffer) == 0) break;
-      if (lastBuffer.p.hdr.offset > last)
-        last = lastBuffer.p.hdr.offset;
-      // printf(" %d ", last);
-  } while ( 1 );
-  // printf("\n-------\n");
-  if (fsetpos(in, &oldPos) != 0) {
+  /* find last offset; compressed files only by their block headers */
+  if (RD_last(in, &last) != 0) {
       fprintf(stderr, "Failed to restore file pos\n");
       exit(1);
   }
+  /* skip to the begin time, without decompressing blocks before it */
+  if (begin > 0) RD_skip(in, begin);
 
   /* create/connect sockets if they don't exist already */
   if (!sock[0]) {
@@ -414,8 +426,14 @@ int main(int argc, char *argv[])
 
   /* initialize event queue */
   first = -1;
+  if (gso && !notify_send_gso(1))
+    fprintf(stderr, "%s: UDP GSO not available\n", argv[0]);
+  if (uring && !notify_uring())
+    fprintf(stderr, "%s: io_uring not available\n", argv[0]);
   for (i = 0; i < READAHEAD; i++) play_handler(-1);
+  if (stats >= 0) notify_stats(stats);
   notify_start();
+  notify_stats_report();
 
   return 0;
 } /* main */
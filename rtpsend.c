@@ -33,7 +33,9 @@
 #include <string.h>
 #include <stdio.h>
 #include <ctype.h>
+#include <signal.h>
 #include <time.h>
+#include <errno.h>
 
 #ifndef WIN32
 #include <unistd.h>
@@ -42,10 +44,13 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #endif
 
 #include "notify.h"
 #include "rtp.h"
+#include "rtpdump.h"
 #include "multimer.h"
 #include "sysdep.h"
 
@@ -55,24 +60,16 @@ static int verbose = 0;
 static FILE *in;
 static int sock[2];  /* output sockets */
 static int loop = 0; /* play file indefinitely if set */
-
-
-/*
-* Node either has a parameter or a non-zero pointer to list.
-*/
-typedef struct node {
-  struct node *next, *list;  /* parameter in list, level down */
-  char *type;    /* parameter type */
-  unsigned long num;       /* numeric value */
-  char *string;  /* string value */
-} node_t;
+static int sr_now;   /* SR generated without an NTP time */
 
 
 static void usage(char *argv0)
 {
   fprintf(stderr,
-    "usage: %s [-alv] [-f file] [-s port] address/port[/ttl]\n",
-    argv0);
+    "usage: %s [-GalUv] [-f file | -g spec] [-S seconds] [-s port] "
+    "address/port[/ttl]\n"
+    "       %s -c [-f file | -g spec] [address/port]\n",
+    argv0, argv0);
   exit(1);
 } /* usage */
 
@@ -104,91 +101,178 @@ static int hex(char *text, char *buffer)
 
 
 /*
-* Convert textual description into parse tree.
-* (SDES (ssrc=<ssrc> cname=<cname> ...) (ssrc=<ssrc> ...))
-* Return pointer to first node.
+* Scanner for the textual description of RTCP packets,
+* (SDES (src=<ssrc> cname="<cname>" ...) (src=<ssrc> ...)),
+* that the packets are written from as they are read, in one pass.
+* Words are not copied: 'name' and 'value' point into the text.
+*/
+typedef struct {
+  char *s;       /* next character */
+  char *name;    /* parameter of the last word */
+  int nlen;
+  char *value;   /* value after '=', or NULL */
+  int vlen;
+} rtcp_scan_t;
+
+enum {RTCP_END, RTCP_OPEN, RTCP_CLOSE, RTCP_WORD};
+
+/*
+* Return the next token: a parenthesis, a parameter[=value] word, whose
+* value may be a quoted string, or the end of the text.
 */
-static node_t *parse(char *text)
+static int rtcp_scan(rtcp_scan_t *t)
 {
-  int string = 0;
-  int level = 0;
-  char tmp[1024];
-  int c = 0;
-  node_t *n;
-  node_t *first = (node_t *)NULL, *last = (node_t *)NULL;
-  char *s;
+  char *s = t->s;
 
-  /* convert to tree */
-  for (s = text; *s; s++) {
-    if (string) {
-      tmp[c++] = *s;
-      if (*s == '"') string = 0;
-    }
-    else if (*s == '(') {
-      if (level > 0) tmp[c++] = *s;
-      else c = 0;
-      level++;
-    }
-    else if (*s == ')') {
-      level--;
-      if (level == 0) {
-        n = calloc(1, sizeof(node_t));
-        /* append node to list */
-        if (!first) first = n;
-        if (last) last->next = n;
-        last = n;
-        tmp[c] = 0;
-        c = 0;
-        /* attach list */
-        n->list = parse(tmp);
-      }
-      else {
-        tmp[c++] = *s;
-      }
+  while (isspace((int)*s)) s++;
+  if (*s == '\0') {
+    t->s = s;
+    return RTCP_END;
+  }
+  if (*s == '(' || *s == ')') {
+    t->s = s + 1;
+    return *s == '(' ? RTCP_OPEN : RTCP_CLOSE;
+  }
+
+  t->name  = s;
+  t->value = NULL;
+  for (; *s && !isspace((int)*s) && *s != '(' && *s != ')'; s++) {
+    if (*s == '=' && !t->value) {
+      t->nlen  = s - t->name;
+      t->value = s + 1;
     }
     else if (*s == '"') {
-      tmp[c++] = *s;
-      string = 1;
-    }
-    else if (level >= 1) {
-      tmp[c++] = *s;
-    }
-    /* end of parameter/value pair */
-    else if (isspace((int)*s)) {
-      char *e;
-
-      tmp[c] = '\0';
-      if (c > 0) {
-        c = 0;
-        n = calloc(1, sizeof(node_t));
-        if (!first) first = n;
-        if (last) last->next = n;
-        last = n;
-        e = strchr(tmp, '=');
-        if (e) {
-          char *v = e+1;
-
-          *e = '\0';
-          if (isdigit((int)*v)) n->num = (unsigned long)strtoul(v, (char **)NULL, 0);
-          else {
-            n->string = malloc(strlen(v+1) + 1);
-            /* strip quotation marks */
-            v[strlen(v)-1] = '\0';
-            strcpy(n->string, v+1);
-          }
-        }
-        n->type = malloc(strlen(tmp) + 1);
-        strcpy(n->type, tmp);
-      }
-    }
-    /* parameters, separated by white space */
-    else {
-      tmp[c++] = *s;
+      while (*++s && *s != '"') ;
+      if (*s == '\0') break;
     }
   }
+  if (t->value) t->vlen = s - t->value;
+  else t->nlen = s - t->name;
+  t->s = s;
+  return RTCP_WORD;
+} /* rtcp_scan */
+
+
+/*
+* Return the next token within a parenthesized list.
+*/
+static int rtcp_next(rtcp_scan_t *t)
+{
+  int tok = rtcp_scan(t);
+
+  if (tok == RTCP_END) {
+    fprintf(stderr, "Missing ) in RTCP packet\n");
+    exit(2);
+  }
+  return tok;
+} /* rtcp_next */
+
+
+/*
+* Is the parameter of the last word 'name'?
+*/
+static int rtcp_is(rtcp_scan_t *t, const char *name)
+{
+  return strncmp(t->name, name, t->nlen) == 0 && name[t->nlen] == '\0';
+} /* rtcp_is */
+
+
+/*
+* Numeric value of the last word, 0 if none.
+*/
+static unsigned long rtcp_num(rtcp_scan_t *t)
+{
+  if (t->value && isdigit((int)*t->value))
+    return strtoul(t->value, (char **)NULL, 0);
+  return 0;
+} /* rtcp_num */
+
+
+/*
+* String value of the last word, without quotation marks; its length
+* is returned in 'len'.
+*/
+static char *rtcp_string(rtcp_scan_t *t, int *len)
+{
+  char *s = t->value, *e;
+
+  *len = 0;
+  if (!s) return s;
+  if (*s == '"') {
+    s++;
+    e = memchr(s, '"', t->vlen - 1);
+    *len = e ? e - s : t->vlen - 1;
+  }
+  else *len = t->vlen;
+  return s;
+} /* rtcp_string */
+
+
+static void rtcp_invalid(rtcp_scan_t *t, const char *what)
+{
+  fprintf(stderr, "Invalid RTCP %stype %.*s\n", what, t->nlen, t->name);
+  exit(2);
+} /* rtcp_invalid */
+
+
+/*
+* Check that 'len' bytes at 'packet' are before 'end'.
+*/
+static void rtcp_room(char *packet, int len, char *end)
+{
+  if (len > end - packet) {
+    fprintf(stderr, "RTCP packet too long\n");
+    exit(2);
+  }
+} /* rtcp_room */
+
+
+/*
+* Clear the fixed part of 'len' bytes of the packet and set the defaults
+* of the common header.
+*/
+static void rtcp_header(rtcp_t *r, int pt, int len)
+{
+  memset(r, 0, len);
+  r->common.version = RTP_VERSION;
+  r->common.pt      = pt;
+} /* rtcp_header */
+
 
-  return first;
-} /* parse */
+/*
+* Set common header fields given as parameters. Return 0 if the last
+* word is not one of them.
+*/
+static int rtcp_common(rtcp_scan_t *t, rtcp_t *r)
+{
+  if (rtcp_is(t, "p"))
+    r->common.p = rtcp_num(t);
+  else if (rtcp_is(t, "count"))
+    r->common.count = rtcp_num(t);
+  else if (rtcp_is(t, "len"))
+    r->common.length = htons(rtcp_num(t));
+  else
+    return 0;
+  return 1;
+} /* rtcp_common */
+
+
+/*
+* If no length or count given, fill in. The 5-bit count field holds at
+* most 31 chunks or report blocks.
+*/
+static void rtcp_fill(rtcp_t *r, int total, int count)
+{
+  if (count > 31) {
+    fprintf(stderr, "RTCP packet has more than 31 items\n");
+    exit(2);
+  }
+  if (r->common.length == 0) {
+    r->common.length = htons((total - 4) / 4);
+  }
+  if (r->common.count == 0)
+    r->common.count = count;
+} /* rtcp_fill */
 
 
 /*
@@ -211,31 +295,7 @@ static uint32_t parse_uint(char *word)
 } /* parse_int */
 
 
-/*
-* Free nodes recursively.
-*/
-static void node_free(node_t *list)
-{
-  node_t *n, *n_next;
-
-  for (n = list; n; n = n_next) {
-    if (n->type) {
-      free(n->type);
-      n->type = 0;
-    }
-    if (n->string) {
-      free(n->string);
-      n->string = 0;
-    }
-    n->num = 0;
-    if (n->list) node_free(n->list);
-    n_next = n->next;
-    free(n);
-  }
-} /* node_free */
-
-
-static int rtcp_sdes_item(char *type, char *string, char *packet)
+static int rtcp_sdes_item(rtcp_scan_t *t, char *packet, char *end)
 {
   struct {
     const char *name;
@@ -252,16 +312,24 @@ static int rtcp_sdes_item(char *type, char *string, char *packet)
     {"priv",  RTCP_SDES_PRIV},
     {0,0}
   };
-  int i;
+  int i, len;
+  char *string;
   rtcp_sdes_item_t *item = (rtcp_sdes_item_t *)packet;
 
   for (i = 0; map[i].name; i++) {
-    if (strcasecmp(type, map[i].name) == 0) break;
+    if (strncasecmp(t->name, map[i].name, t->nlen) == 0 &&
+        map[i].name[t->nlen] == '\0') break;
   }
 
+  string = rtcp_string(t, &len);
+  if (len > 255) {
+    fprintf(stderr, "SDES item %.*s too long\n", t->nlen, t->name);
+    exit(2);
+  }
+  rtcp_room(packet, len + 2, end);
   item->type = map[i].type;
-  item->length = strlen(string);
-  strcpy(item->data, string);
+  item->length = len;
+  memcpy(item->data, string, len);
 
   return item->length + 2;
 } /* rtcp_sdes_item */
@@ -271,32 +339,33 @@ static int rtcp_sdes_item(char *type, char *string, char *packet)
 * Create SDES entries for single source.
 * Return length.
 */
-static int rtcp_sdes(node_t *list, char *packet)
+static int rtcp_sdes(rtcp_scan_t *t, char *packet, char *end)
 {
-  node_t *n;
-  int len = 0, total = 4;
+  int tok, len = 0, total = 4;
   struct rtcp_sdes *sdes = (struct rtcp_sdes *)packet;
 
+  rtcp_room(packet, 4, end);
+  sdes->src = 0;
   packet += 4; /* skip SRC */
-  for (n = list; n; n = n->next) {
-    if (n->type) {
-      if (strcmp(n->type, "src") == 0) {
-        sdes->src = htonl(n->num);
-      }
-      else {
-        len = rtcp_sdes_item(n->type, n->string, packet);
-        packet += len;
-        total += len;
-      }
+  while ((tok = rtcp_next(t)) != RTCP_CLOSE) {
+    if (tok == RTCP_OPEN) {
+      fprintf(stderr, "Invalid ( in SDES chunk\n");
+      exit(2);
+    }
+    if (rtcp_is(t, "src")) {
+      sdes->src = htonl(rtcp_num(t));
+    }
+    else {
+      len = rtcp_sdes_item(t, packet, end);
+      packet += len;
+      total += len;
     }
   }
-  /* end marker */
-  *packet = RTCP_SDES_END;
-  total++;
 
-  /* pad length to next multiple of 32 bits */
-  len = (total + 3) & 0xfffc;
-  memset(packet, 0, len - total);
+  /* end marker, and pad length to next multiple of 32 bits */
+  len = (total + 4) & ~3;
+  rtcp_room(packet, len - total, end);
+  memset(packet, RTCP_SDES_END, len - total);
 
   return len;
 } /* rtcp_sdes */
@@ -304,48 +373,28 @@ static int rtcp_sdes(node_t *list, char *packet)
 
 #define RTCP_SDES_HDR_LEN  4  /* SDES default length (common) */
 
-static int rtcp_write_sdes(node_t *list, char *packet)
+static int rtcp_write_sdes(rtcp_scan_t *t, char *packet, char *end)
 {
-  node_t *n;
-  int len = 0, total = RTCP_SDES_HDR_LEN, count = 0;
+  int tok, len = 0, total = RTCP_SDES_HDR_LEN, count = 0;
   rtcp_t *r = (rtcp_t *)packet;
 
-  r->common.length  = 0;
-  r->common.count   = 0;
-  r->common.version = RTP_VERSION;
-  r->common.pt      = RTCP_SDES;
-  r->common.p       = 0;
+  rtcp_room(packet, RTCP_SDES_HDR_LEN, end);
+  rtcp_header(r, RTCP_SDES, RTCP_SDES_HDR_LEN);
 
   packet += RTCP_SDES_HDR_LEN; /* skip common header */
 
-  for (n = list; n; n = n->next) {
-    if (n->type) {
-      if (strcmp(n->type, "SDES") == 0)
-        continue;
-      else if (strcmp(n->type, "p") == 0)
-        r->common.p = n->num;
-      else if (strcmp(n->type, "count") == 0)
-        r->common.count = n->num;
-      else if (strcmp(n->type, "len") == 0)
-        r->common.length = htons(n->num);
-      else  {
-        fprintf(stderr, "Invalid RTCP type %s\n", n->type);
-        exit(2);
-      }
-    }
-    else { /* list: type-specific parts */
-      len = rtcp_sdes(n->list, packet);
+  while ((tok = rtcp_next(t)) != RTCP_CLOSE) {
+    if (tok == RTCP_OPEN) { /* list: type-specific parts */
+      len = rtcp_sdes(t, packet, end);
       packet += len;
       total += len;
       count++;
     }
+    else if (!rtcp_common(t, r)) {
+      rtcp_invalid(t, "");
+    }
   }
-  /* if no length or count given, fill in */
-  if (r->common.length == 0) {
-    r->common.length = htons((total - 4) / 4);
-  }
-  if (r->common.count == 0)
-    r->common.count = count;
+  rtcp_fill(r, total, count);
 
   return total;
 } /* rtcp_write_sdes */
@@ -356,32 +405,29 @@ static int rtcp_write_sdes(node_t *list, char *packet)
 * Create RR entries for single report block.
 * Return length.
 */
-static int rtcp_rr(node_t *list, char *packet)
+static int rtcp_rr(rtcp_scan_t *t, char *packet, char *end)
 {
-  node_t *n;
   rtcp_rr_t *rr = (rtcp_rr_t *)packet;
 
-  for (n = list; n; n = n->next) {
-    if (n->type) {
-      if (strcmp(n->type, "ssrc") == 0)
-        rr->ssrc = htonl(n->num);
-      else if (strcmp(n->type, "fraction") == 0)
-        rr->fraction = (n->num)*256;
-      else if (strcmp(n->type, "lost") == 0)   /* PP: alignment OK? */
-        RTCP_SET_LOST(rr, n->num);
-      else if (strcmp(n->type, "last_seq") == 0)
-        rr->last_seq = htonl(n->num);
-      else if (strcmp(n->type, "jit") == 0)
-        rr->jitter = htonl(n->num);
-      else if (strcmp(n->type, "lsr") == 0)
-        rr->lsr = htonl(n->num);
-      else if (strcmp(n->type, "dlsr") == 0)
-        rr->dlsr = htonl(n->num);
-      else  {
-        fprintf(stderr, "Invalid RTCP RR type %s\n", n->type);
-        exit(2);
-      }
-    }
+  rtcp_room(packet, sizeof(rtcp_rr_t), end);
+  memset(rr, 0, sizeof(rtcp_rr_t));
+  while (rtcp_next(t) != RTCP_CLOSE) {
+    if (rtcp_is(t, "ssrc"))
+      rr->ssrc = htonl(rtcp_num(t));
+    else if (rtcp_is(t, "fraction"))
+      rr->fraction = rtcp_num(t)*256;
+    else if (rtcp_is(t, "lost"))   /* PP: alignment OK? */
+      RTCP_SET_LOST(rr, rtcp_num(t));
+    else if (rtcp_is(t, "last_seq"))
+      rr->last_seq = htonl(rtcp_num(t));
+    else if (rtcp_is(t, "jit"))
+      rr->jitter = htonl(rtcp_num(t));
+    else if (rtcp_is(t, "lsr"))
+      rr->lsr = htonl(rtcp_num(t));
+    else if (rtcp_is(t, "dlsr"))
+      rr->dlsr = htonl(rtcp_num(t));
+    else
+      rtcp_invalid(t, "RR ");
   }
 
   return  sizeof(rtcp_rr_t);
@@ -409,129 +455,115 @@ static u_int usec2ntp(u_int usec)
 } /* usec2ntp */
 
 
-static int rtcp_write_sr(node_t *list, char *packet)
+static int rtcp_write_sr(rtcp_scan_t *t, char *packet, char *end)
 {
-  node_t *n;
-  int len = 0, total = RTCP_SR_HDR_LEN, count = 0;
+  int tok, len = 0, total = RTCP_SR_HDR_LEN, count = 0;
+  int ntp = 0;  /* NTP time given */
   rtcp_t *r = (rtcp_t *)packet;
   struct timeval now;
 
+  rtcp_room(packet, RTCP_SR_HDR_LEN, end);
+  rtcp_header(r, RTCP_SR, RTCP_SR_HDR_LEN);
   gettimeofday(&now, 0);
-  r->common.length  = 0;
-  r->common.count   = 0;
-  r->common.version = RTP_VERSION;
-  r->common.pt      = RTCP_SR;
-  r->common.p       = 0;
   r->r.sr.ntp_sec   = htonl((uint32_t)now.tv_sec + GETTIMEOFDAY_TO_NTP_OFFSET);
   r->r.sr.ntp_frac  = htonl(usec2ntp((u_int)now.tv_usec));
 
   packet += RTCP_SR_HDR_LEN; /* skip common header and ssrc */
 
-  for (n = list; n; n = n->next) {
-    if (n->type) {
-      if (strcmp(n->type, "SR") == 0)
-        continue;
-      else if (strcmp(n->type, "ssrc") == 0)
-        r->r.sr.ssrc = htonl(n->num);
-      else if (strcmp(n->type, "p") == 0)
-        r->common.p = n->num;
-      else if (strcmp(n->type, "count") == 0)
-        r->common.count = n->num;
-      else if (strcmp(n->type, "len") == 0)
-        r->common.length = htons(n->num);
-      else if (strcmp(n->type, "ntp") == 0)  /* PP: two words */
-        r->r.sr.ntp_sec = htonl(n->num);
-      else if (strcmp(n->type, "ts") == 0)
-        r->r.sr.rtp_ts = htonl(n->num);
-      else if (strcmp(n->type, "psent") == 0)
-        r->r.sr.psent = htonl(n->num);
-      else if (strcmp(n->type, "osent") == 0)
-        r->r.sr.osent = htonl(n->num);
-      else  {
-        fprintf(stderr, "Invalid RTCP type %s\n", n->type);
-        exit(2);
-      }
-    }
-    else { /* list: type-specific parts */
-      len = rtcp_rr(n->list, packet);
+  while ((tok = rtcp_next(t)) != RTCP_CLOSE) {
+    if (tok == RTCP_OPEN) { /* list: type-specific parts */
+      len = rtcp_rr(t, packet, end);
       packet += len;
       total += len;
       count++;
     }
+    else if (rtcp_common(t, r))
+      continue;
+    else if (rtcp_is(t, "ssrc"))
+      r->r.sr.ssrc = htonl(rtcp_num(t));
+    else if (rtcp_is(t, "ntp")) {  /* PP: two words */
+      r->r.sr.ntp_sec = htonl(rtcp_num(t));
+      ntp = 1;
+    }
+    else if (rtcp_is(t, "ts"))
+      r->r.sr.rtp_ts = htonl(rtcp_num(t));
+    else if (rtcp_is(t, "psent"))
+      r->r.sr.psent = htonl(rtcp_num(t));
+    else if (rtcp_is(t, "osent"))
+      r->r.sr.osent = htonl(rtcp_num(t));
+    else
+      rtcp_invalid(t, "");
   }
-  /* if no length or count given, fill in */
-  if (r->common.length == 0) {
-    r->common.length = htons((total - 4) / 4);
-  }
-  if (r->common.count == 0)
-    r->common.count = count;
+  rtcp_fill(r, total, count);
+  if (!ntp) sr_now = 1;
 
   return total;
 } /* rtcp_write_sr */
 
 
+/*
+* Set the NTP time of the sender reports in compound RTCP packet
+* 'packet' of 'len' bytes to 'now'.
+*/
+static void sr_stamp(char *packet, int len, struct timeval *now)
+{
+  char *end = packet + len;
+
+  while (packet + RTCP_SR_HDR_LEN <= end) {
+    rtcp_t *r = (rtcp_t *)packet;
+
+    if (r->common.pt == RTCP_SR) {
+      r->r.sr.ntp_sec  = htonl((uint32_t)now->tv_sec +
+        GETTIMEOFDAY_TO_NTP_OFFSET);
+      r->r.sr.ntp_frac = htonl(usec2ntp((u_int)now->tv_usec));
+    }
+    packet += (ntohs(r->common.length) + 1) * 4;
+  }
+} /* sr_stamp */
+
+
 
 #define RTCP_RR_HDR_LEN  8  /* RR default length (common + ssrc) */
 
-static int rtcp_write_rr(node_t *list, char *packet)
+static int rtcp_write_rr(rtcp_scan_t *t, char *packet, char *end)
 {
-  node_t *n;
-  int len = 0, total = RTCP_RR_HDR_LEN, count = 0;
+  int tok, len = 0, total = RTCP_RR_HDR_LEN, count = 0;
   rtcp_t *r = (rtcp_t *)packet;
 
-  r->common.length  = 0;
-  r->common.count   = 0;
-  r->common.version = RTP_VERSION;
-  r->common.pt      = RTCP_RR;
-  r->common.p       = 0;
+  rtcp_room(packet, RTCP_RR_HDR_LEN, end);
+  rtcp_header(r, RTCP_RR, RTCP_RR_HDR_LEN);
 
   packet += RTCP_RR_HDR_LEN; /* skip common header and ssrc */
 
-  for (n = list; n; n = n->next) {
-    if (n->type) {
-      if (strcmp(n->type, "RR") == 0)
-        continue;
-      else if (strcmp(n->type, "ssrc") == 0)
-        r->r.rr.ssrc = htonl(n->num);
-      else if (strcmp(n->type, "p") == 0)
-        r->common.p = n->num;
-      else if (strcmp(n->type, "count") == 0)
-        r->common.count = n->num;
-      else if (strcmp(n->type, "len") == 0)
-        r->common.length = htons(n->num);
-      else  {
-        fprintf(stderr, "Invalid RTCP type %s\n", n->type);
-        exit(2);
-      }
-    }
-    else { /* list: type-specific parts */
-      len = rtcp_rr(n->list, packet);
+  while ((tok = rtcp_next(t)) != RTCP_CLOSE) {
+    if (tok == RTCP_OPEN) { /* list: type-specific parts */
+      len = rtcp_rr(t, packet, end);
       packet += len;
       total += len;
       count++;
     }
+    else if (rtcp_common(t, r))
+      continue;
+    else if (rtcp_is(t, "ssrc"))
+      r->r.rr.ssrc = htonl(rtcp_num(t));
+    else
+      rtcp_invalid(t, "");
   }
-  /* if no length or count given, fill in */
-  if (r->common.length == 0) {
-    r->common.length = htons((total - 4) / 4);
-  }
-  if (r->common.count == 0)
-    r->common.count = count;
+  rtcp_fill(r, total, count);
 
   return total;
 } /* rtcp_write_rr */
 
 
-static int rtcp_bye(node_t *list, char *packet)
+static int rtcp_bye(rtcp_scan_t *t, char *packet, char *end)
 {
-  node_t *n;
   uint32_t *bye = (uint32_t *)packet;
 
-  for (n = list; n; n = n->next) {
-    if (n->type) {
-      if (strcmp(n->type, "ssrc") == 0)
-        *bye = htonl(n->num);
-    }
+  rtcp_room(packet, sizeof(uint32_t), end);
+  *bye = 0;
+  while (rtcp_next(t) != RTCP_CLOSE) {
+    if (rtcp_is(t, "ssrc"))
+      *bye = htonl(rtcp_num(t));
   }
   return sizeof(uint32_t);
 } /* rtcp_bye */
@@ -539,66 +571,58 @@ static int rtcp_bye(node_t *list, char *packet)
 
 #define RTCP_BYE_HDR_LEN  4  /* BYE default length (common) */
 
-static int rtcp_write_bye(node_t *list, char *packet)
+static int rtcp_write_bye(rtcp_scan_t *t, char *packet, char *end)
 {
-  node_t *n;
-  int len = 0, total = RTCP_BYE_HDR_LEN, count = 0;
+  int tok, len = 0, total = RTCP_BYE_HDR_LEN, count = 0;
   rtcp_t *r = (rtcp_t *)packet;
 
-  r->common.length  = 0;
-  r->common.count   = 0;
-  r->common.version = RTP_VERSION;
-  r->common.pt      = RTCP_BYE;
-  r->common.p       = 0;
+  rtcp_room(packet, RTCP_BYE_HDR_LEN, end);
+  rtcp_header(r, RTCP_BYE, RTCP_BYE_HDR_LEN);
 
   packet += RTCP_BYE_HDR_LEN; /* skip common header */
 
-  for (n = list; n; n = n->next) {
-    if (n->type) {
-      if (strcmp(n->type, "BYE") == 0)
-        continue;
-      else if (strcmp(n->type, "p") == 0)
-        r->common.p = n->num;
-      else if (strcmp(n->type, "count") == 0)
-        r->common.count = n->num;
-      else if (strcmp(n->type, "len") == 0)
-        r->common.length = htons(n->num);
-      else  {
-        fprintf(stderr, "Invalid RTCP type %s\n", n->type);
-        exit(2);
-      }
-    }
-    else { /* list: type-specific parts */
-      len = rtcp_bye(n->list, packet);
+  while ((tok = rtcp_next(t)) != RTCP_CLOSE) {
+    if (tok == RTCP_OPEN) { /* list: type-specific parts */
+      len = rtcp_bye(t, packet, end);
       packet += len;
       total += len;
       count++;
     }
+    else if (!rtcp_common(t, r)) {
+      rtcp_invalid(t, "");
+    }
   }
-  /* if no length or count given, fill in */
-  if (r->common.length == 0) {
-    r->common.length = htons((total - 4) / 4);
-  }
-  if (r->common.count == 0)
-    r->common.count = count;
+  rtcp_fill(r, total, count);
 
   return total;
 } /* rtcp_write_bye */
 
 
-static int rtcp_write_app(node_t *list, char *packet)
+/*
+* APP packets are not generated; skip the description.
+*/
+static int rtcp_write_app(rtcp_scan_t *t, char *packet, char *end)
 {
+  int level = 1;
+  int tok;
+
+  while (level > 0) {
+    tok = rtcp_next(t);
+    if (tok == RTCP_OPEN) level++;
+    else if (tok == RTCP_CLOSE) level--;
+  }
   return 0;
-}
+} /* rtcp_write_app */
 
 /*
- * Based on list of parameters in 'n', assemble RTCP packet.
+ * Assemble the RTCP packet described by the list after its opening
+ * parenthesis, which starts with the packet type, up to the closing one.
  */
-static int rtcp_packet(node_t *list, char *packet)
+static int rtcp_packet(rtcp_scan_t *t, char *packet, char *end)
 {
   struct {
     const char *pt;
-    int  (*rtcp_write)(node_t *list, char *packet);
+    int  (*rtcp_write)(rtcp_scan_t *t, char *packet, char *end);
   } rtcp_map[] = {
     { "SDES",  rtcp_write_sdes },
     { "RR",  rtcp_write_rr },
@@ -608,15 +632,11 @@ static int rtcp_packet(node_t *list, char *packet)
   };
   int max = sizeof(rtcp_map) / sizeof(rtcp_map[0]);
   int i;
-  node_t *n;
-
-  for (n = list; n; n = n->next) {
-    if (!n->type)
-      continue;
 
+  if (rtcp_next(t) == RTCP_WORD && !t->value) {
     for (i=0; i < max; i++) {
-      if (strcmp(n->type, rtcp_map[i].pt) == 0)
-        return rtcp_map[i].rtcp_write(list, packet);
+      if (rtcp_is(t, rtcp_map[i].pt))
+        return rtcp_map[i].rtcp_write(t, packet, end);
     }
   }
 
@@ -626,24 +646,29 @@ static int rtcp_packet(node_t *list, char *packet)
 
 
 /*
-* Generate RTCP packet based on textual description.
+* Generate RTCP packet based on textual description into 'packet',
+* which must not extend past 'end'.
 */
-static int rtcp(char *text, char *packet)
+static int rtcp(char *text, char *packet, char *end)
 {
-  node_t *node_list, *n;
+  rtcp_scan_t t;
+  int tok;
   int len;
   int total = 0;
 
-  node_list = parse(text);
-
-  for (n = node_list; n; n = n->next) {
-    if (n->list) {
-      len = rtcp_packet(n->list, packet);
+  t.s = text;
+  while ((tok = rtcp_scan(&t)) != RTCP_END) {
+    if (tok == RTCP_OPEN) {
+      len = rtcp_packet(&t, packet, end);
       packet += len;
       total += len;
     }
+    else if (tok == RTCP_CLOSE) {
+      fprintf(stderr, "Unbalanced ) in RTCP packet\n");
+      exit(2);
+    }
+    /* words outside of packets, such as len=, are ignored */
   }
-  node_free(node_list);
 
   return total;
 } /* rtcp */
@@ -738,117 +763,735 @@ static int rtp(char *text, char *packet)
 
 
 /*
-* Generate a packet based on description in 'text'. Return length.
-* Set generation time.
+* A packet to send, with its time as given in the input.
 */
-static int generate(char *text, char *data, struct timeval *time, int *type)
-{
+typedef struct {
+  struct timeval time;
+  int type;            /* 0: RTP, 1: RTCP */
   int length;
+  int sr_now;          /* stamp SRs with the time when sent */
+  char *data;
+  size_t off;          /* compiled: offset of the data */
+} packet_t;
+
+
+/* room for the data of a packet, as in an RD_buffer_t */
+#define PACKET_MAX  sizeof(((RD_buffer_t *)0)->p.data)
+
+/*
+* Generate a packet based on description in 'text' into 'p', whose
+* data must have room for PACKET_MAX bytes. Return length.
+*/
+static int generate(char *text, packet_t *p)
+{
   char type_name[100];
   /* suseconds_t is int on some platforms, long on others, so it can't portably
      be directly used in sscanf.  sscanf into a long and assign (which implicitly
      casts) */
-  long tv_usec;
+  long tv_sec, tv_usec;
 
-  if (verbose) printf("%s", text);
-  if (sscanf(text, "%ld.%ld %s", &(time->tv_sec), &tv_usec, type_name) < 3) {
+  if (verbose) printf("%s\n", text);
+  if (sscanf(text, "%ld.%ld %s", &tv_sec, &tv_usec, type_name) < 3) {
     fprintf(stderr, "Line {%s} is invalid.\n", text);
     exit(2);
   }
-  time->tv_usec = tv_usec;
+  p->time.tv_sec  = tv_sec;
+  p->time.tv_usec = tv_usec;
+  sr_now = 0;
   if (strcmp(type_name, "RTP") == 0) {
-    length = rtp(strstr(text, "RTP") + 3, data);
-    *type = 0;
+    p->length = rtp(strstr(text, "RTP") + 3, p->data);
+    p->type = 0;
   }
   else if (strcmp(type_name, "RTCP") == 0) {
-    length = rtcp(strstr(text, "RTCP") + 4, data);
-    *type = 1;
+    p->length = rtcp(strstr(text, "RTCP") + 4, p->data,
+      p->data + PACKET_MAX);
+    p->type = 1;
   } else {
     fprintf(stderr, "Type %s is not supported.\n", type_name);
     exit(2);
   }
-  return length;
+  p->sr_now = sr_now;
+  return p->length;
 } /* generate */
 
 #define MAX_TEXT_LINE 4096
 
+static char line[MAX_TEXT_LINE];  /* last line read (may be next packet) */
+
 /*
-* Timer handler; sends any pending packets and parses next one.
-* First packet is played out immediately.
+* Read the next record, a line and its continuation lines, which start
+* with white space, into 'text', without the final newline. Return 0 at
+* the end of the input.
 */
-static Notify_value send_handler(Notify_client client)
+static int read_record(FILE *in, char *text)
 {
-  static struct {
-    int length;
-    struct timeval time;
-    int type;
-    char data[1500];
-  } packet;
-  FILE *in = (FILE *)client;
-  static char line[MAX_TEXT_LINE];       /* last line read (may be next packet) */
-  char text[MAX_TEXT_LINE];              /* current line from the file, including cont. lines */
-  static int isfirstpacket = 1; /* is this the first packet? */
-  struct timeval this_tv;       /* time this packet is being sent */
-  static struct timeval basetime;        /* base time (first packet) */
-  struct timeval next_tv;       /* time for next packet */
-  struct timeval past_tv;       /* to determine the time to sent is in past */
-  char *s;
+  char *s = text;
+  size_t len;
+  int next = 0;  /* 'line' starts the next record */
 
-  gettimeofday(&this_tv, NULL);
-
-  /* send any pending packet */
-  if (packet.length && send(sock[packet.type], packet.data, packet.length, 0) < 0) {
-    perror("write");
+  if (line[0]) {
+    strcpy(text, line);
+    s += strlen(text);
+    line[0] = '\0';
   }
+  while (!next && fgets(line, sizeof(line), in)) {
+    if (line[0] == '#') continue;
+    else if (s != text && !isspace((int)line[0])) next = 1;
+    else {
+      len = strlen(line);
+      if (s + len >= text + MAX_TEXT_LINE) {
+        fprintf(stderr, "Record longer than %d bytes; use -f.\n",
+          MAX_TEXT_LINE);
+        exit(2);
+      }
+      memcpy(s, line, len + 1);
+      s += len;
+    }
+  }
+  if (!next) line[0] = '\0';
+  if (s == text) return 0;
+  if (s[-1] == '\n') s[-1] = '\0';
+  return 1;
+} /* read_record */
 
-  /* read line; continuation lines start with white space */
-  if (feof(in)) {
-    if (loop) {
-      fseek(in, 0, SEEK_SET);
-      printf("Rewound input file\n");
+
+/*
+* A script in a regular file, mapped into memory and split into records
+* once: each record, a line and its continuation lines, is terminated
+* in place (the mapping is private) and parsed there, so it can have any
+* length.
+*/
+static struct {
+  char **rec;
+  int n, max;
+  int next;
+} script;
+
+
+/*
+* Map the script 'in' and index its records. Return 0 if it is not a
+* regular file or cannot be mapped; it is then read line by line.
+*/
+static int script_map(FILE *in)
+{
+#ifndef WIN32
+  struct stat st;
+  char *map, *s, *end, *eol;
+  char *last = NULL;  /* newline ending the last record */
+
+  if (fstat(fileno(in), &st) < 0 || !S_ISREG(st.st_mode) ||
+      st.st_size == 0)
+    return 0;
+  map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+    fileno(in), 0);
+  if (map == MAP_FAILED) return 0;
+  end = map + st.st_size;
+
+  for (s = map; s < end; s = eol + 1) {
+    if (!(eol = memchr(s, '\n', end - s))) eol = end;
+    if (*s == '#') {
+      /* drop comments, also between continuation lines */
+      if (last) memset(s, ' ', eol - s);
+    }
+    else if (isspace((int)*s) && last) {
+      last = eol;
     }
     else {
-      notify_stop();
-      exit(0);
-      return NOTIFY_DONE;
-   }
+      if (last) *last = '\0';
+      if (script.n == script.max) {
+        script.max = script.max ? 2 * script.max : 4096;
+        script.rec = realloc(script.rec, script.max * sizeof(char *));
+        if (!script.rec) {
+          perror("can not index input");
+          exit(1);
+        }
+      }
+      script.rec[script.n++] = s;
+      last = eol;
+    }
   }
-  s = text;
-  if (line[0]) {
-    strcpy(text, line);
-    s += strlen(text);
+
+  /* no newline after the last record: copy it to terminate it */
+  if (last == end) {
+    char *r = script.rec[script.n - 1];
+
+    if (!(s = malloc(end - r + 1))) {
+      perror("can not index input");
+      exit(1);
+    }
+    memcpy(s, r, end - r);
+    s[end - r] = '\0';
+    script.rec[script.n - 1] = s;
   }
-  while (fgets(line, sizeof(line), in)) {
-    if (line[0] == '#') continue;
-    else if (s != text && !isspace((int)line[0])) break;
+  else if (last) *last = '\0';
+  return 1;
+#else
+  return 0;
+#endif
+} /* script_map */
+
+
+/*
+* Return the next record of the script, NULL at the end.
+*/
+static char *next_record(FILE *in)
+{
+  static char text[MAX_TEXT_LINE];
+
+  if (script.rec) {
+    return script.next < script.n ? script.rec[script.next++] : NULL;
+  }
+  return read_record(in, text) ? text : NULL;
+} /* next_record */
+
+
+/*
+* The input compiled to packets. In loop mode, the first pass over the
+* input appends each packet here, and later passes send them from
+* memory without parsing.
+*/
+static struct {
+  packet_t *p;           /* data at 'off' in 'buf' */
+  int n, max;
+  char *buf;
+  size_t len, size;
+  int replay;            /* input read, sending from here */
+  int next;              /* next packet when replaying */
+  struct timeval period; /* time from one pass to the next */
+} compiled;
+
+static int dump;                  /* input is an rtpdump file */
+static struct timeval basetime;   /* send time minus packet time */
+
+
+/*
+* Append packet 'p' to the compiled input.
+*/
+static void compile(packet_t *p)
+{
+  packet_t *c;
+
+  if (compiled.n == compiled.max) {
+    compiled.max = compiled.max ? 2 * compiled.max : 1024;
+    compiled.p = realloc(compiled.p, compiled.max * sizeof(packet_t));
+  }
+  while (compiled.len + p->length > compiled.size) {
+    compiled.size = compiled.size ? 2 * compiled.size : 65536;
+    compiled.buf = realloc(compiled.buf, compiled.size);
+  }
+  if (!compiled.p || !compiled.buf) {
+    perror("can not compile input");
+    exit(1);
+  }
+  c = &compiled.p[compiled.n++];
+  *c = *p;
+  c->off = compiled.len;
+  memcpy(compiled.buf + compiled.len, p->data, p->length);
+  compiled.len += p->length;
+} /* compile */
+
+
+/*
+* Synthetic streams (-g): 'streams' sources with consecutive SSRCs,
+* each sending 'size' bytes of payload every 'ptime' ms with RTP
+* timestamps at 'rate' Hz, spread evenly over the packet time, and a
+* compound SR and SDES packet at the RTCP intervals of RFC 3550. The
+* next event of each source, an RTP or an RTCP packet, is kept in a
+* binary heap ordered by time, so a packet costs O(log streams).
+*/
+typedef struct {
+  uint32_t ssrc;
+  uint16_t seq;
+  uint32_t ts;         /* RTP timestamp at 'start' */
+  int64_t start;       /* time of the first packet (us) */
+  uint32_t packets, octets;
+} gen_stream_t;
+
+typedef struct {
+  int64_t time;        /* us since the start */
+  int stream;
+  int rtcp;            /* SR rather than RTP packet */
+} gen_event_t;
+
+static struct {
+  int streams;         /* 0: not generating */
+  uint32_t ssrc;
+  int pt, size, ptime, rate;
+  int marker;          /* set the marker bit every 'marker' packets */
+  int rtcp;            /* send RTCP */
+  double duration;     /* seconds, 0: forever */
+  gen_stream_t *s;
+  gen_event_t *heap;
+  int n;
+} gen;
+
+#define GEN_CNAME_LEN 16   /* "%08lx@rtpsend" */
+#define GEN_SDES_LEN  (8 + ((2 + GEN_CNAME_LEN + 4) & ~3))  /* CNAME only */
+
+
+/*
+* Parse generator spec 'spec', a list of "name=value" terms separated by
+* white space. Return 0 on success.
+*/
+static int gen_parse(char *spec)
+{
+  char *term, *v, *end;
+  double value;
+
+  gen.streams = 1;
+  gen.ssrc = rand();
+  gen.pt = 0;
+  gen.size = 160;
+  gen.ptime = 20;
+  gen.rate = 8000;
+  gen.rtcp = 1;
+  for (term = strtok(spec, " \t"); term; term = strtok(NULL, " \t")) {
+    if (!(v = strchr(term, '='))) goto bad;
+    *v++ = '\0';
+    value = strtod(v, &end);
+    if (end == v || *end || value < 0 || value > 0xffffffffUL) goto bad;
+    if (strcmp(term, "streams") == 0 && value >= 1 && value <= 1000000)
+      gen.streams = value;
+    else if (strcmp(term, "ssrc") == 0)
+      gen.ssrc = value;
+    else if (strcmp(term, "pt") == 0 && value <= 127)
+      gen.pt = value;
+    else if (strcmp(term, "size") == 0 && value + 12 <= PACKET_MAX)
+      gen.size = value;
+    else if (strcmp(term, "ptime") == 0 && value >= 1 && value <= 60000)
+      gen.ptime = value;
+    else if (strcmp(term, "rate") == 0 && value >= 1)
+      gen.rate = value;
+    else if (strcmp(term, "duration") == 0)
+      gen.duration = value;
+    else if (strcmp(term, "marker") == 0)
+      gen.marker = value;
+    else if (strcmp(term, "rtcp") == 0)
+      gen.rtcp = value != 0;
     else {
-      strcpy(s, line);
-      s += strlen(line);
+      v[-1] = '=';
+      goto bad;
+    }
+  }
+  return 0;
+
+bad:
+  fprintf(stderr, "invalid generator term: %s\n", term);
+  return -1;
+} /* gen_parse */
+
+
+/*
+* Return the time to the next RTCP packet of a source, in microseconds,
+* as computed by rtcp_interval() of RFC 3550, A.7: all members are
+* senders, so all of the RTCP bandwidth, 5% of the session bandwidth,
+* is shared by all of them.
+*/
+static int64_t gen_interval(int initial)
+{
+  double rtp_size  = 28 + 12 + gen.size;            /* with UDP/IP */
+  double rtcp_size = 28 + RTCP_SR_HDR_LEN + GEN_SDES_LEN;
+  double rtcp_bw   = 0.05 * gen.streams * rtp_size * 1000 / gen.ptime;
+  double t = gen.streams * rtcp_size / rtcp_bw;
+  double t_min = initial ? 2.5 : 5;
+
+  if (t < t_min) t = t_min;
+  t *= rand() / (RAND_MAX + 1.0) + 0.5;
+  return t / (2.71828 - 1.5) * 1e6;  /* compensate for reconsideration */
+} /* gen_interval */
+
+
+/*
+* Restore the heap order after the time of event 'i' was increased.
+*/
+static void gen_sift(int i)
+{
+  gen_event_t e = gen.heap[i];
+  int c;
+
+  while ((c = 2 * i + 1) < gen.n) {
+    if (c + 1 < gen.n && gen.heap[c + 1].time < gen.heap[c].time) c++;
+    if (e.time <= gen.heap[c].time) break;
+    gen.heap[i] = gen.heap[c];
+    i = c;
+  }
+  gen.heap[i] = e;
+} /* gen_sift */
+
+
+static void gen_init(void)
+{
+  int i;
+
+  gen.s = calloc(gen.streams, sizeof(gen_stream_t));
+  gen.heap = calloc(2 * gen.streams, sizeof(gen_event_t));
+  if (!gen.s || !gen.heap) {
+    perror("can not set up streams");
+    exit(1);
+  }
+  for (i = 0; i < gen.streams; i++) {
+    gen_stream_t *s = &gen.s[i];
+
+    s->ssrc  = gen.ssrc + i;
+    s->seq   = rand();
+    s->ts    = rand();
+    s->start = (int64_t)i * gen.ptime * 1000 / gen.streams;
+    gen.heap[gen.n].time = s->start;
+    gen.heap[gen.n++].stream = i;
+    if (gen.rtcp) {
+      gen.heap[gen.n].time = s->start + gen_interval(1);
+      gen.heap[gen.n].stream = i;
+      gen.heap[gen.n++].rtcp = 1;
+    }
+  }
+  for (i = gen.n / 2 - 1; i >= 0; i--) gen_sift(i);
+} /* gen_init */
+
+
+static int gen_rtp(gen_stream_t *s, char *packet)
+{
+  rtp_hdr_t *h = (rtp_hdr_t *)packet;
+
+  memset(packet, 0, 12 + gen.size);
+  h->version = RTP_VERSION;
+  h->pt   = gen.pt;
+  h->m    = s->packets == 0 || (gen.marker && s->packets % gen.marker == 0);
+  h->seq  = htons(s->seq++);
+  h->ts   = htonl(s->ts + (uint32_t)((double)s->packets * gen.rate *
+    gen.ptime / 1000));
+  h->ssrc = htonl(s->ssrc);
+  s->packets++;
+  s->octets += gen.size;
+  return 12 + gen.size;
+} /* gen_rtp */
+
+
+/*
+* Compound SR and SDES packet of source 's' at time 'now'; the NTP time
+* is set when sent.
+*/
+static int gen_rtcp(gen_stream_t *s, int64_t now, char *packet)
+{
+  rtcp_t *r = (rtcp_t *)packet;
+  rtcp_sdes_item_t *item;
+
+  rtcp_header(r, RTCP_SR, RTCP_SR_HDR_LEN);
+  r->common.length = htons(RTCP_SR_HDR_LEN / 4 - 1);
+  r->r.sr.ssrc   = htonl(s->ssrc);
+  r->r.sr.rtp_ts = htonl(s->ts + (uint32_t)((double)(now - s->start) *
+    gen.rate / 1e6));
+  r->r.sr.psent  = htonl(s->packets);
+  r->r.sr.osent  = htonl(s->octets);
+
+  r = (rtcp_t *)(packet + RTCP_SR_HDR_LEN);
+  rtcp_header(r, RTCP_SDES, GEN_SDES_LEN);
+  r->common.count  = 1;
+  r->common.length = htons(GEN_SDES_LEN / 4 - 1);
+  r->r.sdes.src    = htonl(s->ssrc);
+  item = r->r.sdes.item;
+  item->type   = RTCP_SDES_CNAME;
+  item->length = GEN_CNAME_LEN;
+  sprintf(item->data, "%08lx@rtpsend", (unsigned long)s->ssrc);
+  item->data[GEN_CNAME_LEN] = RTCP_SDES_END;
+
+  return RTCP_SR_HDR_LEN + GEN_SDES_LEN;
+} /* gen_rtcp */
+
+
+/*
+* Generate the next packet into 'p'. Return 0 after the duration.
+*/
+static int gen_next(packet_t *p)
+{
+  gen_event_t *e = &gen.heap[0];
+  gen_stream_t *s = &gen.s[e->stream];
+
+  if (gen.duration > 0 && e->time >= gen.duration * 1e6) return 0;
+  p->time.tv_sec  = e->time / 1000000;
+  p->time.tv_usec = e->time % 1000000;
+  if (e->rtcp) {
+    p->length = gen_rtcp(s, e->time, p->data);
+    p->type   = 1;
+    p->sr_now = 1;
+    e->time  += gen_interval(0);
+  }
+  else {
+    p->length = gen_rtp(s, p->data);
+    p->type   = 0;
+    p->sr_now = 0;
+    e->time  += gen.ptime * 1000;
+  }
+  gen_sift(0);
+  return 1;
+} /* gen_next */
+
+
+/*
+* Get the next packet into 'p', parsing the input or, when replaying,
+* from memory. Return 0 at the end.
+*/
+static int next_packet(FILE *in, packet_t *p)
+{
+  static RD_buffer_t b;
+  char *text;
+
+  if (compiled.replay) {
+    if (compiled.next == compiled.n) {
+      compiled.next = 0;
+      timeradd(&basetime, &compiled.period, &basetime);
+      printf("Rewound input file\n");
     }
+    *p = compiled.p[compiled.next++];
+    p->data = compiled.buf + p->off;
+    return 1;
+  }
+
+  p->data = b.p.data;
+  if (gen.streams) {
+    return gen_next(p);
+  }
+  else if (dump) {
+    if (RD_read(in, &b) > 0) {
+      p->time.tv_sec  = b.p.hdr.offset / 1000;
+      p->time.tv_usec = (b.p.hdr.offset % 1000) * 1000;
+      p->type   = b.p.hdr.plen == 0;
+      p->length = b.p.hdr.length;
+      p->sr_now = 0;
+      if (loop) compile(p);
+      return 1;
+    }
+  }
+  else if ((text = next_record(in))) {
+    generate(text, p);
+    if (loop) compile(p);
+    return 1;
+  }
+
+  /*
+  * End of the input: replay it, one average packet interval after the
+  * last packet.
+  */
+  if (loop && compiled.n > 0) {
+    struct timeval first = compiled.p[0].time;
+    struct timeval last  = compiled.p[compiled.n - 1].time;
+    double period;
+
+    timersub(&last, &first, &compiled.period);
+    period = compiled.period.tv_sec + compiled.period.tv_usec / 1e6;
+    if (compiled.n > 1) period += period / (compiled.n - 1);
+    if (period <= 0) period = 0.001;
+    compiled.period.tv_sec  = period;
+    compiled.period.tv_usec = (period - compiled.period.tv_sec) * 1e6;
+    compiled.replay = 1;
+    compiled.next = compiled.n;  /* rewinds first */
+    return next_packet(in, p);
   }
+  return 0;
+} /* next_packet */
+
+
+/*
+* Packets parsed ahead of time, each with its absolute send time, so
+* that parsing is done while waiting for the next packet to become due
+* rather than after it is due.
+*/
+#define SEND_BATCH  256   /* most packets sent in one call */
+#define SEND_QUEUE  64    /* packets parsed ahead */
+
+static struct {
+  packet_t p[SEND_QUEUE];
+  struct timeval due[SEND_QUEUE];
+  char data[SEND_QUEUE][PACKET_MAX];
+  int head, n;
+  int eof;               /* input exhausted */
+  int started;           /* 'basetime' is set */
+  struct timeval last;   /* send time of the last packet queued */
+} sendq;
+
+/*
+* Lateness of packets, i.e., the time they were sent after they were
+* due, in microseconds, with power-of-two buckets.
+*/
+#define LATE_BUCKETS 24
+
+static struct {
+  unsigned long n;
+  double sum;
+  long max;
+  unsigned long b[LATE_BUCKETS];
+} late;
+
+static int stats = -1;    /* -S interval, -1: no statistics */
+
+
+/*
+* Record a packet sent 'us' microseconds after it was due.
+*/
+static void late_add(long us)
+{
+  int i;
+
+  if (us < 0) us = 0;
+  for (i = 0; i < LATE_BUCKETS - 1 && us >= (1L << i); i++)
+    ;
+  late.b[i]++;
+  late.n++;
+  late.sum += us;
+  if (us > late.max) late.max = us;
+} /* late_add */
+
+
+/*
+* Print the lateness statistics and those of the event loop (-S).
+*/
+static void late_report(void)
+{
+  int i;
+
+  fprintf(stderr, "rtpsend: lateness: %lu, avg %.1f max %ld usec;", late.n,
+    late.n ? late.sum / late.n : 0., late.max);
+  for (i = 0; i < LATE_BUCKETS; i++) {
+    if (!late.b[i]) continue;
+    if (i < LATE_BUCKETS - 1) fprintf(stderr, " <%ld:%lu", 1L << i, late.b[i]);
+    else fprintf(stderr, " >=%ld:%lu", 1L << (i - 1), late.b[i]);
+  }
+  fprintf(stderr, "\n");
+  notify_stats_report();
+} /* late_report */
+
+
+static void done(int sig)
+{
+  exit(0);
+}
+
+
+/*
+* Parse the next packet into the queue. The very first packet is due
+* 'now'; the others keep their spacing from it. Return 0 at the end of
+* the input.
+*/
+static int enqueue(FILE *in, struct timeval *now)
+{
+  int i = (sendq.head + sendq.n) % SEND_QUEUE;
+  packet_t *p = &sendq.p[i];
 
-  packet.length = generate(text, packet.data, &packet.time, &packet.type);
-  /* very first packet: send immediately */
-  if (isfirstpacket) {
-    isfirstpacket = 0;
-    timersub(&this_tv, &packet.time, &basetime);
+  if (!next_packet(in, p)) return 0;
+  if (p->data != sendq.data[i]) {
+    memcpy(sendq.data[i], p->data, p->length);
+    p->data = sendq.data[i];
   }
+  if (!sendq.started) {
+    sendq.started = 1;
+    timersub(now, &p->time, &basetime);
+    sendq.last = *now;
+  }
+  timeradd(&basetime, &p->time, &sendq.due[i]);
+  if (timercmp(&sendq.due[i], &sendq.last, <)) {
+    fprintf(stderr, "Non-monotonic time %ld.%ld - sent immediately.\n",
+            p->time.tv_sec, (long)p->time.tv_usec);
+  }
+  sendq.last = sendq.due[i];
+  sendq.n++;
+  return 1;
+} /* enqueue */
+
+
+/*
+* Report a send that failed after notify_send() had queued it.
+*/
+static void send_failed(Notify_client client, int error)
+{
+  errno = error;
+  perror("write");
+} /* send_failed */
+
 
-  /* compute and set next playout time */
-  timeradd(&basetime, &packet.time, &next_tv);
+/*
+* Timer handler; sends the packets that are due and, until the next one
+* is, parses ahead. First packet is played out immediately.
+*/
+static Notify_value send_handler(Notify_client client)
+{
+  FILE *in = (FILE *)client;
+  struct timeval now;
+  packet_t *p;
+  int sent = 0;
+
+  for (;;) {
+    gettimeofday(&now, NULL);
+    while (sendq.n && !timercmp(&sendq.due[sendq.head], &now, >)) {
+      if (sent == SEND_BATCH) {
+        timer_set(&now, send_handler, client, 0);
+        return NOTIFY_DONE;
+      }
+      p = &sendq.p[sendq.head];
+      if (p->sr_now) sr_stamp(p->data, p->length, &now);
+      if (notify_send(sock[p->type], p->data, p->length, NULL,
+          send_failed, 0) < 0) {
+        perror("write");
+      }
+      if (stats >= 0) {
+        struct timeval d;
 
-  timersub(&next_tv, &this_tv, &past_tv);
-  if (past_tv.tv_sec < 0) {
-    fprintf(stderr, "Non-monotonic time %ld.%ld - sent immediately.\n", 
-            packet.time.tv_sec, (long)packet.time.tv_usec);
-    next_tv = this_tv;
+        timersub(&now, &sendq.due[sendq.head], &d);
+        late_add(d.tv_sec * 1000000L + d.tv_usec);
+      }
+      sendq.head = (sendq.head + 1) % SEND_QUEUE;
+      sendq.n--;
+      sent++;
+    }
+    if (sendq.n == SEND_QUEUE || sendq.eof) break;
+    if (!enqueue(in, &now)) sendq.eof = 1;
   }
 
-  timer_set(&next_tv, send_handler, (Notify_client)in, 0);
+  if (sendq.n == 0) {
+    notify_stop();
+    notify_flush();
+    exit(0);
+  }
+  timer_set(&sendq.due[sendq.head], send_handler, client, 0);
   return NOTIFY_DONE;
 } /* send_handler */
 
 
+/*
+* Write the input as an rtpdump file to standard output, with packet
+* times rounded to milliseconds. Sender reports without an NTP time get
+* that of the packet in the file.
+*/
+static void compile_dump(FILE *in, struct sockaddr_in *sin)
+{
+  RD_buffer_t b;
+  packet_t p;
+  struct timeval now;
+
+  gettimeofday(&now, 0);
+  if (RD_write_header(stdout, sin, &now) < 0) {
+    perror("fwrite");
+    exit(1);
+  }
+  loop = 0;
+  while (next_packet(in, &p)) {
+    if (p.sr_now) {
+      struct timeval t;
+
+      timeradd(&now, &p.time, &t);
+      sr_stamp(p.data, p.length, &t);
+    }
+    memcpy(b.p.data, p.data, p.length);
+    b.p.hdr.length = p.length;
+    b.p.hdr.plen   = p.type ? 0 : p.length;
+    b.p.hdr.offset = p.time.tv_sec * 1000 + (p.time.tv_usec + 500) / 1000;
+    if (RD_write(stdout, &b) < 0) {
+      perror("fwrite");
+      exit(1);
+    }
+  }
+  exit(0);
+} /* compile_dump */
+
+
 int main(int argc, char *argv[])
 {
   unsigned char ttl = 16;
@@ -861,25 +1504,44 @@ int main(int argc, char *argv[])
   int on = 1;          /* flag */
   static u_char ra[4] = {148, 4, 0, 1};  /* router alert option for RTP */
   char *filename = 0;
+  int compile_only = 0; /* write rtpdump file instead of sending */
+  char *spec = 0;       /* generate synthetic streams */
+  int gso = 0;          /* coalesce packets with UDP GSO */
+  int uring = 0;        /* send through io_uring */
   extern char *optarg;
   extern int optind;
 
   /* parse command line arguments */
   startupSocket();
-  while ((c = getopt(argc, argv, "f:als:v?h")) != EOF) {
+  while ((c = getopt(argc, argv, "cf:Gg:alS:s:Uv?h")) != EOF) {
     switch(c) {
+    case 'c':
+      compile_only = 1;
+      break;
     case 'f':
       filename = optarg;
       break;
+    case 'G':
+      gso = 1;
+      break;
+    case 'g':
+      spec = optarg;
+      break;
     case 'a':
       alert = 1;
       break;
     case 'l':  /* loop */
       loop = 1;
       break;
+    case 'S':
+      stats = atoi(optarg);
+      break;
     case 's':  /* locked source port */
       sourceport = atoi(optarg);
       break;
+    case 'U':
+      uring = 1;
+      break;
     case 'v':
       verbose = 1;
       break;
@@ -890,7 +1552,16 @@ int main(int argc, char *argv[])
     }
   }
 
-  if (filename) {
+  srand((unsigned)time(NULL));
+  if (spec) {
+    if (gen_parse(spec)) exit(1);
+    if (compile_only && gen.duration == 0) {
+      fprintf(stderr, "%s: -c needs a generator duration\n", argv[0]);
+      exit(1);
+    }
+    gen_init();
+  }
+  else if (filename) {
     in = fopen(filename, "r");
     if (!in) {
       perror(filename);
@@ -899,9 +1570,21 @@ int main(int argc, char *argv[])
   }
   else {
     in = stdin;
-    loop = 0;
   }
 
+  /* an rtpdump file, e.g., compiled with -c, or a script */
+  if (in && fgets(line, sizeof(line), in) && strncmp(line, "#!rtpplay", 9) == 0) {
+    struct timeval start;
+
+    if (RD_header_line(in, line, NULL, &start, 0) < 0) {
+      fprintf(stderr, "%s: invalid rtpdump file header\n", argv[0]);
+      exit(1);
+    }
+    dump = 1;
+  }
+  if (line[0] == '#') line[0] = '\0';
+  if (in && !dump && script_map(in)) line[0] = '\0';
+
   if (optind < argc) {
     if (hpt(argv[optind], &sin, &ttl) == -1) {
       fprintf(stderr, "%s: Invalid host. %s\n", argv[0], argv[optind]);
@@ -919,6 +1602,7 @@ int main(int argc, char *argv[])
       sin.sin_addr = *local;
     }
   }
+  if (compile_only) compile_dump(in, &sin);
 
   /* create/connect sockets */
   for (i = 0; i < 2; i++) {
@@ -972,6 +1656,16 @@ int main(int argc, char *argv[])
     }
   }
 
+  if (gso && !notify_send_gso(1))
+    fprintf(stderr, "%s: UDP GSO not available\n", argv[0]);
+  if (uring && !notify_uring())
+    fprintf(stderr, "%s: io_uring not available\n", argv[0]);
+  if (stats >= 0) {
+    notify_stats(stats);
+    atexit(late_report);
+    signal(SIGINT, done);
+    signal(SIGTERM, done);
+  }
   send_handler((Notify_client)in);
   notify_start();
   return 0;
@@ -0,0 +1,419 @@
+/*
+ * (c) 1998-2018 by Columbia University; all rights reserved
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+* Copy part of an rtpdump file to a new one: the packets recorded in a
+* time range, optionally only those of some sources, payload types or
+* kinds. Records are not decoded and re-encoded; runs of consecutive
+* records that are kept are copied as they are from a large buffer.
+* The file header, including the start of recording, is kept too, so
+* packet times stay the same.
+*
+* To find the start of the range without reading the file from its
+* beginning, "rtpslice -I file" writes an index to "file.idx": the
+* position of the first record of each second of the recording. Its
+* header carries the size of the file it describes, so that an index
+* of another file, or of one that was rewritten, is not used.
+*
+* Compressed files need no index: RD_skip() passes over the blocks
+* before the range by their headers. Their records are read with
+* RD_read() and written uncompressed.
+*/
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+
+#ifndef WIN32
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <err.h>
+#else
+#include <fcntl.h>       /* O_BINARY */
+#endif
+
+#include "sysdep.h"
+#include "rtpdump.h"
+#include "filter.h"
+
+#define SLICE_BUF       (1 << 20)  /* bytes read and written at once */
+#define INDEX_MAGIC     "#!rtpidx1.0\n"
+#define INDEX_INTERVAL  1000       /* ms between index entries */
+
+/* index entry, in network byte order */
+typedef struct {
+  uint32_t offset;       /* ms since the start of recording */
+  uint32_t pos[2];       /* position of the record, high and low word */
+} index_t;
+
+/* the input and the part of it in the buffer */
+static struct {
+  FILE *in;
+  char *name;
+  off_t pos;             /* position of buf[0] in the file */
+  size_t len;            /* bytes in buf */
+  size_t next;           /* start of the next record in buf */
+  unsigned char buf[SLICE_BUF];
+} r;
+
+/* records in buf from 'run' to r.next are yet to be written, if >= 0 */
+static long run = -1;
+static FILE *out;
+
+/* packets to copy, as with rtpdump -e */
+static filter_t filter;
+
+
+static void usage(char *argv0)
+{
+  fprintf(stderr, "usage: %s [-b begin] [-e end] [-m filter] "
+    "[-o outfile] file\n"
+    "       %s -I file\n", argv0, argv0);
+  exit(1);
+} /* usage */
+
+
+/*
+* Return whether record 'p', as in the file, passes the filter.
+*/
+static int slice_match(const unsigned char *p)
+{
+  int ctrl = p[2] == 0 && p[3] == 0;     /* plen 0: RTCP */
+  int len = ((p[0] << 8) | p[1]) - sizeof(RD_packet_t);
+
+  if (!filter.on) return 1;
+  return filter_match(&filter, ctrl,
+    (const char *)p + sizeof(RD_packet_t), len);
+} /* slice_match */
+
+
+static void write_out(const void *buf, size_t len)
+{
+  if (len && fwrite(buf, len, 1, out) != 1) err(1, "write");
+} /* write_out */
+
+
+/*
+* Write the records kept so far and end the run.
+*/
+static void flush_run(size_t end)
+{
+  if (run < 0) return;
+  write_out(r.buf + run, end - run);
+  run = -1;
+} /* flush_run */
+
+
+static size_t record_len(const unsigned char *p)
+{
+  return (p[0] << 8) | p[1];
+} /* record_len */
+
+
+/*
+* Return the next record in the buffer, refilling it as needed, or
+* NULL at the end of the file. A pending run is written before the
+* buffer moves and continues in the refilled buffer.
+*/
+static unsigned char *next_record(void)
+{
+  unsigned char *p;
+  size_t n;
+
+  if (r.len - r.next < sizeof(RD_packet_t) ||
+      r.len - r.next < record_len(r.buf + r.next)) {
+    int running = run >= 0;
+
+    flush_run(r.next);
+    memmove(r.buf, r.buf + r.next, r.len - r.next);
+    r.pos += r.next;
+    r.len -= r.next;
+    r.next = 0;
+    if (running) run = 0;
+    n = fread(r.buf + r.len, 1, sizeof(r.buf) - r.len, r.in);
+    if (n == 0 && ferror(r.in)) err(1, "%s", r.name);
+    r.len += n;
+    if (r.len < sizeof(RD_packet_t) || r.len < record_len(r.buf)) {
+      if (r.len > 0) warnx("%s: truncated record at end", r.name);
+      return NULL;
+    }
+  }
+  p = r.buf + r.next;
+  if (record_len(p) < sizeof(RD_packet_t))
+    errx(1, "%s: invalid record at %lld", r.name,
+      (long long)(r.pos + r.next));
+  r.next += record_len(p);
+  return p;
+} /* next_record */
+
+
+static uint32_t record_offset(const unsigned char *p)
+{
+  uint32_t offset;
+
+  memcpy(&offset, p + 4, sizeof(offset));
+  return ntohl(offset);
+} /* record_offset */
+
+
+/*
+* Position the input at 'pos' and empty the buffer.
+*/
+static void seek(off_t pos)
+{
+  if (fseeko(r.in, pos, SEEK_SET) != 0) err(1, "%s", r.name);
+  r.pos = pos;
+  r.len = r.next = 0;
+} /* seek */
+
+
+/*
+* Copy the records of compressed input from 'begin' to 'end' ms, with
+* the file header for 'sin' and 'start'.
+*/
+static void slice_blocks(struct sockaddr_in *sin, struct timeval *start,
+  uint32_t begin, uint32_t end)
+{
+  RD_buffer_t b;
+  RD_packet_t h;
+  int len;
+
+  if (RD_write_header(out, sin, start) < 0) err(1, "write");
+  if (RD_skip(r.in, begin) < 0) return;
+  while ((len = RD_read(r.in, &b)) > 0) {
+    if (b.p.hdr.offset > end) break;
+
+    /* back to the byte order of the file */
+    h = b.p.hdr;
+    b.p.hdr.length = htons(len + sizeof(h));
+    b.p.hdr.plen   = htons(h.plen);
+    b.p.hdr.offset = htonl(h.offset);
+    if (slice_match((unsigned char *)b.byte))
+      write_out(b.byte, len + sizeof(h));
+  }
+} /* slice_blocks */
+
+
+/*
+* Write the index of the input, positioned after the file header.
+*/
+static void index_write(off_t data)
+{
+  char name[1024];
+  FILE *f;
+  unsigned char *p;
+  index_t e;
+  uint32_t size[2];
+  int64_t last = -INDEX_INTERVAL;
+  off_t pos;
+
+  snprintf(name, sizeof(name), "%s.idx", r.name);
+  if (!(f = fopen(name, "wb"))) err(1, "%s", name);
+  memset(size, 0, sizeof(size));
+  if (fputs(INDEX_MAGIC, f) == EOF || fwrite(size, sizeof(size), 1, f) != 1)
+    err(1, "%s", name);
+  seek(data);
+  while ((p = next_record())) {
+    if ((int64_t)record_offset(p) < last + INDEX_INTERVAL) continue;
+    last = record_offset(p);
+    pos = r.pos + (p - r.buf);
+    e.offset = htonl(last);
+    e.pos[0] = htonl((uint64_t)pos >> 32);
+    e.pos[1] = htonl((uint64_t)pos & 0xffffffff);
+    if (fwrite(&e, sizeof(e), 1, f) != 1) err(1, "%s", name);
+  }
+
+  /* the size covered, written last, marks the index as complete */
+  pos = r.pos + r.next;
+  size[0] = htonl((uint64_t)pos >> 32);
+  size[1] = htonl((uint64_t)pos & 0xffffffff);
+  if (fseeko(f, strlen(INDEX_MAGIC), SEEK_SET) != 0 ||
+      fwrite(size, sizeof(size), 1, f) != 1 || fclose(f) == EOF)
+    err(1, "%s", name);
+} /* index_write */
+
+
+static off_t index_pos(const uint32_t *w)
+{
+  return (off_t)(((uint64_t)ntohl(w[0]) << 32) | ntohl(w[1]));
+} /* index_pos */
+
+
+/*
+* Return the position of a record at or before the first one at
+* 'begin' ms, using the index of the input, or -1 if there is no
+* usable index.
+*/
+static off_t index_find(uint32_t begin)
+{
+  char name[1024], magic[sizeof(INDEX_MAGIC)];
+  FILE *f;
+  uint32_t size[2];
+  index_t e, found;
+  unsigned char h[sizeof(RD_packet_t)];
+  off_t end, lo, hi, mid;
+  int have = 0;
+
+  snprintf(name, sizeof(name), "%s.idx", r.name);
+  if (!(f = fopen(name, "rb"))) return -1;
+  if (fread(magic, strlen(INDEX_MAGIC), 1, f) != 1 ||
+      memcmp(magic, INDEX_MAGIC, strlen(INDEX_MAGIC)) != 0 ||
+      fread(size, sizeof(size), 1, f) != 1 ||
+      fseeko(f, 0, SEEK_END) != 0 || (end = ftello(f)) < 0 ||
+      fseeko(r.in, 0, SEEK_END) != 0 || ftello(r.in) != index_pos(size)) {
+    warnx("%s: not an index of %s; ignored", name, r.name);
+    fclose(f);
+    return -1;
+  }
+
+  /* binary search for the last entry before 'begin' */
+  lo = 0;
+  hi = (end - strlen(INDEX_MAGIC) - sizeof(size)) / sizeof(e);
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (fseeko(f, strlen(INDEX_MAGIC) + sizeof(size) + mid * sizeof(e),
+        SEEK_SET) != 0 || fread(&e, sizeof(e), 1, f) != 1) break;
+    if (ntohl(e.offset) < begin) {
+      found = e;
+      have = 1;
+      lo = mid + 1;
+    }
+    else hi = mid;
+  }
+  fclose(f);
+  if (!have) return -1;
+
+  /* check that the entry points at a record of its time */
+  if (fseeko(r.in, index_pos(found.pos), SEEK_SET) != 0 ||
+      fread(h, sizeof(h), 1, r.in) != 1 ||
+      record_offset(h) != ntohl(found.offset)) {
+    warnx("%s: does not match %s; ignored", name, r.name);
+    return -1;
+  }
+  return index_pos(found.pos);
+} /* index_find */
+
+
+int main(int argc, char *argv[])
+{
+  struct sockaddr_in sin;
+  struct timeval start;
+  double b = 0, e = -1;
+  uint32_t begin, end;
+  off_t data, pos;
+  unsigned char *p;
+  int make_index = 0;
+  int c;
+  extern char *optarg;
+  extern int optind;
+
+  out = stdout;
+  while ((c = getopt(argc, argv, "b:e:Im:o:h")) != EOF) {
+    switch (c) {
+    case 'b':
+      b = atof(optarg);
+      break;
+    case 'e':
+      e = atof(optarg);
+      break;
+    case 'I':
+      make_index = 1;
+      break;
+    case 'm':
+      if (filter_parse(&filter, optarg)) usage(argv[0]);
+      break;
+    case 'o':
+      if (!(out = fopen(optarg, "wb"))) {
+        perror(optarg);
+        exit(1);
+      }
+      break;
+    case '?':
+    case 'h':
+      usage(argv[0]);
+      break;
+    }
+  }
+  if (optind != argc - 1 || b < 0 || (e >= 0 && e < b)) usage(argv[0]);
+  begin = b * 1000;
+  end = e < 0 || e * 1000 >= UINT32_MAX ? UINT32_MAX : (uint32_t)(e * 1000);
+
+#if defined(WIN32)
+  if (out == stdout) setmode(fileno(stdout), O_BINARY);
+#endif
+
+  r.name = argv[optind];
+  if (!(r.in = fopen(r.name, "rb"))) err(1, "%s", r.name);
+  memset(&sin, 0, sizeof(sin));
+  if ((c = getc(r.in)) != '#' || ungetc(c, r.in) == EOF ||
+      (c = RD_header(r.in, &sin, &start, 0)) < 0 || (data = ftello(r.in)) < 0)
+    errx(1, "%s: not a seekable rtpdump file", r.name);
+
+  if (c > 0) {
+    if (make_index) errx(1, "%s: compressed files need no index", r.name);
+    slice_blocks(&sin, &start, begin, end);
+    if (fclose(out) == EOF) err(1, "write");
+    return 0;
+  }
+  if (make_index) {
+    index_write(data);
+    return 0;
+  }
+
+  /* the header as it is */
+  seek(0);
+  r.len = fread(r.buf, 1, data, r.in);
+  if (r.len != (size_t)data) err(1, "%s", r.name);
+  write_out(r.buf, r.len);
+
+  pos = begin > 0 ? index_find(begin) : -1;
+  seek(pos >= 0 ? pos : data);
+  while ((p = next_record())) {
+    uint32_t offset = record_offset(p);
+
+    if (offset > end) {
+      flush_run(p - r.buf);
+      break;
+    }
+    if (offset >= begin && slice_match(p)) {
+      if (run < 0) run = p - r.buf;
+    }
+    else flush_run(p - r.buf);
+  }
+  flush_run(r.next);
+  if (fclose(out) == EOF) err(1, "write");
+  return 0;
+} /* main */
@@ -0,0 +1,451 @@
+/*
+ * (c) 1998-2018 by Columbia University; all rights reserved
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+* Statistics of the RTP sources in many rtpdump files: packets, loss,
+* duplicates, reordering, jitter and duration of each source in each
+* file, as with rtpdump -F stats, and totals, printed as text, CSV or
+* JSON. The files are independent, so they are analyzed in parallel by
+* a pool of threads, each taking the next file from the list. A file is
+* mapped into memory and its records are parsed in place; each file has
+* its own table of sources, and the report is printed from the tables
+* in the order of the files once all are done.
+*/
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+
+#ifndef WIN32
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <netinet/in.h>
+#include <err.h>
+#endif
+
+#include "sysdep.h"
+#include "rtp.h"
+#include "rtpdump.h"
+#include "stats.h"
+#include "lz.h"
+
+#if HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#define RD_MAGIC       "#!rtpplay1.0 "
+#define RD_BLOCK_MAGIC "#!rtpplay2.0 "  /* compressed */
+
+typedef struct {
+  char *name;
+  const char *error;   /* why the file could not be analyzed */
+  double duration;     /* from the first to the last record (s) */
+  stats_table_t t;
+} job_t;
+
+static job_t *jobs;
+static int njobs;
+static int next_job;   /* next file to analyze */
+
+#if HAVE_PTHREAD
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+enum {F_text, F_csv, F_json} format = F_text;
+
+
+static void usage(char *argv0)
+{
+  fprintf(stderr,
+    "usage: %s [-F text|csv|json] [-j jobs] [-o outfile] file ...\n", argv0);
+  exit(1);
+} /* usage */
+
+
+static uint32_t get32(const unsigned char *p)
+{
+  return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+} /* get32 */
+
+
+/*
+* Account the records from 'p' to 'end'; count them in 'records' and
+* keep the offsets of the first and last one. Return NULL, or why the
+* records could not all be read.
+*/
+static const char *analyze_records(job_t *j, const unsigned char *p,
+  const unsigned char *end, int *records, uint32_t *first, uint32_t *last)
+{
+  size_t len;
+
+  for (; end - p >= (long)sizeof(RD_packet_t); p += len) {
+    uint16_t plen = (p[2] << 8) | p[3];
+    uint32_t offset = get32(p + 4);
+
+    len = (p[0] << 8) | p[1];
+    if (len < sizeof(RD_packet_t) || len > (size_t)(end - p))
+      return "truncated or invalid record";
+    if (!(*records)++) *first = offset;
+    *last = offset;
+
+    /* RTP packets, with the header copied for alignment */
+    if (plen && len - sizeof(RD_packet_t) >= 12) {
+      rtp_hdr_t r;
+
+      memset(&r, 0, sizeof(r));
+      memcpy(&r, p + sizeof(RD_packet_t), 12);
+      if (r.version == RTP_VERSION)
+        stats_packet(&j->t, &r, plen, offset / 1000.);
+    }
+  }
+  return NULL;
+} /* analyze_records */
+
+
+/*
+* Account the records in the blocks of a compressed file, from 'p' to
+* 'end', as analyze_records().
+*/
+static const char *analyze_blocks(job_t *j, const unsigned char *p,
+  const unsigned char *end, int *records, uint32_t *first, uint32_t *last)
+{
+  unsigned char *block = malloc(RD_BLOCK_SIZE);
+  const char *error = NULL;
+
+  if (!block) return strerror(errno);
+  while (!error && end - p >= (long)sizeof(RD_block_hdr_t)) {
+    uint32_t clen = get32(p), ulen = get32(p + 4);
+    const unsigned char *data = p + sizeof(RD_block_hdr_t);
+
+    if (ulen > RD_BLOCK_SIZE || clen > ulen || clen > (size_t)(end - data)) {
+      error = "truncated or invalid block";
+      break;
+    }
+    if (clen == ulen)
+      error = analyze_records(j, data, data + ulen, records, first, last);
+    else if (lz_decompress(data, clen, block, ulen) != (int)ulen)
+      error = "invalid compressed block";
+    else
+      error = analyze_records(j, block, block + ulen, records, first, last);
+    p = data + clen;
+  }
+  free(block);
+  return error;
+} /* analyze_blocks */
+
+
+/*
+* Account the records of rtpdump file 'map' of 'len' bytes.
+*/
+static void analyze_map(job_t *j, const unsigned char *map, size_t len)
+{
+  const unsigned char *end = map + len, *eol;
+  uint32_t first = 0, last = 0;
+  int records = 0, compressed;
+
+  compressed = len >= strlen(RD_BLOCK_MAGIC) &&
+    memcmp(map, RD_BLOCK_MAGIC, strlen(RD_BLOCK_MAGIC)) == 0;
+  if (len < strlen(RD_MAGIC) ||
+      (!compressed && memcmp(map, RD_MAGIC, strlen(RD_MAGIC))) ||
+      !(eol = memchr(map, '\n', len)) ||
+      (size_t)(end - eol - 1) < sizeof(RD_hdr_t)) {
+    j->error = "not an rtpdump file";
+    return;
+  }
+  map = eol + 1 + sizeof(RD_hdr_t);
+  j->error = compressed ?
+    analyze_blocks(j, map, end, &records, &first, &last) :
+    analyze_records(j, map, end, &records, &first, &last);
+  j->duration = (last - first) / 1000.;
+} /* analyze_map */
+
+
+static void analyze(job_t *j)
+{
+#ifndef WIN32
+  struct stat st;
+  void *map;
+  int fd;
+
+  stats_init(&j->t);
+  if ((fd = open(j->name, O_RDONLY)) < 0) {
+    j->error = strerror(errno);
+    return;
+  }
+  if (fstat(fd, &st) < 0 || st.st_size == 0) {
+    j->error = st.st_size == 0 ? "not an rtpdump file" : strerror(errno);
+    close(fd);
+    return;
+  }
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    j->error = strerror(errno);
+    return;
+  }
+#ifdef MADV_SEQUENTIAL
+  madvise(map, st.st_size, MADV_SEQUENTIAL);
+#endif
+  analyze_map(j, map, st.st_size);
+  munmap(map, st.st_size);
+#else
+  FILE *f;
+  unsigned char *buf;
+  long len;
+
+  stats_init(&j->t);
+  if (!(f = fopen(j->name, "rb")) || fseek(f, 0, SEEK_END) != 0 ||
+      (len = ftell(f)) < 0 || fseek(f, 0, SEEK_SET) != 0 ||
+      !(buf = malloc(len ? len : 1)) ||
+      (len && fread(buf, len, 1, f) != 1)) {
+    j->error = strerror(errno);
+    if (f) fclose(f);
+    return;
+  }
+  fclose(f);
+  analyze_map(j, buf, len);
+  free(buf);
+#endif
+} /* analyze */
+
+
+/*
+* Analyze files from the list until there are none left.
+*/
+static void *worker(void *arg)
+{
+  int i;
+
+  for (;;) {
+#if HAVE_PTHREAD
+    pthread_mutex_lock(&lock);
+#endif
+    i = next_job++;
+#if HAVE_PTHREAD
+    pthread_mutex_unlock(&lock);
+#endif
+    if (i >= njobs) break;
+    analyze(&jobs[i]);
+  }
+  return NULL;
+} /* worker */
+
+
+/*
+* Print string 's' as a quoted CSV or JSON string.
+*/
+static void quote(FILE *out, const char *s)
+{
+  putc('"', out);
+  for (; *s; s++) {
+    if (*s == '"') fputs(format == F_csv ? "\"\"" : "\\\"", out);
+    else if (format == F_json && *s == '\\') fputs("\\\\", out);
+    else if (format == F_json && (unsigned char)*s < 0x20)
+      fprintf(out, "\\u%04x", *s);
+    else putc(*s, out);
+  }
+  putc('"', out);
+} /* quote */
+
+
+/*
+* Print source 's' of file 'j'.
+*/
+static void report_source(FILE *out, job_t *j, source_t *s, int first)
+{
+  long expected = stats_expected(s);
+  long lost = expected - (long)s->c.unique;
+  double loss = expected > 0 ? 100. * lost / expected : 0.;
+  double jitter = s->rate ? s->jitter * 1000. / s->rate : -1;
+  double duration = s->last - s->first;
+
+  switch (format) {
+  case F_text:
+    fprintf(out, "%s ssrc=0x%08lx pt=%d packets=%lu bytes=%lu lost=%ld "
+      "loss=%.2f%% dup=%lu reorder=%lu wraps=%lu", j->name,
+      (unsigned long)s->ssrc, s->pt, s->c.packets, s->c.bytes, lost, loss,
+      s->c.dups, s->c.reordered, s->c.wraps);
+    if (jitter >= 0) fprintf(out, " jitter=%.3fms", jitter);
+    else fprintf(out, " jitter=-");
+    fprintf(out, " duration=%.3fs\n", duration);
+    break;
+
+  case F_csv:
+    quote(out, j->name);
+    fprintf(out, ",0x%08lx,%d,%lu,%lu,%ld,%ld,%.2f,%lu,%lu,%lu,",
+      (unsigned long)s->ssrc, s->pt, s->c.packets, s->c.bytes, expected,
+      lost, loss, s->c.dups, s->c.reordered, s->c.wraps);
+    if (jitter >= 0) fprintf(out, "%.3f", jitter);
+    fprintf(out, ",%.3f\n", duration);
+    break;
+
+  case F_json:
+    fprintf(out, "%s\n      {\"ssrc\": %lu, \"pt\": %d, \"packets\": %lu, "
+      "\"bytes\": %lu, \"expected\": %ld, \"lost\": %ld, \"loss\": %.2f, "
+      "\"dup\": %lu, \"reorder\": %lu, \"wraps\": %lu, \"jitter_ms\": ",
+      first ? "" : ",", (unsigned long)s->ssrc, s->pt, s->c.packets,
+      s->c.bytes, expected, lost, loss, s->c.dups, s->c.reordered,
+      s->c.wraps);
+    if (jitter >= 0) fprintf(out, "%.3f", jitter);
+    else fprintf(out, "null");
+    fprintf(out, ", \"duration\": %.3f}", duration);
+    break;
+  }
+} /* report_source */
+
+
+/*
+* Print the statistics of all files and the totals. Return the number
+* of files that could not be analyzed.
+*/
+static int report(FILE *out)
+{
+  unsigned long sources = 0, packets = 0, bytes = 0;
+  long expected = 0, lost = 0;
+  int i, failed = 0;
+  source_t *s;
+
+  if (format == F_csv)
+    fprintf(out, "file,ssrc,pt,packets,bytes,expected,lost,loss,dup,"
+      "reorder,wraps,jitter_ms,duration\n");
+  if (format == F_json) fprintf(out, "{\n  \"files\": [");
+
+  for (i = 0; i < njobs; i++) {
+    job_t *j = &jobs[i];
+
+    if (j->error) {
+      warnx("%s: %s", j->name, j->error);
+      failed++;
+    }
+    if (format == F_json) {
+      fprintf(out, "%s\n    {\"file\": ", i ? "," : "");
+      quote(out, j->name);
+      if (j->error) {
+        fprintf(out, ", \"error\": ");
+        quote(out, j->error);
+      }
+      fprintf(out, ", \"duration\": %.3f, \"sources\": [", j->duration);
+    }
+    for (s = j->t.first; s; s = s->list) {
+      report_source(out, j, s, s == j->t.first);
+      sources++;
+      packets += s->c.packets;
+      bytes += s->c.bytes;
+      expected += stats_expected(s);
+      lost += stats_expected(s) - s->c.unique;
+    }
+    if (format == F_json) fprintf(out, "%s]}", j->t.first ? "\n    " : "");
+    stats_free(&j->t);
+  }
+
+  switch (format) {
+  case F_text:
+    fprintf(out, "total files=%d failed=%d sources=%lu packets=%lu "
+      "bytes=%lu lost=%ld loss=%.2f%%\n", njobs, failed, sources, packets,
+      bytes, lost, expected > 0 ? 100. * lost / expected : 0.);
+    break;
+  case F_csv:
+    break;
+  case F_json:
+    fprintf(out, "\n  ],\n  \"total\": {\"files\": %d, \"failed\": %d, "
+      "\"sources\": %lu, \"packets\": %lu, \"bytes\": %lu, "
+      "\"expected\": %ld, \"lost\": %ld, \"loss\": %.2f}\n}\n",
+      njobs, failed, sources, packets, bytes, expected, lost,
+      expected > 0 ? 100. * lost / expected : 0.);
+    break;
+  }
+  return failed;
+} /* report */
+
+
+int main(int argc, char *argv[])
+{
+  FILE *out = stdout;
+  int threads = 0;
+  int i, c;
+  extern char *optarg;
+  extern int optind;
+
+  while ((c = getopt(argc, argv, "F:j:o:h")) != EOF) {
+    switch (c) {
+    case 'F':
+      if (strcmp(optarg, "text") == 0) format = F_text;
+      else if (strcmp(optarg, "csv") == 0) format = F_csv;
+      else if (strcmp(optarg, "json") == 0) format = F_json;
+      else usage(argv[0]);
+      break;
+    case 'j':
+      if ((threads = atoi(optarg)) < 1) usage(argv[0]);
+      break;
+    case 'o':
+      if (!(out = fopen(optarg, "w"))) {
+        perror(optarg);
+        exit(1);
+      }
+      break;
+    case '?':
+    case 'h':
+      usage(argv[0]);
+      break;
+    }
+  }
+  njobs = argc - optind;
+  if (njobs < 1) usage(argv[0]);
+  if (!(jobs = calloc(njobs, sizeof(job_t)))) err(1, "can not analyze");
+  for (i = 0; i < njobs; i++) jobs[i].name = argv[optind + i];
+
+#if HAVE_PTHREAD
+  if (threads == 0) threads = sysconf(_SC_NPROCESSORS_ONLN);
+  if (threads > njobs) threads = njobs;
+  if (threads > 1) {
+    pthread_t *t = calloc(threads, sizeof(pthread_t));
+
+    if (!t) err(1, "can not analyze");
+    for (i = 0; i < threads; i++) {
+      if ((c = pthread_create(&t[i], NULL, worker, NULL)) != 0) {
+        errno = c;
+        err(1, "pthread_create");
+      }
+    }
+    for (i = 0; i < threads; i++) pthread_join(t[i], NULL);
+    free(t);
+  }
+  else
+#endif
+  worker(NULL);
+
+  if (report(out) || fclose(out) == EOF) return 1;
+  return 0;
+} /* main */
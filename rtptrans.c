@@ -37,6 +37,7 @@
 
 #ifndef WIN32
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/time.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -57,6 +58,7 @@ extern int hpt(char*, struct sockaddr_in*, unsigned char*);
 #define MAX_HOST 10
 
 static int debug = 0;
+static int merge = 0;   /* merge redundant legs into the last address */
 static int hostc = 0;
 static int multi_sock[3] = {0,0,0};
 static struct {
@@ -175,32 +177,549 @@ static int find_stream(int addr, int ts, int next, int m)
   return(create_stream(addr, next));
 }
 
-struct sdes_msg {
-  rtcp_common_t header;
-  struct rtcp_sdes sdes;
-};
+/*
+ * Translated RTCP compound packet (empty RR + SDES with CNAME and NAME)
+ * for one VAT source. The packet is built once and only rebuilt when
+ * the site string carried in the VAT ID message changes, so the RR SSRC
+ * stays the same for the lifetime of the source.
+ */
+#define VAT_SITE_MAX 255  /* SDES item length is a single octet */
+
+typedef struct vat_id {
+  uint32_t addr;               /* VAT source address (network order) */
+  uint32_t ssrc;               /* SSRC of the empty RR */
+  int site_len;                /* length of 'site' */
+  char site[VAT_SITE_MAX];     /* site string the packet was built from */
+  int len;                     /* length of 'rtcp' in bytes */
+  char rtcp[8 + 8 + 2 * (2 + VAT_SITE_MAX) + 4];  /* RR + SDES */
+  struct vat_id *next;
+} vat_id_t;
+
+static vat_id_t *vat_ids;      /* list of known VAT sources */
 
 /*
-* Handle file input events from network sockets.
-*/
-static Notify_value socket_handler(Notify_client client, int sock)
+ * Find the cached translation for VAT source 'addr', creating an empty
+ * entry with a fresh SSRC if the source has not been seen before.
+ * The entry found is moved to the head of the list.
+ */
+static vat_id_t *vat_id_find(uint32_t addr)
 {
+  vat_id_t *v, *prev = NULL;
+
+  for (v = vat_ids; v; prev = v, v = v->next) {
+    if (v->addr == addr) {
+      if (prev) {
+        prev->next = v->next;
+        v->next = vat_ids;
+        vat_ids = v;
+      }
+      return v;
+    }
+  }
+  v = (vat_id_t *)calloc(1, sizeof(vat_id_t));
+  if (v == NULL) {
+    perror("can not create a new VAT source");
+    exit(1);
+  }
+  v->addr = addr;
+  v->ssrc = rand();
+  v->site_len = -1;  /* force a build on first use */
+  v->next = vat_ids;
+  vat_ids = v;
+  return v;
+} /* vat_id_find */
+
+/*
+ * Build the RR+SDES packet for 'v' from the source address 'from'
+ * (used as CNAME) and the VAT site string (used as NAME).
+ */
+static void vat_id_build(vat_id_t *v, struct in_addr from,
+  const char *site, int site_len)
+{
+  rtcp_common_t *rr, *sdes;
+  rtcp_sdes_item_t *item;
+  const char *cname = inet_ntoa(from);
+  int cname_len = strlen(cname);
   int len;
+
+  memset(v->rtcp, 0, sizeof(v->rtcp));
+  memcpy(v->site, site, site_len);
+  v->site_len = site_len;
+
+  /* empty RR */
+  rr = (rtcp_common_t *)v->rtcp;
+  rr->version = RTP_VERSION;
+  rr->p       = 0;
+  rr->count   = 0;
+  rr->pt      = RTCP_RR;
+  rr->length  = htons((8 >> 2) - 1);
+  *(uint32_t *)(v->rtcp + 4) = v->ssrc;
+
+  /* SDES: CNAME is the source address, NAME is the site */
+  sdes = (rtcp_common_t *)(v->rtcp + 8);
+  *(uint32_t *)(v->rtcp + 12) = v->addr;
+  item = (rtcp_sdes_item_t *)(v->rtcp + 16);
+  item->type   = RTCP_SDES_CNAME;
+  item->length = cname_len;
+  memcpy(item->data, cname, cname_len);
+  item = (rtcp_sdes_item_t *)((char *)item + cname_len + 2);
+  item->type   = RTCP_SDES_NAME;
+  item->length = site_len;
+  memcpy(item->data, site, site_len);
+
+  /* SDES chunk plus at least one zero octet for the end marker */
+  len = 8 + 2 + cname_len + 2 + site_len;
+  len = ((len / 4) * 4) + 4;
+  sdes->version = RTP_VERSION;
+  sdes->p       = 0;
+  sdes->count   = 1;
+  sdes->pt      = RTCP_SDES;
+  sdes->length  = htons((len >> 2) - 1);
+
+  v->len = 8 + len;
+} /* vat_id_build */
+
+/*
+ * Redundant-feed merging: the same RTP streams arrive on several legs
+ * and only the first copy of each (SSRC, sequence number) is forwarded.
+ * For each SSRC we keep the highest sequence number seen, the leg it
+ * came from and a bitmap of the MERGE_WINDOW sequence numbers up to and
+ * including it. A packet from another leg that is behind the window
+ * was forwarded long ago by the leading leg and is dropped as late.
+ */
+#define MERGE_WINDOW  1024                /* must be a multiple of 32 */
+#define MERGE_WORDS   (MERGE_WINDOW / 32)
+#define MERGE_BUCKETS 256                 /* must be power of 2 */
+
+typedef struct merge_src {
+  uint32_t ssrc;
+  uint16_t max;                  /* highest sequence number seen */
+  int leg;                       /* leg that delivered max */
+  uint32_t seen[MERGE_WORDS];    /* bit for each sequence number in window */
+  struct merge_src *next;        /* hash chain */
+} merge_src_t;
+
+static merge_src_t *merge_table[MERGE_BUCKETS];
+
+static struct {
+  unsigned long forwarded;       /* first copies forwarded from this leg */
+  unsigned long duplicates;      /* copies dropped */
+  unsigned long late;            /* dropped as behind the window */
+} merge_stats[MAX_HOST];
+
+#define MERGE_BIT(m, seq) \
+  ((m)->seen[((seq) % MERGE_WINDOW) >> 5] & (1u << ((seq) & 31)))
+#define MERGE_SET(m, seq) \
+  ((m)->seen[((seq) % MERGE_WINDOW) >> 5] |= (1u << ((seq) & 31)))
+#define MERGE_CLR(m, seq) \
+  ((m)->seen[((seq) % MERGE_WINDOW) >> 5] &= ~(1u << ((seq) & 31)))
+
+/*
+ * Return 1 if the RTP packet 'seq' of source 'ssrc' that arrived on
+ * 'leg' has not been seen before and should be forwarded, 0 if it is a
+ * duplicate, -1 if it is too far behind the window to tell.
+ */
+static int merge_first(uint32_t ssrc, uint16_t seq, int leg)
+{
+  merge_src_t *m;
+  int delta;
+  unsigned h = (ssrc ^ (ssrc >> 16)) & (MERGE_BUCKETS - 1);
+
+  for (m = merge_table[h]; m; m = m->next) {
+    if (m->ssrc == ssrc) break;
+  }
+  if (!m) {
+    m = (merge_src_t *)calloc(1, sizeof(merge_src_t));
+    if (m == NULL) {
+      perror("can not create a new merge source");
+      exit(1);
+    }
+    m->ssrc = ssrc;
+    m->max  = seq;
+    m->leg  = leg;
+    m->next = merge_table[h];
+    merge_table[h] = m;
+    MERGE_SET(m, seq);
+    return 1;
+  }
+
+  delta = (int16_t)(seq - m->max);
+  if (delta > 0) {
+    /* advance window, forgetting the sequence numbers that fall out */
+    if (delta >= MERGE_WINDOW) {
+      memset(m->seen, 0, sizeof(m->seen));
+    }
+    else {
+      uint16_t s;
+
+      for (s = m->max + 1; s != seq; s++) {
+        if ((s & 31) == 0 && (uint16_t)(seq - s) >= 32) {
+          m->seen[(s % MERGE_WINDOW) >> 5] = 0;
+          s += 31;
+        }
+        else MERGE_CLR(m, s);
+      }
+    }
+    m->max = seq;
+    m->leg = leg;
+    MERGE_SET(m, seq);
+    return 1;
+  }
+  if (-delta >= MERGE_WINDOW) {
+    /* from another leg, a lagging copy; from the leading one, a restart */
+    if (leg != m->leg) return -1;
+    memset(m->seen, 0, sizeof(m->seen));
+    m->max = seq;
+    MERGE_SET(m, seq);
+    return 1;
+  }
+  if (MERGE_BIT(m, seq)) return 0;
+  MERGE_SET(m, seq);
+  return 1;
+} /* merge_first */
+
+
+/*
+ * Print the number of packets each leg contributed.
+ */
+static void merge_report(FILE *out)
+{
+  int i;
+
+  for (i = 0; i < hostc - 1; i++) {
+    fprintf(out, "leg %d: %lu forwarded, %lu duplicates, %lu late\n", i,
+      merge_stats[i].forwarded, merge_stats[i].duplicates,
+      merge_stats[i].late);
+  }
+} /* merge_report */
+
+
+/*
+ * Per-destination send queues. Send sockets are non-blocking; when the
+ * kernel cannot take a packet, it is queued and the queue is drained
+ * from an output handler once the socket becomes writable, so a slow
+ * destination does not hold up the others. The queue is bounded; when
+ * it is full, either the oldest queued or the new packet is dropped.
+ */
+typedef struct qpkt {
+  struct qpkt *next;
+  int proto;                   /* 0: RTP port, 1: RTCP port */
+  int len;
+  char data[1];
+} qpkt_t;
+
+static struct {
+  qpkt_t *head, *tail;
+  int n;                       /* packets in queue */
+  unsigned long sent;          /* packets handed to the kernel */
+  unsigned long queued;        /* packets that had to wait */
+  unsigned long dropped;       /* packets lost to overflow or errors */
+} dest_q[MAX_HOST];
+
+static int queue_max = 64;     /* maximum queue length, in packets */
+static int drop_oldest = 1;    /* on overflow, drop oldest (1) or new (0) */
+
+/*
+ * Only a full socket buffer waits for the socket to become writable.
+ * ENOBUFS (a full device queue) leaves it writable, so waiting would
+ * spin; the packet is dropped instead.
+ */
+#ifdef WIN32
+#define SEND_BLOCKED() (WSAGetLastError() == WSAEWOULDBLOCK)
+#else
+#define SEND_BLOCKED() (errno == EAGAIN || errno == EWOULDBLOCK)
+#endif
+
+/*
+ * Put the send socket of host 'i' into non-blocking mode.
+ */
+static void dest_nonblock(int i)
+{
+#ifdef WIN32
+  u_long on = 1;
+
+  if (ioctlsocket(side[i][2].sock, FIONBIO, &on) != 0)
+    fprintf(stderr, "ioctlsocket(FIONBIO): %d\n", WSAGetLastError());
+#else
+  int flags = fcntl(side[i][2].sock, F_GETFL, 0);
+
+  if (flags == -1 ||
+      fcntl(side[i][2].sock, F_SETFL, flags | O_NONBLOCK) == -1)
+    perror("fcntl: O_NONBLOCK");
+#endif
+} /* dest_nonblock */
+
+static void dest_pop(int i)
+{
+  qpkt_t *q = dest_q[i].head;
+
+  dest_q[i].head = q->next;
+  if (!dest_q[i].head) dest_q[i].tail = NULL;
+  dest_q[i].n--;
+  free(q);
+} /* dest_pop */
+
+/*
+ * Output handler: send queued packets for host 'client' until the
+ * socket would block again or the queue is empty.
+ */
+static Notify_value dest_drain(Notify_client client)
+{
+  int i = (int)client;
+  qpkt_t *q;
+
+  while ((q = dest_q[i].head)) {
+    if (sendto(side[i][2].sock, q->data, q->len, 0,
+        (struct sockaddr *)&side[i][q->proto].sin,
+        sizeof(side[i][q->proto].sin)) < 0) {
+      if (SEND_BLOCKED()) return NOTIFY_DONE;
+      perror("sendto");
+      dest_q[i].dropped++;
+    }
+    else dest_q[i].sent++;
+    dest_pop(i);
+  }
+  notify_set_output_func(client, NOTIFY_FUNC_NULL, side[i][2].sock);
+  return NOTIFY_DONE;
+} /* dest_drain */
+
+/*
+ * Send packet 'buf' of length 'len' to the RTP (proto 0) or RTCP
+ * (proto 1) address of host 'i', queueing it if the socket is full.
+ * This calls sendto() rather than notify_send(): a send queued with
+ * io_uring would be reported full only after the fact, past the queue
+ * and its drop policy.
+ */
+static void dest_send(int i, int proto, const char *buf, int len)
+{
+  qpkt_t *q;
+
+  /* keep packet order: only bypass the queue when it is empty */
+  if (!dest_q[i].head) {
+    if (sendto(side[i][2].sock, buf, len, 0,
+        (struct sockaddr *)&side[i][proto].sin,
+        sizeof(side[i][proto].sin)) >= 0) {
+      dest_q[i].sent++;
+      return;
+    }
+    if (!SEND_BLOCKED()) {
+      perror("sendto");
+      dest_q[i].dropped++;
+      return;
+    }
+  }
+
+  if (dest_q[i].n >= queue_max) {
+    dest_q[i].dropped++;
+    if (!drop_oldest || !dest_q[i].head) return;
+    dest_pop(i);
+  }
+  q = (qpkt_t *)malloc(sizeof(qpkt_t) + len);
+  if (!q) {
+    dest_q[i].dropped++;
+    return;
+  }
+  q->next  = NULL;
+  q->proto = proto;
+  q->len   = len;
+  memcpy(q->data, buf, len);
+  if (dest_q[i].tail) dest_q[i].tail->next = q;
+  else {
+    dest_q[i].head = q;
+    notify_set_output_func((Notify_client)i, dest_drain, side[i][2].sock);
+  }
+  dest_q[i].tail = q;
+  dest_q[i].n++;
+  dest_q[i].queued++;
+} /* dest_send */
+
+
+/*
+ * Print per-destination send counters.
+ */
+static void dest_report(FILE *out)
+{
+  int i;
+
+  for (i = 0; i < hostc; i++) {
+    fprintf(out, "host %d: %lu sent, %lu queued, %lu dropped\n", i,
+      dest_q[i].sent, dest_q[i].queued, dest_q[i].dropped);
+  }
+} /* dest_report */
+
+
+static Notify_value done(Notify_client client, int sig,
+  Notify_signal_mode mode)
+{
+  if (merge) merge_report(stderr);
+  dest_report(stderr);
+  notify_stats_report();
+  exit(0);
+  return NOTIFY_DONE;
+} /* done */
+
+
+/*
+ * Selective routing: rules map an SSRC or an RTP payload type to the set
+ * of addresses (as a bit mask of host indices) a packet is forwarded to.
+ * SSRC rules are kept in an array sorted by SSRC for binary search;
+ * payload type rules are a direct table. SSRC rules take precedence.
+ */
+#define ROUTE_SET 0x80000000u  /* marks a payload type entry as present */
+
+typedef struct {
+  uint32_t ssrc;
+  unsigned int dest;           /* bit i set: forward to host i */
+} route_t;
+
+static int routing = 0;        /* rules have been loaded */
+static route_t *routes;        /* SSRC rules, sorted by ssrc */
+static int routec;             /* number of SSRC rules */
+static unsigned int route_pt[128];     /* payload type rules */
+static unsigned int route_default = ~0u;
+
+static int route_cmp(const void *a, const void *b)
+{
+  uint32_t x = ((const route_t *)a)->ssrc, y = ((const route_t *)b)->ssrc;
+
+  return x < y ? -1 : x > y;
+} /* route_cmp */
+
+/*
+ * Load routing rules from 'file'. Each line has the form
+ *   ssrc <ssrc> <host> ...
+ *   pt <payload type> <host> ...
+ *   default <host> ...
+ * where <host> is the index of an address on the command line,
+ * counting from 0. A rule without hosts drops matching packets.
+ * Text after '#' is ignored. Exit on error.
+ */
+static void route_load(const char *file)
+{
+  FILE *f;
+  char line[1024];
+  int lineno = 0;
+  int size = 0;
+  int i;
+
+  if (!(f = fopen(file, "r"))) {
+    perror(file);
+    exit(1);
+  }
+  while (fgets(line, sizeof(line), f)) {
+    char *word, *end;
+    char *key = NULL;
+    unsigned long value = 0;
+    unsigned int dest = 0;
+
+    lineno++;
+    if ((end = strchr(line, '#'))) *end = '\0';
+    if (!(key = strtok(line, " \t\r\n"))) continue;
+    if (strcmp(key, "ssrc") == 0 || strcmp(key, "pt") == 0) {
+      errno = 0;
+      if ((word = strtok(NULL, " \t\r\n")))
+        value = strtoul(word, &end, 0);
+      if (!word || *end || errno || *word == '-' ||
+          value > (key[0] == 'p' ? 127 : 0xffffffffUL)) {
+        fprintf(stderr, "%s:%d: invalid %s\n", file, lineno, key);
+        exit(1);
+      }
+    }
+    else if (strcmp(key, "default") != 0) {
+      fprintf(stderr, "%s:%d: unknown rule %s\n", file, lineno, key);
+      exit(1);
+    }
+    while ((word = strtok(NULL, " \t\r\n"))) {
+      i = strtol(word, &end, 10);
+      if (*end || i < 0 || i >= hostc) {
+        fprintf(stderr, "%s:%d: invalid host index %s\n",
+          file, lineno, word);
+        exit(1);
+      }
+      dest |= 1u << i;
+    }
+
+    if (key[0] == 'd') {
+      route_default = dest;
+    }
+    else if (key[0] == 'p') {
+      route_pt[value] = dest | ROUTE_SET;
+    }
+    else {
+      if (routec == size) {
+        size = size ? 2 * size : 64;
+        routes = (route_t *)realloc(routes, size * sizeof(route_t));
+        if (!routes) {
+          perror("route_load");
+          exit(1);
+        }
+      }
+      routes[routec].ssrc = value;
+      routes[routec].dest = dest;
+      routec++;
+    }
+  }
+  fclose(f);
+
+  qsort(routes, routec, sizeof(route_t), route_cmp);
+  for (i = 1; i < routec; i++) {
+    if (routes[i].ssrc == routes[i-1].ssrc) {
+      fprintf(stderr, "%s: duplicate rule for ssrc 0x%08lx\n",
+        file, (unsigned long)routes[i].ssrc);
+      exit(1);
+    }
+  }
+  routing = 1;
+} /* route_load */
+
+/*
+ * Return the set of hosts the packet in 'packet' should be sent to.
+ * RTCP packets are routed by the sender SSRC of the first report.
+ * Packets too short for that or not of RTP version 2 follow the
+ * default rule.
+ */
+static unsigned int route_lookup(char *packet, int len, int proto)
+{
+  rtp_hdr_t *r = (rtp_hdr_t *)packet;
+  uint32_t ssrc;
+  int lo, hi, mid;
+
+  if (!routing) return ~0u;
+  if (len < (proto == 0 ? 12 : 8) || r->version != RTP_VERSION)
+    return route_default;
+  ssrc = proto == 0 ? ntohl(r->ssrc) : ntohl(((rtcp_t *)packet)->r.rr.ssrc);
+
+  lo = 0;
+  hi = routec - 1;
+  while (lo <= hi) {
+    mid = (lo + hi) / 2;
+    if (routes[mid].ssrc == ssrc) return routes[mid].dest;
+    if (routes[mid].ssrc < ssrc) lo = mid + 1;
+    else hi = mid - 1;
+  }
+  if (proto == 0 && (route_pt[r->pt] & ROUTE_SET))
+    return route_pt[r->pt] & ~ROUTE_SET;
+  return route_default;
+} /* route_lookup */
+
+
+/*
+* Handle packets received from network sockets.
+*/
+static Notify_value socket_handler(Notify_client client, int sock,
+  char *packet, int len, struct sockaddr_in *from)
+{
   int proto;
-  struct sockaddr_in sin_from;
-  socklen_t addr_len;
-  char packet[8192];
+  struct sockaddr_in sin_from = *from;
   int i;
   const int VAT_LEN=8;
   vat_hdr_t *vat_hdr;
   rtp_hdr_t *rtp_hdr;
   rtp_hdr_t rtp_hdr_send;
+  int leg;
 
   proto = ((int)client & 1);
-  /* Read packet data from socket. */
-  addr_len = sizeof(sin_from);
-  len = recvfrom(sock, packet, sizeof(packet), 0,
-        (struct sockaddr *)&sin_from, &addr_len);
+  leg   = ((int)client >> 1);
   rtp_hdr=(rtp_hdr_t *)packet;
   if (debug) {
     struct timeval now;
@@ -213,25 +732,38 @@ static Notify_value socket_handler(Notify_client client, int sock)
       inet_ntoa(sin_from.sin_addr), ntohs(sin_from.sin_port));
   }
 
+  /* redundant legs only feed the last address; drop repeated RTP */
+  if (merge && leg < hostc - 1) {
+    if (proto == 0 && len >= 12 && rtp_hdr->version == RTP_VERSION) {
+      int first = merge_first(ntohl(rtp_hdr->ssrc), ntohs(rtp_hdr->seq), leg);
+
+      if (first <= 0) {
+        if (first < 0) merge_stats[leg].late++;
+        else merge_stats[leg].duplicates++;
+        return NOTIFY_DONE;
+      }
+      merge_stats[leg].forwarded++;
+    }
+    dest_send(hostc - 1, proto, packet, len);
+    return NOTIFY_DONE;
+  }
+
   /* do not translate packets that already use RTP or arrive over the unicast
    link*/
   if ((rtp_hdr->version==2)||((sock!=multi_sock[0])&&(sock!=multi_sock[1]))) {
+    unsigned int dest = route_lookup(packet, len, proto);
+
     rtp_hdr=(rtp_hdr_t *)packet;
     for (i = 0; i < hostc; i++) {
-      if (side[i][proto].sock != sock
+      if ((dest & (1u << i))
+          && side[i][proto].sock != sock
           && side[i][proto].sin.sin_addr.s_addr != INADDR_ANY) {
-        if (sendto(side[i][2].sock, packet, len, 0,
-        (struct sockaddr *)&side[i][proto].sin,
-	sizeof(side[i][proto].sin)) == -1) {
-		perror("sendto RTPC");
-	}
+        dest_send(i, proto, packet, len);
       }
     }
   }
   else {
-    struct msghdr msg;
     if (!proto) { /* translate VAT packets */
-      struct iovec iov[2];
       char type;
       int samples = len-VAT_LEN;
       vat_hdr=(vat_hdr_t *)packet;
@@ -278,11 +810,9 @@ static Notify_value socket_handler(Notify_client client, int sock)
       rtp_hdr_send.cc      = 0;
       rtp_hdr_send.ts      = vat_hdr->ts;
 
-#if WIN32
-      /* Windows does not support sendmsg(), use copying instead;
-       * contributed by Lutz Grueneberg <gruen@rvs.uni-hannover.de>. */
+      /* assemble once, then send (or queue) for every destination */
       {
-        unsigned char mbuf[10000];
+        char mbuf[sizeof(rtp_hdr_t) - 4 + NOTIFY_RECV_MAX];
         int mlength = 0;
         memcpy (&mbuf[mlength], (char *)&(rtp_hdr_send), sizeof(rtp_hdr_t)-4);
         mlength += sizeof(rtp_hdr_t)-4;
@@ -290,95 +820,32 @@ static Notify_value socket_handler(Notify_client client, int sock)
         mlength += len-VAT_LEN;
         for (i = 0; i < hostc; i++) {
           if (side[i][proto].sock != sock) {
-            if (sendto(side[i][2].sock, mbuf, mlength, 0,
-                        &(side[i][proto].sin), sizeof(side[i][proto].sin))!=
-                mlength)
-              perror("sendmsg RTCP");
+            dest_send(i, proto, mbuf, mlength);
           }
         }
       }
-#else
-      iov[0].iov_base = (char *)&(rtp_hdr_send);
-      iov[0].iov_len = sizeof(rtp_hdr_t)-4;
-      iov[1].iov_base = packet+VAT_LEN;
-      iov[1].iov_len = len-VAT_LEN;
-      msg.msg_iov = iov;
-      msg.msg_iovlen = 2;
-      for (i = 0; i < hostc; i++) {
-        if (side[i][proto].sock != sock) {
-          msg.msg_name = (char*) &side[i][proto].sin;
-          msg.msg_namelen = sizeof(side[i][proto].sin);
-#if HAVE_MSGCONTROL
-          msg.msg_control = 0;
-          msg.msg_controllen = 0;
-#else
-          msg.msg_accrights = 0;
-          msg.msg_accrightslen = 0;
-#endif
-          if ((sendmsg(side[i][2].sock, &msg,0))!=
-            iov[0].iov_len +iov[1].iov_len)
-            perror("sendmsg RTCP");
-          }
-       }
-#endif /* WIN32 */
     }
     else if (((struct CtrlMsgHdr *)packet)->type == 1) /* vat ID messages */{
-      rtcp_t *rtcp_msg;
-      struct sdes_msg *ctl_msg;
-      rtcp_sdes_item_t *item;
-      int len=0;
-      int length;
-      item=NULL;
-
-      /* total length of the packet = IP address+ site entry of vat+ 2 type+ 2
-        length + 4 common header+ 4 ssrc + 8 empty RR */
-      length = strlen(inet_ntoa(sin_from.sin_addr)) +
-        strlen(packet+sizeof(struct CtrlMsgHdr)) + 12 + 8;
-      length = ((length/4)*4)+4;
-      rtcp_msg=(rtcp_t *)malloc(length);
-      memset(rtcp_msg,0,length);
-
-      /* init RR */
-      rtcp_msg->common.version=2;
-      rtcp_msg->common.p=0;
-      rtcp_msg->common.count=0;
-      rtcp_msg->common.pt=RTCP_RR;
-      rtcp_msg->r.rr.ssrc = rand();
-      rtcp_msg->common.length=(8 >> 2) - 1;
-
-      ctl_msg=(struct sdes_msg *)&rtcp_msg->r.rr.rr[0];
-      item=( rtcp_sdes_item_t *) ((char *)ctl_msg+8);
-      /* init CNAME */
-      item->type=1;
-      strcpy(item->data,inet_ntoa(sin_from.sin_addr));
-      item->length=strlen(item->data);
-      len=item->length+2;
-
-      item=(rtcp_sdes_item_t *)((char *)item +len);
-      /* init NAME */
-      strcpy(item->data,packet+sizeof(struct CtrlMsgHdr));
-      item->length=strlen(item->data);
-      item->type=2;
-      len+=item->length+2;
-
-
-      ctl_msg->header.version=2;
-      ctl_msg->header.p=0;
-      ctl_msg->header.count=1;
-      ctl_msg->header.pt=202;
-      ctl_msg->sdes.src=sin_from.sin_addr.s_addr;
-      ctl_msg->header.length=((length-8) >> 2) - 1;
+      vat_id_t *v;
+      char *site = packet + sizeof(struct CtrlMsgHdr);
+      char *eos;
+      int site_len;
+
+      /* site string is NUL-terminated, but do not trust it to be */
+      site_len = len - (int)sizeof(struct CtrlMsgHdr);
+      if (site_len < 0) site_len = 0;
+      if ((eos = memchr(site, '\0', site_len))) site_len = eos - site;
+      if (site_len > VAT_SITE_MAX) site_len = VAT_SITE_MAX;
+
+      v = vat_id_find(sin_from.sin_addr.s_addr);
+      if (v->site_len != site_len || memcmp(v->site, site, site_len) != 0)
+        vat_id_build(v, sin_from.sin_addr, site, site_len);
 
       for (i = 0; i < hostc; i++) {
         if (side[i][proto].sock != sock) {
-          if (sendto(side[i][2].sock,(char *)rtcp_msg,
-             ((rtcp_msg->common.length+1)+(ctl_msg->header.length+1))*4,
-             0, (struct sockaddr *)&side[i][proto].sin,
-             sizeof(side[i][proto].sin)) < 0)
-          perror("sendto RTCP");
+          dest_send(i, proto, v->rtcp, v->len);
         }
       }
-      free(rtcp_msg);
     }/* control messages */
   }
   return NOTIFY_DONE;
@@ -387,8 +854,9 @@ static Notify_value socket_handler(Notify_client client, int sock)
 
 static void usage(char *argv0)
 {
-  fprintf(stderr, "usage: %s address/port[/ttl] address/port[/ttl] [...]\n",
-	argv0);
+  fprintf(stderr, "usage: %s [-dm] [-Q oldest|newest] [-q packets] "
+	"[-r rules] [-S seconds] [-U]\n"
+	"\taddress/port[/ttl] address/port[/ttl] [...]\n", argv0);
 }
 
 int main(int argc, char *argv[])
@@ -401,7 +869,11 @@ int main(int argc, char *argv[])
     struct ip_mreq mreq;
   } host[MAX_HOST];
   struct sockaddr_in sin;   /* generic bind */
+  extern char *optarg;
   extern int optind;
+  char *rules = NULL;  /* routing rules file */
+  int stats = -1;      /* seconds between loop statistics */
+  int uring = 0;       /* receive through io_uring */
   char loop = 0;  /* multicast loop */
   int reuse = 1;  /* reuse address */
   int i, j;
@@ -409,11 +881,42 @@ int main(int argc, char *argv[])
 
   /* Set up socket. */
   startupSocket();
-  while ((c = getopt(argc, argv, "d?h")) != EOF) {
+  while ((c = getopt(argc, argv, "dmQ:q:r:S:U?h")) != EOF) {
     switch(c) {
     case 'd':
       debug = 1;
       break;
+    case 'm':
+      merge = 1;
+      break;
+    case 'Q':
+      if (strcmp(optarg, "oldest") == 0) drop_oldest = 1;
+      else if (strcmp(optarg, "newest") == 0) drop_oldest = 0;
+      else {
+        usage(argv[0]);
+        exit(1);
+      }
+      break;
+    case 'q':
+      queue_max = atoi(optarg);
+      if (queue_max < 0) {
+        usage(argv[0]);
+        exit(1);
+      }
+      break;
+    case 'r':
+      rules = optarg;
+      break;
+    case 'S':
+      stats = atoi(optarg);
+      if (stats < 0) {
+        usage(argv[0]);
+        exit(1);
+      }
+      break;
+    case 'U':
+      uring = 1;
+      break;
     case '?':
     case 'h':
       usage(argv[0]);
@@ -422,6 +925,12 @@ int main(int argc, char *argv[])
     }
   }
 
+  /* Merged packets all go to the last address; there is nothing to route. */
+  if (rules && merge) {
+    fprintf(stderr, "%s: -r can not be used with -m\n", argv[0]);
+    exit(1);
+  }
+
   if (argc - optind < 2) {
     usage(argv[0]);
     exit(1);
@@ -434,8 +943,7 @@ int main(int argc, char *argv[])
 
     host[i].ttl  = 16;
     host[i].name = argv[optind+i];
-    if (hpt(host[i].name, (struct sockaddr_in*) &host[i].sin.sin_addr,
-    &host[i].ttl) == -1) {
+    if (hpt(host[i].name, &host[i].sin, &host[i].ttl) == -1) {
       fprintf(stderr, "Invalid host specification %s\n", host[i].name);
       usage(argv[0]);
       exit(1);
@@ -448,6 +956,10 @@ int main(int argc, char *argv[])
     hostc++;
   }
 
+  if (rules) route_load(rules);
+  if (uring && !notify_uring())
+    fprintf(stderr, "%s: io_uring not available\n", argv[0]);
+
   /* Create/bind sockets. */
   for (i = 0; i < hostc; i++) { /* hosts (unicast or multicast) */
     for (j = 0; j < 3; j++) { /* receive ports (RTP, RTCP), send */
@@ -510,12 +1022,20 @@ again:
         }
       }
       if (j < 2) {
-        notify_set_input_func((Notify_client)j, socket_handler,
-          side[i][j].sock);
+        /* client encodes host index and protocol */
+        notify_set_recv_func((Notify_client)((i << 1) | j),
+          socket_handler, side[i][j].sock);
+      }
+      else {
+        dest_nonblock(i);
       }
     } /* for j (protocols) */
   } /* for i (hosts) */
 
+  notify_set_signal_func(0, done, SIGINT, NOTIFY_ASYNC);
+  notify_set_signal_func(0, done, SIGTERM, NOTIFY_ASYNC);
+  if (stats >= 0) notify_stats(stats);
+
   if ((c = notify_start()) != NOTIFY_OK) {
     fprintf(stderr, "%s: Notifier error %d.\n", argv[0], c);
     perror("select");
@@ -0,0 +1,232 @@
+/*
+ * (c) 1998-2018 by Columbia University; all rights reserved
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#ifndef WIN32
+#include <netinet/in.h>
+#endif
+
+#include "rtp.h"
+#include "payload.h"
+#include "stats.h"
+
+extern struct pt payload[];
+
+#define MAX_DROPOUT   3000
+#define MAX_MISORDER  100
+#define RTP_SEQ_MOD   (1 << 16)
+
+#define STATS_BIT(s, seq) \
+  ((s)->seen[((seq) % STATS_WINDOW) >> 5] & (1u << ((seq) & 31)))
+#define STATS_SET(s, seq) \
+  ((s)->seen[((seq) % STATS_WINDOW) >> 5] |= (1u << ((seq) & 31)))
+#define STATS_CLR(s, seq) \
+  ((s)->seen[((seq) % STATS_WINDOW) >> 5] &= ~(1u << ((seq) & 31)))
+
+/*
+* Return the clock rate of payload type 'pt', 0 if unknown. The table
+* ends before the dynamic payload types.
+*/
+static unsigned pt_rate(int pt)
+{
+  int i;
+
+  for (i = 0; i <= pt; i++) {
+    if (!payload[i].enc) return 0;
+  }
+  return pt >= 0 ? payload[pt].rate : 0;
+} /* pt_rate */
+
+
+void stats_init(stats_table_t *t)
+{
+  memset(t, 0, sizeof(*t));
+  t->last = &t->first;
+} /* stats_init */
+
+
+void stats_free(stats_table_t *t)
+{
+  source_t *s, *next;
+
+  for (s = t->first; s; s = next) {
+    next = s->list;
+    free(s);
+  }
+  stats_init(t);
+} /* stats_free */
+
+
+/*
+* In 's->c.expected', only the runs of sequence numbers before the
+* current one are counted.
+*/
+unsigned long stats_expected(source_t *s)
+{
+  if (!s->c.unique) return 0;
+  return s->c.expected + s->cycles + s->max_seq - s->base_seq + 1;
+} /* stats_expected */
+
+
+/*
+* Start a new run of sequence numbers at 'seq'.
+*/
+static void stats_init_seq(source_t *s, uint16_t seq)
+{
+  s->c.expected = stats_expected(s);
+  s->base_seq = seq;
+  s->max_seq  = seq;
+  s->bad_seq  = RTP_SEQ_MOD + 1;
+  s->cycles   = 0;
+  memset(s->seen, 0, sizeof(s->seen));
+  STATS_SET(s, seq);
+} /* stats_init_seq */
+
+
+/*
+* Look up source 'ssrc', creating it if necessary.
+*/
+static source_t *stats_source(stats_table_t *t, uint32_t ssrc)
+{
+  source_t *s;
+  unsigned h = (ssrc ^ (ssrc >> 16)) & (STATS_BUCKETS - 1);
+
+  for (s = t->table[h]; s; s = s->next) {
+    if (s->ssrc == ssrc) return s;
+  }
+  if (!(s = (source_t *)calloc(1, sizeof(source_t)))) {
+    perror("can not create a new source");
+    exit(1);
+  }
+  s->ssrc = ssrc;
+  s->pt   = -1;
+  s->next = t->table[h];
+  t->table[h] = s;
+  *t->last = s;
+  t->last  = &s->list;
+  return s;
+} /* stats_source */
+
+
+void stats_packet(stats_table_t *t, rtp_hdr_t *r, int len, double now)
+{
+  source_t *s = stats_source(t, ntohl(r->ssrc));
+  uint16_t seq = ntohs(r->seq);
+  uint16_t udelta = seq - s->max_seq;
+  uint32_t ts = ntohl(r->ts);
+
+  s->c.packets++;
+  s->c.bytes += len;
+  s->last = now;
+  if (s->c.packets == 1) {
+    s->first = now;
+    stats_init_seq(s, seq);
+  }
+  else if (udelta == 0) {
+    s->c.dups++;
+    return;
+  }
+  else if (udelta < MAX_DROPOUT) {
+    /* in order, possibly with a gap: advance the window */
+    if (udelta >= STATS_WINDOW) memset(s->seen, 0, sizeof(s->seen));
+    else {
+      uint16_t q;
+
+      for (q = s->max_seq + 1; q != seq; q++) STATS_CLR(s, q);
+    }
+    if (seq < s->max_seq) {
+      s->cycles += RTP_SEQ_MOD;
+      s->c.wraps++;
+    }
+    s->max_seq = seq;
+    STATS_SET(s, seq);
+  }
+  else if (udelta <= RTP_SEQ_MOD - MAX_MISORDER) {
+    /* a large jump: restart only if the next packet follows it */
+    if (seq != s->bad_seq) {
+      s->bad_seq = (seq + 1) & (RTP_SEQ_MOD - 1);
+      return;
+    }
+    stats_init_seq(s, seq);
+    s->have_last = 0;
+  }
+  else {
+    /* behind the highest number, and within the window */
+    if (STATS_BIT(s, seq)) {
+      s->c.dups++;
+      return;
+    }
+    STATS_SET(s, seq);
+    s->c.reordered++;
+  }
+  s->c.unique++;
+
+  /* interarrival jitter (RFC 3550, 6.4.1), if the clock rate is known */
+  if (r->pt != s->pt) {
+    s->pt = r->pt;
+    s->rate = pt_rate(s->pt);
+    s->have_last = 0;
+  }
+  if (s->rate) {
+    double arrival = now * s->rate;
+
+    if (s->have_last) {
+      double d = (arrival - s->last_arrival) - (int32_t)(ts - s->last_ts);
+
+      if (d < 0) d = -d;
+      s->jitter += (d - s->jitter) / 16.;
+    }
+    s->last_arrival = arrival;
+    s->last_ts   = ts;
+    s->have_last = 1;
+  }
+} /* stats_packet */
+
+
+void stats_line(FILE *out, const char *when, source_t *s,
+  stats_count_t *prior)
+{
+  long expected = (long)(stats_expected(s) - prior->expected);
+  long lost = expected - (long)(s->c.unique - prior->unique);
+
+  fprintf(out, "%s ssrc=0x%08lx pt=%d packets=%lu bytes=%lu lost=%ld "
+    "loss=%.2f%% dup=%lu reorder=%lu wraps=%lu",
+    when, (unsigned long)s->ssrc, s->pt, s->c.packets - prior->packets,
+    s->c.bytes - prior->bytes, lost,
+    expected > 0 ? 100. * lost / expected : 0.,
+    s->c.dups - prior->dups, s->c.reordered - prior->reordered,
+    s->c.wraps - prior->wraps);
+  if (s->rate) fprintf(out, " jitter=%.3fms\n", s->jitter * 1000. / s->rate);
+  else fprintf(out, " jitter=-\n");
+} /* stats_line */
@@ -0,0 +1,96 @@
+/*
+ * (c) 1998-2018 by Columbia University; all rights reserved
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Per-SSRC statistics of RTP packets, as printed by rtpdump -F stats
+ * and rtpstats. Include "rtp.h" first.
+ *
+ * Sources are kept in a hash table and, for printing in order of
+ * appearance, in a list. Sequence numbers are tracked as in RFC 3550,
+ * appendix A.1; a bitmap of the last STATS_WINDOW sequence numbers
+ * tells duplicates from late packets. A table is only used by one
+ * thread at a time.
+ */
+#define STATS_BUCKETS 256               /* must be power of 2 */
+#define STATS_WINDOW  1024              /* must be a multiple of 32 */
+
+typedef struct stats_count {
+  unsigned long packets;        /* all packets received */
+  unsigned long bytes;
+  unsigned long unique;         /* packets not seen before */
+  unsigned long dups;
+  unsigned long reordered;      /* arrived after a higher number */
+  unsigned long wraps;          /* sequence number wraps */
+  unsigned long expected;       /* see stats_expected() */
+} stats_count_t;
+
+typedef struct source {
+  uint32_t ssrc;
+  int pt;                       /* payload type of last packet */
+  unsigned rate;                /* its clock rate, 0 if unknown */
+  uint16_t max_seq;             /* highest sequence number seen */
+  uint32_t cycles;              /* wraps of max_seq, shifted by 16 */
+  uint32_t base_seq;            /* first extended sequence number */
+  uint32_t bad_seq;             /* expected after a jump, see A.1 */
+  stats_count_t c, prior;       /* totals; totals at last interval */
+  double jitter;                /* RFC 3550 jitter, timestamp units */
+  double last_arrival;          /* in timestamp units */
+  uint32_t last_ts;
+  int have_last;
+  double first, last;           /* arrival of first and last packet */
+  uint32_t seen[STATS_WINDOW / 32];
+  struct source *next;          /* hash chain */
+  struct source *list;          /* order of appearance */
+} source_t;
+
+typedef struct stats_table {
+  source_t *table[STATS_BUCKETS];
+  source_t *first, **last;      /* list in order of appearance */
+} stats_table_t;
+
+extern void stats_init(stats_table_t *t);
+extern void stats_free(stats_table_t *t);
+
+/*
+ * Account RTP packet 'r' of 'len' bytes arriving at 'now' seconds.
+ */
+extern void stats_packet(stats_table_t *t, rtp_hdr_t *r, int len,
+  double now);
+
+/*
+ * Return the number of packets expected from source 's' so far.
+ */
+extern unsigned long stats_expected(source_t *s);
+
+/*
+ * Print one line for source 's' with the counts since 'prior'.
+ */
+extern void stats_line(FILE *out, const char *when, source_t *s,
+  stats_count_t *prior);
@@ -47,6 +47,12 @@
 #define HAVE_LSOCKET		0
 #define HAVE_BIGENDIAN		0
 #define HAVE_MSGCONTROL		0
+#define HAVE_EPOLL		0
+#define HAVE_EPOLL_PWAIT2	0
+#define HAVE_IO_URING		0
+#define HAVE_SOCKFILTER		0
+#define HAVE_UDP_SEGMENT	0
+#define HAVE_PTHREAD		0
 #define RTP_BIG_ENDIAN		0
 
 #include <winsock2.h>
@@ -58,6 +64,8 @@
 
 #define strcasecmp _stricmp
 #define strncasecmp _strnicmp
+#define fseeko _fseeki64
+#define ftello _ftelli64
 
 #ifndef SIGHUP
 #define SIGHUP SIGINT
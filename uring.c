@@ -0,0 +1,604 @@
+/*
+uring  --  io_uring engine for the notifier: multishot receives into a
+           ring of provided buffers, and sends that are queued and
+           submitted in batches.
+
+Only the kernel headers are needed; the ring is set up with the raw
+system calls rather than through liburing. This file is empty unless
+HAVE_IO_URING is set.
+*/
+
+#include "sysdep.h"
+
+#if HAVE_IO_URING
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <netinet/in.h>
+#include <linux/io_uring.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "notify.h"
+#include "uring.h"
+
+#define RING_ENTRIES 256  /* submission queue entries */
+#define SEND_SLOTS   256  /* sends in flight */
+#define RECV_BUFS    256  /* provided receive buffers, a power of 2 */
+#define RECV_BGID    0    /* buffer group of the receive buffers */
+
+/*
+ * A received buffer holds a header, the source address, control
+ * messages (room for the SO_RXQ_OVFL drop counter) and the data.
+ */
+#define RECV_NAME    sizeof(struct sockaddr_in)
+#define RECV_CTL     CMSG_SPACE(sizeof(uint32_t))
+#define RECV_HDR     (sizeof(struct io_uring_recvmsg_out) + \
+                      RECV_NAME + RECV_CTL)
+#define RECV_BUFSZ   (RECV_HDR + NOTIFY_RECV_MAX)
+
+/* user_data of an SQE: operation in the upper, argument in the lower half */
+#define OP_SEND      0
+#define OP_RECV      1
+#define OP_CANCEL    2
+#define TAG(op, arg) (((uint64_t)(op) << 32) | (uint32_t)(arg))
+
+/* a send in flight keeps its own copy of the data and address */
+struct slot {
+  struct msghdr msg;
+  struct iovec iov;
+  struct sockaddr_in to;
+  char *buf;
+  int size;
+  Notify_func_sent func;
+  Notify_client client;
+  int fd;
+  int next;                 /* next free or queued slot, -1 if none */
+};
+
+/*
+ * The sends of one descriptor. Sends submitted together are hard-linked
+ * into a chain, which the kernel runs in order even if it has to finish
+ * one of them asynchronously; later ones wait here until the chain is
+ * done, so datagrams leave in the order they were given.
+ */
+struct sendq {
+  int head, tail;           /* queued slots, -1 if none */
+  int inflight;             /* sends of the chain not completed */
+};
+
+struct uring {
+  int ring;
+  Uring_recv_func recv_func;
+  void *arg;                /* first argument of recv_func */
+
+  struct {
+    unsigned *head, *tail, *mask, *array;
+    unsigned entries;
+    unsigned local_tail;    /* filled in, not yet visible to the kernel */
+    unsigned pending;       /* visible, not yet submitted */
+    struct io_uring_sqe *sqes;
+    char *ring_ptr;
+    size_t ring_len;
+  } sq;
+
+  struct {
+    unsigned *head, *tail, *mask;
+    struct io_uring_cqe *cqes;
+    char *ring_ptr;         /* NULL if shared with the SQ ring */
+    size_t ring_len;
+  } cq;
+
+  struct io_uring_buf_ring *br;  /* NULL: receiving not supported */
+  char *recv_mem;
+  unsigned br_tail;
+  struct msghdr recv_msg;        /* layout of received buffers */
+
+  struct slot slot[SEND_SLOTS];
+  int free_slot;
+  struct sendq *sendq;      /* by descriptor */
+  int sendq_len;
+  int *ready;               /* descriptors with queued sends */
+  int nready;
+};
+
+
+static int sys_setup(unsigned entries, struct io_uring_params *p)
+{
+  return (int)syscall(__NR_io_uring_setup, entries, p);
+} /* sys_setup */
+
+static int sys_enter(int ring, unsigned to_submit, unsigned min_complete,
+  unsigned flags)
+{
+  return (int)syscall(__NR_io_uring_enter, ring, to_submit, min_complete,
+    flags, NULL, 0);
+} /* sys_enter */
+
+static int sys_register(int ring, unsigned opcode, void *arg,
+  unsigned nr_args)
+{
+  return (int)syscall(__NR_io_uring_register, ring, opcode, arg, nr_args);
+} /* sys_register */
+
+
+/*
+* Hand receive buffer 'bid' (back) to the kernel.
+*/
+static void buf_add(struct uring *u, unsigned bid)
+{
+  struct io_uring_buf *b = &u->br->bufs[u->br_tail & (RECV_BUFS - 1)];
+
+  b->addr = (uintptr_t)(u->recv_mem + bid * RECV_BUFSZ);
+  b->len  = RECV_BUFSZ;
+  b->bid  = bid;
+  u->br_tail++;
+  __atomic_store_n(&u->br->tail, (uint16_t)u->br_tail, __ATOMIC_RELEASE);
+} /* buf_add */
+
+
+/*
+* Register the ring of provided receive buffers.
+* Return -1 if the kernel does not support them.
+*/
+static int buf_init(struct uring *u)
+{
+  struct io_uring_buf_reg reg;
+  unsigned i;
+
+  u->br = (struct io_uring_buf_ring *)mmap(NULL,
+    RECV_BUFS * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE,
+    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (u->br == MAP_FAILED) {
+    u->br = NULL;
+    return -1;
+  }
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr    = (uintptr_t)u->br;
+  reg.ring_entries = RECV_BUFS;
+  reg.bgid         = RECV_BGID;
+  if (!(u->recv_mem = (char *)malloc(RECV_BUFS * RECV_BUFSZ)) ||
+      sys_register(u->ring, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+    munmap(u->br, RECV_BUFS * sizeof(struct io_uring_buf));
+    free(u->recv_mem);
+    u->br = NULL;
+    u->recv_mem = NULL;
+    return -1;
+  }
+  for (i = 0; i < RECV_BUFS; i++) buf_add(u, i);
+
+  u->recv_msg.msg_namelen    = RECV_NAME;
+  u->recv_msg.msg_controllen = RECV_CTL;
+  return 0;
+} /* buf_init */
+
+
+/*
+* Set up a ring. Received datagrams will be passed to func(arg, ...).
+* Return NULL if io_uring is not available.
+*/
+struct uring *uring_init(Uring_recv_func func, void *arg)
+{
+  struct io_uring_params p;
+  struct uring *u;
+  char *sq_ptr, *cq_ptr;
+  int i;
+
+  if (!(u = (struct uring *)calloc(1, sizeof(*u)))) return NULL;
+  memset(&p, 0, sizeof(p));
+  if ((u->ring = sys_setup(RING_ENTRIES, &p)) < 0) {
+    free(u);
+    return NULL;
+  }
+
+  u->sq.ring_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  u->cq.ring_len = p.cq_off.cqes +
+    p.cq_entries * sizeof(struct io_uring_cqe);
+  if ((p.features & IORING_FEAT_SINGLE_MMAP) &&
+      u->cq.ring_len > u->sq.ring_len)
+    u->sq.ring_len = u->cq.ring_len;
+  sq_ptr = (char *)mmap(NULL, u->sq.ring_len, PROT_READ | PROT_WRITE,
+    MAP_SHARED | MAP_POPULATE, u->ring, IORING_OFF_SQ_RING);
+  if (sq_ptr == MAP_FAILED) goto fail;
+  u->sq.ring_ptr = sq_ptr;
+  if (p.features & IORING_FEAT_SINGLE_MMAP) cq_ptr = sq_ptr;
+  else {
+    cq_ptr = (char *)mmap(NULL, u->cq.ring_len, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, u->ring, IORING_OFF_CQ_RING);
+    if (cq_ptr == MAP_FAILED) goto fail;
+    u->cq.ring_ptr = cq_ptr;
+  }
+  u->sq.sqes = (struct io_uring_sqe *)mmap(NULL,
+    p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+    MAP_SHARED | MAP_POPULATE, u->ring, IORING_OFF_SQES);
+  if (u->sq.sqes == MAP_FAILED) {
+    u->sq.sqes = NULL;
+    goto fail;
+  }
+
+  u->sq.head    = (unsigned *)(sq_ptr + p.sq_off.head);
+  u->sq.tail    = (unsigned *)(sq_ptr + p.sq_off.tail);
+  u->sq.mask    = (unsigned *)(sq_ptr + p.sq_off.ring_mask);
+  u->sq.array   = (unsigned *)(sq_ptr + p.sq_off.array);
+  u->sq.entries = p.sq_entries;
+  u->sq.local_tail = *u->sq.tail;
+  u->cq.head    = (unsigned *)(cq_ptr + p.cq_off.head);
+  u->cq.tail    = (unsigned *)(cq_ptr + p.cq_off.tail);
+  u->cq.mask    = (unsigned *)(cq_ptr + p.cq_off.ring_mask);
+  u->cq.cqes    = (struct io_uring_cqe *)(cq_ptr + p.cq_off.cqes);
+
+  for (i = 0; i < SEND_SLOTS; i++) u->slot[i].next = i + 1;
+  u->slot[SEND_SLOTS - 1].next = -1;
+  u->free_slot = 0;
+
+  /* without provided buffers, we can still send */
+  buf_init(u);
+  u->recv_func = func;
+  u->arg       = arg;
+  return u;
+
+fail:
+  perror("io_uring mmap");
+  uring_free(u);
+  return NULL;
+} /* uring_init */
+
+
+/*
+* Tear down ring 'u'. Sends not yet submitted are lost.
+*/
+void uring_free(struct uring *u)
+{
+  int i;
+
+  if (!u) return;
+  if (u->sq.sqes)
+    munmap(u->sq.sqes, u->sq.entries * sizeof(struct io_uring_sqe));
+  if (u->sq.ring_ptr) munmap(u->sq.ring_ptr, u->sq.ring_len);
+  if (u->cq.ring_ptr) munmap(u->cq.ring_ptr, u->cq.ring_len);
+  close(u->ring);
+  if (u->br) munmap(u->br, RECV_BUFS * sizeof(struct io_uring_buf));
+  free(u->recv_mem);
+  for (i = 0; i < SEND_SLOTS; i++) free(u->slot[i].buf);
+  free(u->sendq);
+  free(u->ready);
+  free(u);
+} /* uring_free */
+
+
+/*
+* Descriptor that becomes readable when completions are waiting.
+*/
+int uring_fd(struct uring *u)
+{
+  return u->ring;
+} /* uring_fd */
+
+
+/*
+* Number of free submission queue entries.
+*/
+static unsigned sq_room(struct uring *u)
+{
+  return u->sq.entries -
+    (u->sq.local_tail - __atomic_load_n(u->sq.head, __ATOMIC_ACQUIRE));
+} /* sq_room */
+
+
+/*
+* Take the next submission queue entry, which must be free, and clear
+* it.
+*/
+static struct io_uring_sqe *next_sqe(struct uring *u)
+{
+  struct io_uring_sqe *sqe;
+  unsigned i;
+
+  i = u->sq.local_tail & *u->sq.mask;
+  sqe = &u->sq.sqes[i];
+  memset(sqe, 0, sizeof(*sqe));
+  u->sq.array[i] = i;
+  u->sq.local_tail++;
+  return sqe;
+} /* next_sqe */
+
+
+/*
+* Get a cleared submission queue entry, or NULL if the queue is full.
+*/
+static struct io_uring_sqe *get_sqe(struct uring *u)
+{
+  if (sq_room(u) == 0) {
+    uring_submit(u);
+    if (sq_room(u) == 0) return NULL;
+  }
+  return next_sqe(u);
+} /* get_sqe */
+
+
+/*
+* Put the queued sends of each descriptor that has none in flight into
+* the submission queue, as one chain. If the queue fills up, the rest
+* follow with the next chain.
+*/
+static void send_chains(struct uring *u)
+{
+  struct io_uring_sqe *sqe;
+  struct sendq *q;
+  struct slot *s;
+  int i, k = 0;
+
+  for (i = 0; i < u->nready; i++) {
+    q = &u->sendq[u->ready[i]];
+    if (q->inflight == 0) {
+      sqe = NULL;
+      while (q->head >= 0 && sq_room(u) > 0) {
+        s = &u->slot[q->head];
+        sqe = next_sqe(u);
+        sqe->opcode    = IORING_OP_SENDMSG;
+        sqe->fd        = s->fd;
+        sqe->addr      = (uintptr_t)&s->msg;
+        sqe->len       = 1;
+        sqe->flags     = IOSQE_IO_HARDLINK;  /* errors do not break it */
+        sqe->user_data = TAG(OP_SEND, s - u->slot);
+        q->head = s->next;
+        q->inflight++;
+      }
+      if (sqe) sqe->flags = 0;  /* the chain ends here */
+    }
+    if (q->head >= 0) u->ready[k++] = u->ready[i];
+    else q->tail = -1;
+  }
+  u->nready = k;
+} /* send_chains */
+
+
+/*
+* Submit all queued entries with a single system call.
+*/
+void uring_submit(struct uring *u)
+{
+  int n;
+
+  send_chains(u);
+  if (*u->sq.tail != u->sq.local_tail) {
+    u->sq.pending += u->sq.local_tail - *u->sq.tail;
+    __atomic_store_n(u->sq.tail, u->sq.local_tail, __ATOMIC_RELEASE);
+  }
+  while (u->sq.pending) {
+    n = sys_enter(u->ring, u->sq.pending, 0, 0);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      /* EAGAIN, EBUSY: retried on the next call */
+      if (errno != EAGAIN && errno != EBUSY) perror("io_uring_enter");
+      return;
+    }
+    u->sq.pending -= n;
+  }
+} /* uring_submit */
+
+
+/*
+* Start receiving datagrams from 'fd' until cancelled.
+* Return -1 if this is not possible.
+*/
+int uring_recv(struct uring *u, int fd)
+{
+  struct io_uring_sqe *sqe;
+
+  if (!u->br || !(sqe = get_sqe(u))) return -1;
+  sqe->opcode    = IORING_OP_RECVMSG;
+  sqe->fd        = fd;
+  sqe->addr      = (uintptr_t)&u->recv_msg;
+  sqe->len       = 1;
+  sqe->ioprio    = IORING_RECV_MULTISHOT;
+  sqe->flags     = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = RECV_BGID;
+  sqe->user_data = TAG(OP_RECV, fd);
+  return 0;
+} /* uring_recv */
+
+
+/*
+* Stop receiving from 'fd'.
+*/
+void uring_recv_cancel(struct uring *u, int fd)
+{
+  struct io_uring_sqe *sqe;
+
+  if (!(sqe = get_sqe(u))) return;
+  sqe->opcode    = IORING_OP_ASYNC_CANCEL;
+  sqe->fd        = -1;
+  sqe->addr      = TAG(OP_RECV, fd);
+  sqe->user_data = TAG(OP_CANCEL, fd);
+} /* uring_recv_cancel */
+
+
+/*
+* Make room in the send queue table for descriptor 'fd'.
+*/
+static int sendq_grow(struct uring *u, int fd)
+{
+  int len = u->sendq_len ? u->sendq_len : 16;
+  struct sendq *q;
+  int *r, i;
+
+  while (len <= fd) len *= 2;
+  if (!(q = (struct sendq *)realloc(u->sendq, len * sizeof(*q)))) return -1;
+  u->sendq = q;
+  if (!(r = (int *)realloc(u->ready, len * sizeof(*r)))) return -1;
+  u->ready = r;
+  for (i = u->sendq_len; i < len; i++) {
+    q[i].head = q[i].tail = -1;
+    q[i].inflight = 0;
+  }
+  u->sendq_len = len;
+  return 0;
+} /* sendq_grow */
+
+
+/*
+* Queue 'len' bytes from 'buf' to be sent on 'fd', to address 'to' or,
+* if 'to' is NULL, to the connected peer. The data is copied; it goes
+* to the kernel with the next uring_submit(), after the earlier sends
+* on 'fd'. A failure is reported later to 'func', if not NULL. If all
+* slots are in use, wait for one to complete rather than have the
+* caller send directly, ahead of the queued data.
+* Return 'len', or -1 if the send could not be queued.
+*/
+int uring_send(struct uring *u, int fd, const char *buf, int len,
+  struct sockaddr_in *to, Notify_func_sent func, Notify_client client)
+{
+  struct sendq *q;
+  struct slot *s;
+  int i;
+
+  if (fd < 0 || (fd >= u->sendq_len && sendq_grow(u, fd) < 0)) return -1;
+  if (u->free_slot < 0) {
+    uring_submit(u);
+    uring_reap(u);
+    while (u->free_slot < 0) {
+      uring_submit(u);
+      if (sys_enter(u->ring, 0, 1, IORING_ENTER_GETEVENTS) < 0 &&
+          errno != EINTR) return -1;
+      uring_reap(u);
+    }
+  }
+  s = &u->slot[u->free_slot];
+  if (s->size < len) {
+    char *b = (char *)realloc(s->buf, len);
+
+    if (!b) return -1;
+    s->buf  = b;
+    s->size = len;
+  }
+  i = u->free_slot;
+  u->free_slot = s->next;
+
+  memcpy(s->buf, buf, len);
+  s->iov.iov_base = s->buf;
+  s->iov.iov_len  = len;
+  memset(&s->msg, 0, sizeof(s->msg));
+  s->msg.msg_iov    = &s->iov;
+  s->msg.msg_iovlen = 1;
+  if (to) {
+    s->to = *to;
+    s->msg.msg_name    = &s->to;
+    s->msg.msg_namelen = sizeof(s->to);
+  }
+  s->func   = func;
+  s->client = client;
+  s->fd     = fd;
+  s->next   = -1;
+
+  q = &u->sendq[fd];
+  if (q->head < 0) {
+    q->head = i;
+    u->ready[u->nready++] = fd;
+  }
+  else u->slot[q->tail].next = i;
+  q->tail = i;
+  return len;
+} /* uring_send */
+
+
+/*
+* Hand a completed receive to the receive function and recycle its
+* buffer. The receive is re-armed if the kernel ended it.
+*/
+static void recv_done(struct uring *u, int fd, int res, unsigned flags)
+{
+  struct io_uring_recvmsg_out *o;
+  struct sockaddr_in from;
+  struct msghdr msg;
+  struct cmsghdr *c;
+  long drops;
+  unsigned bid;
+  char *b;
+  int len;
+
+  if (flags & IORING_CQE_F_BUFFER) {
+    bid = flags >> IORING_CQE_BUFFER_SHIFT;
+    b = u->recv_mem + bid * RECV_BUFSZ;
+    if (res >= 0) {
+      o = (struct io_uring_recvmsg_out *)b;
+      memset(&from, 0, sizeof(from));
+      memcpy(&from, b + sizeof(*o),
+        o->namelen < sizeof(from) ? o->namelen : sizeof(from));
+      len = o->payloadlen;
+      if (len > NOTIFY_RECV_MAX) len = NOTIFY_RECV_MAX;  /* truncated */
+
+      drops = -1;
+      memset(&msg, 0, sizeof(msg));
+      msg.msg_control    = b + sizeof(*o) + RECV_NAME;
+      msg.msg_controllen = o->controllen;
+      for (c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+        if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SO_RXQ_OVFL)
+          drops = *(uint32_t *)CMSG_DATA(c);
+      }
+      u->recv_func(u->arg, fd, b + RECV_HDR, len, &from, drops);
+    }
+    buf_add(u, bid);
+  }
+  else if (res < 0 && res != -ENOBUFS && res != -ECANCELED) {
+    u->recv_func(u->arg, fd, NULL, res, NULL, -1);
+    return;
+  }
+
+  /* out of buffers or ended for another reason: start over */
+  if (!(flags & IORING_CQE_F_MORE) && res != -ECANCELED) uring_recv(u, fd);
+} /* recv_done */
+
+
+/*
+* Process all waiting completions. Return their number.
+*/
+int uring_reap(struct uring *u)
+{
+  struct io_uring_cqe *cqe;
+  unsigned head, flags;
+  uint64_t data;
+  int res, n = 0;
+
+  /* handlers may call us again, so consume each entry before using it */
+  while ((head = *u->cq.head) !=
+         __atomic_load_n(u->cq.tail, __ATOMIC_ACQUIRE)) {
+    cqe   = &u->cq.cqes[head & *u->cq.mask];
+    data  = cqe->user_data;
+    res   = cqe->res;
+    flags = cqe->flags;
+    __atomic_store_n(u->cq.head, head + 1, __ATOMIC_RELEASE);
+    n++;
+
+    switch (data >> 32) {
+    case OP_SEND: {
+      struct slot *s = &u->slot[(uint32_t)data];
+      Notify_func_sent func = s->func;
+      Notify_client client  = s->client;
+
+      u->sendq[s->fd].inflight--;
+      s->next = u->free_slot;
+      u->free_slot = s - u->slot;
+      if (res < 0) {
+        if (func) func(client, -res);
+        else fprintf(stderr, "send: %s\n", strerror(-res));
+      }
+      break;
+    }
+    case OP_RECV:
+      recv_done(u, (int)(uint32_t)data, res, flags);
+      break;
+    default:
+      break;
+    }
+  }
+  return n;
+} /* uring_reap */
+
+#endif /* HAVE_IO_URING */
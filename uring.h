@@ -0,0 +1,19 @@
+/*
+ * io_uring engine used by the notifier; see uring.c.
+ * Only available if HAVE_IO_URING is set.
+ */
+struct uring;
+
+/* 'drops' is the SO_RXQ_OVFL counter if the kernel sent it, else -1 */
+typedef void (*Uring_recv_func)(void *arg, int fd, char *buf, int len,
+  struct sockaddr_in *from, long drops);
+
+extern struct uring *uring_init(Uring_recv_func func, void *arg);
+extern void uring_free(struct uring *u);
+extern int  uring_fd(struct uring *u);
+extern int  uring_recv(struct uring *u, int fd);
+extern void uring_recv_cancel(struct uring *u, int fd);
+extern int  uring_send(struct uring *u, int fd, const char *buf, int len,
+  struct sockaddr_in *to, Notify_func_sent func, Notify_client client);
+extern void uring_submit(struct uring *u);
+extern int  uring_reap(struct uring *u);
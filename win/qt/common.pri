@@ -22,6 +22,7 @@ win32 {
         $$ROOT_PATH/multimer.c \
         $$ROOT_PATH/notify.c \
         $$ROOT_PATH/payload.c \
+        $$ROOT_PATH/lz.c \
         $$ROOT_PATH/rd.c \
         $$ROOT_PATH/winsocklib.c
 }